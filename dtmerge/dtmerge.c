@@ -27,10 +27,39 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <libfdt.h>
 
 #include "dtoverlay.h"
 
+#define MAX_DTB_SIZE 200000
+
+typedef struct overlay_blob_struct
+{
+    struct overlay_blob_struct *next;
+    DTBLOB_T *dtb;
+    char filename[0];
+} OVERLAY_BLOB_T;
+
+typedef struct merge_job_struct
+{
+    const DTBLOB_T *base_dtb;    // Shared, read-only
+    const DTBLOB_T *overlay_dtb; // Shared, read-only (NULL for no overlay)
+    char *overrides;             // Comma-separated, or NULL
+    char *output_file;
+    int err;
+} MERGE_JOB_T;
+
+typedef struct merge_pool_struct
+{
+    pthread_mutex_t lock;
+    DTOVL_BATCH_T *batch;
+    MERGE_JOB_T *jobs;
+    int num_jobs;
+    int next_job;
+} MERGE_POOL_T;
+
 static void usage(void)
 {
     printf("Usage:\n");
@@ -38,13 +67,18 @@ static void usage(void)
     printf("        to apply a parameter to the base dtb, without an overlay (like dtparam)\n");
     printf("    dtmerge [<options] <base dtb> <merged dtb> <overlay dtb> [param=value] ...\n");
     printf("        to apply an overlay, optionally with parameters (like dtoverlay)\n");
+    printf("    dtmerge [<options] -m <out dir> <base dtb>... -- <config>...\n");
+    printf("        to apply every config to every base dtb, writing <out dir>/<base>-<name>.dtb\n");
+    printf("        where <config> is [<name>=]<overlay dtb>|-[,param=value]...\n");
     printf("  where <options> is any of:\n");
     printf("    -d      Enable debug output\n");
     printf("    -h      Show this help message\n");
+    printf("    -j <n>  Use <n> worker threads with -m (default: one per CPU)\n");
     exit(1);
 }
 
-static int apply_override(DTBLOB_T *base_dtb, DTBLOB_T *overlay_dtb, char *override)
+static int apply_override(DTOVL_CTX_T *ctx, DTBLOB_T *base_dtb,
+                          DTBLOB_T *overlay_dtb, char *override)
 {
     char *param_name = override;
     char *param_value = param_name + strcspn(param_name, "=");
@@ -67,7 +101,7 @@ static int apply_override(DTBLOB_T *base_dtb, DTBLOB_T *overlay_dtb, char *overr
                         &data_len);
     if (override_data)
     {
-        err = dtoverlay_apply_override(overlay_dtb, param_name,
+        err = dtoverlay_ctx_apply_override(ctx, overlay_dtb, param_name,
                         override_data, data_len,
                         param_value);
     }
@@ -76,7 +110,7 @@ static int apply_override(DTBLOB_T *base_dtb, DTBLOB_T *overlay_dtb, char *overr
         override_data = dtoverlay_find_override(base_dtb, param_name, &data_len);
         if (override_data)
         {
-            err = dtoverlay_apply_override(base_dtb, param_name,
+            err = dtoverlay_ctx_apply_override(ctx, base_dtb, param_name,
                             override_data, data_len,
                             param_value);
         }
@@ -90,47 +124,138 @@ static int apply_override(DTBLOB_T *base_dtb, DTBLOB_T *overlay_dtb, char *overr
     return err;
 }
 
-int main(int argc, char **argv)
+/* Apply a comma-separated list of overrides, which is modified in place */
+static int apply_overrides(DTOVL_CTX_T *ctx, DTBLOB_T *base_dtb,
+                           DTBLOB_T *overlay_dtb, char *overrides)
+{
+    int err = 0;
+
+    while (!err && overrides)
+    {
+        char *override = overrides;
+        char *end;
+        int len = strcspn(override, ",");
+        end = override + len;
+        if (*end == ',' && *(end + 1))
+            overrides = end + 1;
+        else
+            overrides = NULL;
+        *end = '\0';
+        if (len)
+            err = apply_override(ctx, base_dtb, overlay_dtb, override);
+    }
+
+    return err;
+}
+
+static void add_synonyms(DTBLOB_T *base_dtb)
+{
+    if (!dtoverlay_get_alias(base_dtb, "i2c"))
+    {
+        dtoverlay_set_synonym(base_dtb, "i2c_arm", "i2c0");
+        dtoverlay_set_synonym(base_dtb, "i2c_vc", "i2c1");
+        dtoverlay_set_synonym(base_dtb, "i2c_baudrate", "i2c0_baudrate");
+        dtoverlay_set_synonym(base_dtb, "i2c_arm_baudrate", "i2c0_baudrate");
+        dtoverlay_set_synonym(base_dtb, "i2c_vc_baudrate", "i2c1_baudrate");
+    }
+}
+
+static void init_map(DTOVL_CTX_T *ctx, DTBLOB_T *base_dtb,
+                     const char *overlay_file)
 {
-    const char *base_file;
-    const char *merged_file;
-    const char *overlay_file;
     const char *compatible;
     char *overlay_dir;
     char *p;
-    DTBLOB_T *base_dtb;
-    DTBLOB_T *overlay_dtb;
-    int err = 0;
-    int argn = 1;
-    int max_dtb_size = 200000;
     int compatible_len;
 
-    while ((argn < argc) && (argv[argn][0] == '-'))
+    overlay_dir = strdup(overlay_file);
+    p = strrchr(overlay_dir, '/');
+    if (p)
+        *p = 0;
+    else
+        strcpy(overlay_dir, ".");
+
+    compatible = dtoverlay_get_property(base_dtb,
+                                        dtoverlay_find_node(base_dtb, "/", 1),
+                                        "compatible", &compatible_len);
+    dtoverlay_ctx_init_map(ctx, overlay_dir, compatible, compatible_len);
+    free(overlay_dir);
+}
+
+/* Apply any remapping of the overlay, rewriting the filename in new_file
+   and returning any parameters from the map (or NULL) in *map_overrides.
+   Returns 0 on success, otherwise non-zero. */
+static int remap_overlay(DTOVL_CTX_T *ctx, const char *overlay_file,
+                         char *new_file, char **map_overrides)
+{
+    char *overlay_name;
+    const char *new_name;
+    char *p;
+    int len, new_len;
+
+    *map_overrides = NULL;
+
+    if (strnlen(overlay_file, DTOVERLAY_MAX_PATH) == DTOVERLAY_MAX_PATH)
     {
-        const char *arg = argv[argn++];
-        if ((strcmp(arg, "-d") == 0) ||
-            (strcmp(arg, "--debug") == 0))
-            dtoverlay_enable_debug(1);
-        else if ((strcmp(arg, "-h") == 0) ||
-                 (strcmp(arg, "--help") == 0))
-            usage();
-        else
-        {
-            printf("* Unknown option '%s'\n", arg);
-            usage();
-        }
+        printf("* overlay filename too long\n");
+        return -1;
     }
 
-    if (argc < (argn + 3))
+    strcpy(new_file, overlay_file);
+    overlay_name = strrchr(new_file, '/');
+    if (overlay_name)
+        overlay_name++;
+    else
+        overlay_name = new_file;
+    p = strrchr(overlay_name, '.');
+    if (p)
+        *p = 0;
+    new_name = dtoverlay_ctx_remap_overlay(ctx, overlay_name);
+    if (!new_name)
+        return -2;
+
+    len = strlen(overlay_name);
+    new_len = strcspn(new_name, ",");
+    if (new_name[new_len] && new_name[new_len + 1])
     {
-        usage();
+        /* There are parameters */
+        *map_overrides = strdup(new_name + new_len + 1);
+    }
+    if (new_len != len || memcmp(overlay_name, new_name, len))
+    {
+        dtoverlay_debug("mapped overlay '%s' to '%.*s'",
+                        overlay_name, new_len, new_name);
+        memcpy(overlay_name, new_name, new_len);
     }
 
+    if ((overlay_name - new_file) + new_len + 6 > DTOVERLAY_MAX_PATH)
+    {
+        printf("* overlay filename too long\n");
+        free(*map_overrides);
+        *map_overrides = NULL;
+        return -1;
+    }
+    strcpy(overlay_name + new_len, ".dtbo");
+
+    return 0;
+}
+
+static int merge_single(int argc, char **argv)
+{
+    const char *base_file;
+    const char *merged_file;
+    const char *overlay_file;
+    DTOVL_CTX_T *ctx;
+    DTBLOB_T *base_dtb;
+    DTBLOB_T *overlay_dtb;
+    int err = 0;
+    int argn = 0;
+
     base_file = argv[argn++];
     merged_file = argv[argn++];
     overlay_file = argv[argn++];
 
-    base_dtb = dtoverlay_load_dtb(base_file, max_dtb_size);
+    base_dtb = dtoverlay_load_dtb(base_file, MAX_DTB_SIZE);
     if (!base_dtb)
     {
         printf("* failed to load '%s'\n", base_file);
@@ -143,26 +268,12 @@ int main(int argc, char **argv)
         return -1;
     }
 
-    overlay_dir = strdup(overlay_file);
-    p = strrchr(overlay_dir, '/');
-    if (p)
-        *p = 0;
-    else
-        overlay_dir = ".";
-
-    compatible = dtoverlay_get_property(base_dtb,
-                                        dtoverlay_find_node(base_dtb, "/", 1),
-                                        "compatible", &compatible_len);
-    dtoverlay_init_map(overlay_dir, compatible, compatible_len);
+    ctx = dtoverlay_ctx_create(NULL);
+    if (!ctx)
+        return -1;
 
-    if (!dtoverlay_get_alias(base_dtb, "i2c"))
-    {
-        err = dtoverlay_set_synonym(base_dtb, "i2c_arm", "i2c0");
-        err = dtoverlay_set_synonym(base_dtb, "i2c_vc", "i2c1");
-        err = dtoverlay_set_synonym(base_dtb, "i2c_baudrate", "i2c0_baudrate");
-        err = dtoverlay_set_synonym(base_dtb, "i2c_arm_baudrate", "i2c0_baudrate");
-        err = dtoverlay_set_synonym(base_dtb, "i2c_vc_baudrate", "i2c1_baudrate");
-    };
+    init_map(ctx, base_dtb, overlay_file);
+    add_synonyms(base_dtb);
 
     if (strcmp(overlay_file, "-") == 0)
     {
@@ -171,74 +282,35 @@ int main(int argc, char **argv)
     else
     {
         char new_file[DTOVERLAY_MAX_PATH];
-        char *overlay_name;
-        const char *new_name;
-        char *p;
-
-        strcpy(new_file, overlay_file);
-        overlay_name = strrchr(new_file, '/');
-        if (overlay_name)
-            overlay_name++;
-        else
-            overlay_name = new_file;
-        p = strrchr(overlay_name, '.');
-        if (p)
-            *p = 0;
-        new_name = dtoverlay_remap_overlay(overlay_name);
-        if (new_name)
-        {
-            char *overrides = NULL;
-            int len = strlen(overlay_name);
-            int new_len = strcspn(new_name, ",");
-            if (new_name[new_len] && new_name[new_len + 1])
-            {
-                /* There are parameters */
-                overrides = strdup(new_name + new_len + 1);
-            }
-            if (new_len != len || memcmp(overlay_name, new_name, len))
-            {
-                dtoverlay_debug("mapped overlay '%s' to '%.*s'",
-                                overlay_name, new_len, new_name);
-                memcpy(overlay_name, new_name, new_len);
-            }
+        char *overrides;
 
-            strcpy(overlay_name + new_len, ".dtbo");
-
-            overlay_dtb = dtoverlay_load_dtb(new_file, max_dtb_size);
+        err = remap_overlay(ctx, overlay_file, new_file, &overrides);
+        if (!err)
+        {
+            overlay_dtb = dtoverlay_load_dtb(new_file, MAX_DTB_SIZE);
             if (overlay_dtb)
                 err = dtoverlay_fixup_overlay(base_dtb, overlay_dtb);
             else
                 err = -1;
 
-            while (!err && overrides)
-            {
-                char *override = overrides;
-                char *end;
-                len = strcspn(override, ",");
-                end = override + len;
-                if (*end == ',' && *(end + 1))
-                    overrides = end + 1;
-                else
-                    overrides = NULL;
-                *end = '\0';
-                err = apply_override(base_dtb, overlay_dtb, override);
-            }
+            if (!err)
+                err = apply_overrides(ctx, base_dtb, overlay_dtb, overrides);
+            free(overrides);
         }
         else
         {
             overlay_dtb = NULL;
-            err = -2;
         }
     }
 
     while (!err && (argn < argc))
     {
-        err = apply_override(base_dtb, overlay_dtb, argv[argn++]);
+        err = apply_override(ctx, base_dtb, overlay_dtb, argv[argn++]);
     }
 
     if (!err && (overlay_dtb != base_dtb))
     {
-        err = dtoverlay_merge_overlay(base_dtb, overlay_dtb);
+        err = dtoverlay_ctx_merge_overlay(ctx, base_dtb, overlay_dtb);
 
         dtoverlay_free_dtb(overlay_dtb);
     }
@@ -246,10 +318,431 @@ int main(int argc, char **argv)
     if (!err)
     {
         dtoverlay_pack_dtb(base_dtb);
-        err = dtoverlay_save_dtb(base_dtb, merged_file);
+        err = dtoverlay_save_dtb_atomic(base_dtb, merged_file);
+    }
+
+    dtoverlay_free_dtb(base_dtb);
+    dtoverlay_ctx_free(ctx);
+
+    return err;
+}
+
+/* Returns a pointer to the basename of the first path_len characters of
+   path, and its length excluding any extension through *len. */
+static const char *file_stem(const char *path, int path_len, int *len)
+{
+    const char *name = path;
+    const char *ext = NULL;
+    int i;
+
+    for (i = 0; i < path_len; i++)
+    {
+        if (path[i] == '/')
+            name = path + i + 1, ext = NULL;
+        else if (path[i] == '.')
+            ext = path + i;
+    }
+    *len = (ext ? ext : path + path_len) - name;
+    return name;
+}
+
+/* Returns a pointer to the overlay field of a matrix config, of the form
+   [<name>=]<overlay dtb>[,param=value]..., and its length through *len */
+static const char *config_overlay(const char *config, int *len)
+{
+    int name_len = strcspn(config, "=,");
+    const char *overlay_file = config;
+
+    if (config[name_len] == '=')
+        overlay_file += name_len + 1;
+    *len = strcspn(overlay_file, ",");
+    return overlay_file;
+}
+
+static OVERLAY_BLOB_T *find_overlay_blob(OVERLAY_BLOB_T **blobs,
+                                         const char *filename)
+{
+    OVERLAY_BLOB_T *blob;
+
+    for (blob = *blobs; blob; blob = blob->next)
+    {
+        if (strcmp(blob->filename, filename) == 0)
+            return blob;
+    }
+
+    blob = malloc(sizeof(OVERLAY_BLOB_T) + strlen(filename) + 1);
+    if (!blob)
+        return NULL;
+
+    /* Load it at its natural size - each job takes its own padded copy */
+    blob->dtb = dtoverlay_load_dtb(filename, 0);
+    if (!blob->dtb)
+    {
+        free(blob);
+        return NULL;
+    }
+    strcpy(blob->filename, filename);
+    blob->next = *blobs;
+    *blobs = blob;
+    return blob;
+}
+
+static int run_job(DTOVL_CTX_T *ctx, DTOVL_BATCH_T *batch, MERGE_JOB_T *job)
+{
+    DTBLOB_T *base_dtb;
+    DTBLOB_T *overlay_dtb;
+    int err = 0;
+
+    base_dtb = dtoverlay_clone_dtb(job->base_dtb, MAX_DTB_SIZE);
+    if (!base_dtb)
+        return -1;
+
+    if (job->overlay_dtb)
+    {
+        overlay_dtb = dtoverlay_clone_dtb(job->overlay_dtb, MAX_DTB_SIZE);
+        if (overlay_dtb)
+            err = dtoverlay_fixup_overlay(base_dtb, overlay_dtb);
+        else
+            err = -1;
+    }
+    else
+    {
+        overlay_dtb = base_dtb;
+    }
+
+    if (!err && job->overrides)
+        err = apply_overrides(ctx, base_dtb, overlay_dtb, job->overrides);
+
+    if (!err && (overlay_dtb != base_dtb))
+        err = dtoverlay_ctx_merge_overlay(ctx, base_dtb, overlay_dtb);
+
+    if (overlay_dtb != base_dtb)
+        dtoverlay_free_dtb(overlay_dtb);
+
+    if (!err)
+    {
+        dtoverlay_pack_dtb(base_dtb);
+        err = dtoverlay_batch_save_dtb(batch, base_dtb, job->output_file);
     }
 
     dtoverlay_free_dtb(base_dtb);
 
     return err;
 }
+
+static void *merge_worker(void *arg)
+{
+    MERGE_POOL_T *pool = arg;
+    DTOVL_CTX_T *ctx = dtoverlay_ctx_create(NULL);
+
+    while (ctx)
+    {
+        MERGE_JOB_T *job;
+
+        pthread_mutex_lock(&pool->lock);
+        job = (pool->next_job < pool->num_jobs) ?
+            &pool->jobs[pool->next_job++] : NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (!job)
+            break;
+
+        job->err = run_job(ctx, pool->batch, job);
+        if (job->err)
+            printf("* failed to create '%s'\n", job->output_file);
+        else
+            dtoverlay_debug("created '%s'", job->output_file);
+    }
+
+    dtoverlay_ctx_free(ctx);
+    return NULL;
+}
+
+static int merge_matrix(const char *out_dir, int num_threads,
+                        int argc, char **argv)
+{
+    OVERLAY_BLOB_T *blobs = NULL;
+    DTOVL_CTX_T *ctx = NULL;
+    DTBLOB_T **base_dtbs;
+    MERGE_POOL_T pool;
+    pthread_t *threads = NULL;
+    char **configs;
+    int num_bases, num_configs;
+    int map_config = -1;
+    int err = 0;
+    int i, j;
+
+    for (num_bases = 0; num_bases < argc; num_bases++)
+    {
+        if (strcmp(argv[num_bases], "--") == 0)
+            break;
+    }
+    configs = argv + num_bases + 1;
+    num_configs = argc - num_bases - 1;
+    if (!num_bases || num_configs <= 0)
+        usage();
+
+    /* The overlay map is found alongside the first overlay */
+    for (j = 0; j < num_configs; j++)
+    {
+        int len;
+        const char *overlay_file = config_overlay(configs[j], &len);
+        if (len != 1 || overlay_file[0] != '-')
+        {
+            map_config = j;
+            break;
+        }
+    }
+
+    base_dtbs = calloc(num_bases, sizeof(DTBLOB_T *));
+    pool.jobs = calloc(num_bases * num_configs, sizeof(MERGE_JOB_T));
+    pool.num_jobs = 0;
+    pool.next_job = 0;
+    if (!base_dtbs || !pool.jobs)
+    {
+        printf("* out of memory\n");
+        err = -1;
+    }
+
+    /* The remapping depends on the platform of each base dtb, but the map
+       is only loaded once. */
+    if (!err)
+    {
+        ctx = dtoverlay_ctx_create(NULL);
+        if (!ctx)
+            err = -1;
+    }
+
+    /* Load everything and resolve the overlay names up front, so that the
+       workers only ever read the shared blobs. */
+    for (i = 0; !err && i < num_bases; i++)
+    {
+        const char *base_name;
+        int base_len;
+
+        base_dtbs[i] = dtoverlay_load_dtb(argv[i], MAX_DTB_SIZE);
+        if (!base_dtbs[i])
+        {
+            printf("* failed to load '%s'\n", argv[i]);
+            err = -1;
+            break;
+        }
+        add_synonyms(base_dtbs[i]);
+        base_name = file_stem(argv[i], strlen(argv[i]), &base_len);
+
+        if (map_config >= 0)
+        {
+            int len;
+            const char *overlay_file = config_overlay(configs[map_config], &len);
+            char *file = strndup(overlay_file, len);
+            if (file)
+            {
+                init_map(ctx, base_dtbs[i], file);
+                free(file);
+            }
+        }
+
+        for (j = 0; j < num_configs; j++)
+        {
+            MERGE_JOB_T *job = &pool.jobs[pool.num_jobs];
+            const char *config = configs[j];
+            const char *overlay_file;
+            const char *params;
+            const char *config_name = NULL;
+            char *map_overrides = NULL;
+            int overlay_len, config_name_len = 0;
+
+            overlay_file = config_overlay(config, &overlay_len);
+            if (overlay_file != config)
+            {
+                config_name = config;
+                config_name_len = overlay_file - config - 1;
+            }
+            params = overlay_file + overlay_len;
+            if (*params)
+                params++;
+
+            job->base_dtb = base_dtbs[i];
+            if (overlay_len == 1 && overlay_file[0] == '-')
+            {
+                if (!config_name)
+                {
+                    config_name = "base";
+                    config_name_len = 4;
+                }
+                job->overlay_dtb = NULL;
+            }
+            else
+            {
+                char new_file[DTOVERLAY_MAX_PATH];
+                char *file;
+                OVERLAY_BLOB_T *blob;
+
+                if (!config_name)
+                    config_name = file_stem(overlay_file, overlay_len,
+                                            &config_name_len);
+                file = strndup(overlay_file, overlay_len);
+                if (!file || remap_overlay(ctx, file, new_file, &map_overrides))
+                {
+                    free(file);
+                    err = -2;
+                    break;
+                }
+                free(file);
+                blob = find_overlay_blob(&blobs, new_file);
+                if (!blob)
+                {
+                    printf("* failed to load '%s'\n", new_file);
+                    free(map_overrides);
+                    err = -1;
+                    break;
+                }
+                job->overlay_dtb = blob->dtb;
+            }
+
+            if (map_overrides || *params)
+            {
+                int len = (map_overrides ? strlen(map_overrides) : 0) + 1 +
+                    strlen(params) + 1;
+                job->overrides = malloc(len);
+                if (job->overrides)
+                    snprintf(job->overrides, len, "%s,%s",
+                             map_overrides ? map_overrides : "", params);
+                else
+                    err = -1;
+                free(map_overrides);
+            }
+
+            job->output_file = malloc(strlen(out_dir) + base_len +
+                                      config_name_len + 7);
+            if (!job->output_file || err)
+            {
+                free(job->overrides);
+                free(job->output_file);
+                memset(job, 0, sizeof(*job));
+                printf("* out of memory\n");
+                err = -1;
+                break;
+            }
+            sprintf(job->output_file, "%s/%.*s-%.*s.dtb", out_dir,
+                    base_len, base_name, config_name_len, config_name);
+            pool.num_jobs++;
+        }
+    }
+
+    dtoverlay_ctx_free(ctx);
+
+    if (!err)
+    {
+        if (num_threads > pool.num_jobs)
+            num_threads = pool.num_jobs;
+        threads = calloc(num_threads, sizeof(pthread_t));
+        if (!threads)
+        {
+            printf("* out of memory\n");
+            err = -1;
+        }
+    }
+
+    if (!err)
+    {
+        pool.batch = dtoverlay_batch_create();
+        if (!pool.batch)
+            err = -1;
+    }
+
+    if (!err)
+    {
+        int started = 0;
+
+        pthread_mutex_init(&pool.lock, NULL);
+        for (i = 0; i < num_threads; i++)
+        {
+            if (pthread_create(&threads[i], NULL, merge_worker, &pool) != 0)
+                break;
+            started++;
+        }
+        /* If no threads could be started, do the work here */
+        if (!started)
+            merge_worker(&pool);
+        for (i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+        pthread_mutex_destroy(&pool.lock);
+
+        for (i = 0; i < pool.num_jobs; i++)
+        {
+            if (pool.jobs[i].err && !err)
+                err = pool.jobs[i].err;
+        }
+
+        /* Publish the successful merges together */
+        if (dtoverlay_batch_commit(pool.batch) != 0 && !err)
+            err = -2;
+        dtoverlay_batch_free(pool.batch);
+    }
+
+    free(threads);
+    for (i = 0; i < pool.num_jobs; i++)
+    {
+        free(pool.jobs[i].overrides);
+        free(pool.jobs[i].output_file);
+    }
+    free(pool.jobs);
+
+    while (blobs)
+    {
+        OVERLAY_BLOB_T *blob = blobs;
+        blobs = blob->next;
+        dtoverlay_free_dtb(blob->dtb);
+        free(blob);
+    }
+
+    for (i = 0; base_dtbs && i < num_bases; i++)
+        dtoverlay_free_dtb(base_dtbs[i]);
+    free(base_dtbs);
+
+    return err;
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_dir = NULL;
+    int num_threads = 0;
+    int argn = 1;
+
+    while ((argn < argc) && (argv[argn][0] == '-'))
+    {
+        const char *arg = argv[argn++];
+        if ((strcmp(arg, "-d") == 0) ||
+            (strcmp(arg, "--debug") == 0))
+            dtoverlay_enable_debug(1);
+        else if ((strcmp(arg, "-h") == 0) ||
+                 (strcmp(arg, "--help") == 0))
+            usage();
+        else if ((strcmp(arg, "-m") == 0) && (argn < argc))
+            out_dir = argv[argn++];
+        else if ((strcmp(arg, "-j") == 0) && (argn < argc))
+            num_threads = atoi(argv[argn++]);
+        else
+        {
+            printf("* Unknown option '%s'\n", arg);
+            usage();
+        }
+    }
+
+    if (out_dir)
+    {
+        if (num_threads <= 0)
+            num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (num_threads <= 0)
+            num_threads = 1;
+        return merge_matrix(out_dir, num_threads, argc - argn, argv + argn);
+    }
+
+    if (argc < (argn + 3))
+    {
+        usage();
+    }
+
+    return merge_single(argc - argn, argv + argn);
+}
@@ -25,10 +25,17 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#define _GNU_SOURCE // For syncfs
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <libfdt.h>
 #include <assert.h>
 
@@ -51,14 +58,54 @@ typedef enum
 #define DTOVERRIDE_OVERLAY 5
 #define DTOVERRIDE_BYTE_STRING 6
 
-static int dtoverlay_extract_override(const char *override_name,
+typedef enum
+{
+    REMAP_KEEP,        // Supported on this platform as-is
+    REMAP_SUBSTITUTE,  // Replaced on this platform (possibly with parameters)
+    REMAP_RENAMED,     // Renamed on all platforms
+    REMAP_DEPRECATED,  // No longer supported
+    REMAP_UNSUPPORTED  // Not supported on this platform
+} remap_type_t;
+
+typedef struct remap_entry_struct
+{
+    const char *name; // NULL for an unused slot
+    int name_len;
+    remap_type_t type;
+    const char *value;
+} REMAP_ENTRY_T;
+
+struct dtovl_ctx_struct
+{
+    DTBLOB_T *overlay_map;
+    char *map_file;
+    const char *platform_name;
+    int platform_name_len;
+
+    // The overlay map resolved for platform_name, as an open-addressed hash
+    // table with a power-of-two size.
+    REMAP_ENTRY_T *remap_table;
+    unsigned int remap_size;
+
+    dtovl_cell_changed_callback_t cell_changed_callback;
+    dtovl_intra_fragment_merged_callback_t intra_fragment_merged_callback;
+    void *user_data;
+
+    // Per-override scratch state
+    const void *override_data_start;
+    const void *cell_source;
+};
+
+static int dtoverlay_extract_override(DTOVL_CTX_T *ctx,
+                                      const char *override_name,
                                       char *override_value, int value_size,
                                       int *phandle_ptr,
                                       const char **datap, const char *dataendp,
                                       const char **namep, int *namelenp,
                                       int *offp, int *sizep);
 
-static const char *dtoverlay_lookup_key(const char *lookup_string, const char *data_end,
+static const char *dtoverlay_lookup_key(DTOVL_CTX_T *ctx,
+                                        const char *lookup_string, const char *data_end,
                                         const char *key, char *buf, int buf_len);
 
 static int dtoverlay_set_node_name(DTBLOB_T *dtb, int node_off,
@@ -69,17 +116,16 @@ static void dtoverlay_stdio_logging(dtoverlay_logging_type_t type,
 
 #define phandle_debug if (0) dtoverlay_debug
 
+// The logging function and debug flag are process-wide - set them before
+// starting any threads.
 static DTOVERLAY_LOGGING_FUNC *dtoverlay_logging_func = dtoverlay_stdio_logging;
 static int dtoverlay_debug_enabled = 0;
-static DTBLOB_T *overlay_map;
-static const char *platform_name;
-static int platform_name_len;
 
-static void (*cell_changed_callback)(DTBLOB_T *, int, const char *, int, int);
-static void (*intra_fragment_merged_callback)(DTBLOB_T *, int, int);
+// The context used by the original (context-free) API
+static DTOVL_CTX_T default_ctx;
 
-static const void *override_data_start;
-static const void *cell_source;
+static void (*legacy_cell_changed_callback)(DTBLOB_T *, int, const char *, int, int);
+static void (*legacy_intra_fragment_merged_callback)(DTBLOB_T *, int, int);
 
 static int strmemcmp(const char *mem, int mem_len, const char *str)
 {
@@ -1148,6 +1194,13 @@ static int dtoverlay_apply_overlay_paths(DTBLOB_T *base_dtb, int strings_off,
 
 // Returns 0 on success, -ve for fatal errors and +ve for non-fatal errors
 int dtoverlay_merge_overlay(DTBLOB_T *base_dtb, DTBLOB_T *overlay_dtb)
+{
+    return dtoverlay_ctx_merge_overlay(&default_ctx, base_dtb, overlay_dtb);
+}
+
+// Returns 0 on success, -ve for fatal errors and +ve for non-fatal errors
+int dtoverlay_ctx_merge_overlay(DTOVL_CTX_T *ctx, DTBLOB_T *base_dtb,
+                                DTBLOB_T *overlay_dtb)
 {
     // Merge each fragment node
     int frag_off;
@@ -1196,8 +1249,9 @@ int dtoverlay_merge_overlay(DTBLOB_T *base_dtb, DTBLOB_T *overlay_dtb)
         // as source and destination because the source is not expected to
         // change. Instead, clone the overlay, apply the fragment, then switch.
 
-        if (intra_fragment_merged_callback)
-            (*intra_fragment_merged_callback)(overlay_dtb, overlay_off, target_off);
+        if (ctx->intra_fragment_merged_callback)
+            (*ctx->intra_fragment_merged_callback)(ctx, overlay_dtb, overlay_off,
+                                                   target_off);
 
         if (!overlay_copy)
         {
@@ -1619,14 +1673,71 @@ int dtoverlay_stringlist_replace(const char *src, int src_len,
     return dst_p - dst;
 }
 
+DTOVL_CTX_T *dtoverlay_ctx_create(void *user_data)
+{
+    DTOVL_CTX_T *ctx = calloc(1, sizeof(DTOVL_CTX_T));
+    if (!ctx)
+    {
+        dtoverlay_error("out of memory");
+        return NULL;
+    }
+    ctx->user_data = user_data;
+    return ctx;
+}
+
+void dtoverlay_ctx_free(DTOVL_CTX_T *ctx)
+{
+    if (ctx && ctx != &default_ctx)
+    {
+        dtoverlay_ctx_reset_map(ctx);
+        free(ctx);
+    }
+}
+
+void *dtoverlay_ctx_user_data(DTOVL_CTX_T *ctx)
+{
+    return ctx->user_data;
+}
+
+void dtoverlay_ctx_set_intra_fragment_merged_callback(DTOVL_CTX_T *ctx,
+                                                      dtovl_intra_fragment_merged_callback_t callback)
+{
+    ctx->intra_fragment_merged_callback = callback;
+}
+
+void dtoverlay_ctx_set_cell_changed_callback(DTOVL_CTX_T *ctx,
+                                             dtovl_cell_changed_callback_t callback)
+{
+    ctx->cell_changed_callback = callback;
+}
+
+static void legacy_intra_fragment_merged(DTOVL_CTX_T *ctx, DTBLOB_T *dtb,
+                                         int fragment_off, int target_off)
+{
+    UNUSED(ctx);
+    (*legacy_intra_fragment_merged_callback)(dtb, fragment_off, target_off);
+}
+
+static void legacy_cell_changed(DTOVL_CTX_T *ctx, DTBLOB_T *dtb, int node_off,
+                                const char *prop_name, int target_off,
+                                int cell_data_offset)
+{
+    UNUSED(ctx);
+    (*legacy_cell_changed_callback)(dtb, node_off, prop_name, target_off,
+                                    cell_data_offset);
+}
+
 void dtoverlay_set_intra_fragment_merged_callback(void (*callback)(DTBLOB_T *, int, int))
 {
-    intra_fragment_merged_callback = callback;
+    legacy_intra_fragment_merged_callback = callback;
+    default_ctx.intra_fragment_merged_callback =
+        callback ? legacy_intra_fragment_merged : NULL;
 }
 
 void dtoverlay_set_cell_changed_callback(void (*callback)(DTBLOB_T *, int, const char *, int, int))
 {
-    cell_changed_callback = callback;
+    legacy_cell_changed_callback = callback;
+    default_ctx.cell_changed_callback = callback ? legacy_cell_changed : NULL;
 }
 
 /* Returns a pointer to the override data and (through data_len) its length.
@@ -1690,6 +1801,20 @@ int dtoverlay_override_one_target(int override_type,
                                   const char *prop_name, int target_phandle,
                                   int target_off, int target_size,
                                   void *callback_state)
+{
+    return dtoverlay_ctx_override_one_target(&default_ctx, override_type,
+                                             override_value, dtb, node_off,
+                                             prop_name, target_phandle,
+                                             target_off, target_size,
+                                             callback_state);
+}
+
+int dtoverlay_ctx_override_one_target(DTOVL_CTX_T *ctx, int override_type,
+                                      const char *override_value,
+                                      DTBLOB_T *dtb, int node_off,
+                                      const char *prop_name, int target_phandle,
+                                      int target_off, int target_size,
+                                      void *callback_state)
 {
     UNUSED(target_phandle);
     UNUSED(callback_state);
@@ -1993,9 +2118,11 @@ int dtoverlay_override_one_target(int override_type,
         }
     }
 
-    if (!err && cell_changed_callback && cell_source && override_type == DTOVERRIDE_INTEGER && target_size == 4)
-        (*cell_changed_callback)(dtb, node_off, prop_name, target_off,
-                                 (int)(cell_source - override_data_start));
+    if (!err && ctx->cell_changed_callback && ctx->cell_source &&
+        override_type == DTOVERRIDE_INTEGER && target_size == 4)
+        (*ctx->cell_changed_callback)(ctx, dtb, node_off, prop_name, target_off,
+                                      (int)((const char *)ctx->cell_source -
+                                            (const char *)ctx->override_data_start));
 
     return err;
 }
@@ -2025,11 +2152,13 @@ int dtoverlay_override_one_target(int override_type,
 
 // Returns 0 on success, -ve for fatal errors and +ve for non-fatal errors
 // After calling this, assume all node offsets are no longer valid
-int dtoverlay_foreach_override_target(DTBLOB_T *dtb, const char *override_name,
-                                      const char *override_data, int data_len,
-                                      const char *override_value,
-                                      override_callback_t callback,
-                                      void *callback_state)
+static int dtoverlay_foreach_target(DTOVL_CTX_T *ctx, DTBLOB_T *dtb,
+                                    const char *override_name,
+                                    const char *override_data, int data_len,
+                                    const char *override_value,
+                                    override_callback_t callback,
+                                    dtovl_ctx_override_callback_t ctx_callback,
+                                    void *callback_state)
 {
     int err = 0;
     int target_phandle = 0;
@@ -2051,13 +2180,13 @@ int dtoverlay_foreach_override_target(DTBLOB_T *dtb, const char *override_name,
     memcpy(data_buf, override_data, data_len);
     data = data_buf;
     data_end = data + data_len;
-    override_data_start = data_buf;
+    ctx->override_data_start = data_buf;
 
     while (err == 0)
     {
         const char *target_prop = NULL;
-        static char prop_name[256];
-        static char target_value[256];
+        char prop_name[256];
+        char target_value[256];
         int name_len = 0;
         int target_off = 0;
         int target_size = 0;
@@ -2065,7 +2194,7 @@ int dtoverlay_foreach_override_target(DTBLOB_T *dtb, const char *override_name,
         int node_off = 0;
 
         strcpy(target_value, override_value);
-        override_type = dtoverlay_extract_override(override_name,
+        override_type = dtoverlay_extract_override(ctx, override_name,
                                                    target_value, sizeof(target_value),
                                                    &target_phandle,
                                                    (const char **)&data, data_end,
@@ -2095,36 +2224,86 @@ int dtoverlay_foreach_override_target(DTBLOB_T *dtb, const char *override_name,
             memcpy(prop_name, target_prop, name_len);
             prop_name[name_len] = '\0';
         }
+        else
+        {
+            prop_name[0] = '\0';
+        }
 
         /* Pass DTOVERRIDE_END to the callback, in case it is interested */
-        err = callback(override_type, target_value, dtb, node_off, prop_name,
-                       target_phandle, target_off, target_size,
-                       callback_state);
+        if (ctx_callback)
+            err = ctx_callback(ctx, override_type, target_value, dtb, node_off,
+                               prop_name, target_phandle, target_off,
+                               target_size, callback_state);
+        else
+            err = callback(override_type, target_value, dtb, node_off, prop_name,
+                           target_phandle, target_off, target_size,
+                           callback_state);
 
         if (override_type == DTOVERRIDE_END)
             break;
     }
 
     free(data_buf);
+    ctx->override_data_start = NULL;
+    ctx->cell_source = NULL;
 
     return err;
 }
 
+// Returns 0 on success, -ve for fatal errors and +ve for non-fatal errors
+// After calling this, assume all node offsets are no longer valid
+int dtoverlay_foreach_override_target(DTBLOB_T *dtb, const char *override_name,
+                                      const char *override_data, int data_len,
+                                      const char *override_value,
+                                      override_callback_t callback,
+                                      void *callback_state)
+{
+    return dtoverlay_foreach_target(&default_ctx, dtb, override_name,
+                                    override_data, data_len, override_value,
+                                    callback, NULL, callback_state);
+}
+
+// Returns 0 on success, -ve for fatal errors and +ve for non-fatal errors
+// After calling this, assume all node offsets are no longer valid
+int dtoverlay_ctx_foreach_override_target(DTOVL_CTX_T *ctx, DTBLOB_T *dtb,
+                                          const char *override_name,
+                                          const char *override_data, int data_len,
+                                          const char *override_value,
+                                          dtovl_ctx_override_callback_t callback,
+                                          void *callback_state)
+{
+    return dtoverlay_foreach_target(ctx, dtb, override_name,
+                                    override_data, data_len, override_value,
+                                    NULL, callback, callback_state);
+}
+
 // Returns 0 on success, -ve for fatal errors and +ve for non-fatal errors
 int dtoverlay_apply_override(DTBLOB_T *dtb, const char *override_name,
                              const char *override_data, int data_len,
                              const char *override_value)
 {
-    return dtoverlay_foreach_override_target(dtb, override_name,
-                                             override_data, data_len,
-                                             override_value,
-                                             dtoverlay_override_one_target,
-                                             NULL);
+    return dtoverlay_ctx_apply_override(&default_ctx, dtb, override_name,
+                                        override_data, data_len,
+                                        override_value);
+}
+
+// Returns 0 on success, -ve for fatal errors and +ve for non-fatal errors
+int dtoverlay_ctx_apply_override(DTOVL_CTX_T *ctx, DTBLOB_T *dtb,
+                                 const char *override_name,
+                                 const char *override_data, int data_len,
+                                 const char *override_value)
+{
+    return dtoverlay_ctx_foreach_override_target(ctx, dtb, override_name,
+                                                 override_data, data_len,
+                                                 override_value,
+                                                 dtoverlay_ctx_override_one_target,
+                                                 NULL);
 }
 
 /* Returns an override type (DTOVERRIDE_INTEGER, DTOVERRIDE_BOOLEAN, DTOVERRIDE_STRING, DTOVERRIDE_OVERLAY),
    DTOVERRIDE_END (0) at the end, or an error code (< 0) */
-static int dtoverlay_extract_override(const char *override_name,
+static int dtoverlay_extract_override(DTOVL_CTX_T *ctx,
+                                      const char *override_name,
                                       char *override_value, int value_size,
                                       int *phandle_ptr,
                                       const char **datap, const char *data_end,
@@ -2139,7 +2318,7 @@ static int dtoverlay_extract_override(const char *override_name,
     char literal_type = '?';
     int type;
 
-    cell_source = NULL;
+    ctx->cell_source = NULL;
 
     data = *datap;
     len = data_end - data;
@@ -2315,14 +2494,14 @@ static int dtoverlay_extract_override(const char *override_name,
             {
                 /* Cell */
                 sprintf(override_value, "%u", dtoverlay_read_u32(data, 0));
-                cell_source = data;
+                ctx->cell_source = data;
                 *datap = data + 4;
             }
         }
         else if (literal_type == '{')
         {
             /* Lookup */
-            data = dtoverlay_lookup_key(literal_value, data_end,
+            data = dtoverlay_lookup_key(ctx, literal_value, data_end,
                                         override_value, override_value, value_size);
             *datap = data;
             if (!data)
@@ -2358,7 +2537,8 @@ static int dtoverlay_extract_override(const char *override_name,
 
 /* Read the string or (if permitted) cell value, storing the result in buf. Returns a pointer
    to the first byte after the successfully parsed immediate, or NULL on error. */
-static const char *dtoverlay_extract_immediate(const char *data, const char *data_end,
+static const char *dtoverlay_extract_immediate(DTOVL_CTX_T *ctx,
+                                               const char *data, const char *data_end,
                                                char *buf, int buf_len)
 {
     if ((data + 1) < data_end && !data[0])
@@ -2373,7 +2553,7 @@ static const char *dtoverlay_extract_immediate(const char *data, const char *dat
         val = dtoverlay_read_u32(data, 0);
         if (buf)
         {
-            cell_source = data;
+            ctx->cell_source = data;
             snprintf(buf, buf_len, "%d", val);
         }
         data += 4;
@@ -2425,7 +2605,8 @@ static const char *dtoverlay_extract_immediate(const char *data, const char *dat
     return data;
 }
 
-static const char *dtoverlay_lookup_key(const char *lookup_string, const char *data_end,
+static const char *dtoverlay_lookup_key(DTOVL_CTX_T *ctx,
+                                        const char *lookup_string, const char *data_end,
                                         const char *key, char *buf, int buf_len)
 {
     const char *p = lookup_string;
@@ -2461,7 +2642,7 @@ static const char *dtoverlay_lookup_key(const char *lookup_string, const char *d
 
         if (sep == '=')
         {
-            p = dtoverlay_extract_immediate(p + 1, data_end, q, buf_len);
+            p = dtoverlay_extract_immediate(ctx, p + 1, data_end, q, buf_len);
         }
         else
         {
@@ -2724,6 +2905,58 @@ DTBLOB_T *dtoverlay_load_dtb_from_fp(FILE *fp, int max_size)
     return NULL;
 }
 
+// Returns a private, writable copy of a DTB, which can be used while other
+// threads are cloning the same source. Any trailer is shared with the source,
+// so the source must outlive the clone. max_size has the same meaning as for
+// dtoverlay_load_dtb.
+DTBLOB_T *dtoverlay_clone_dtb(const DTBLOB_T *src_dtb, int max_size)
+{
+    DTBLOB_T *dtb = NULL;
+    void *fdt = NULL;
+    int len = fdt_totalsize(src_dtb->fdt);
+
+    if (max_size > 0)
+    {
+        if (max_size < len)
+        {
+            dtoverlay_error("dtb too large (%d bytes) for max_size", len);
+            goto error_exit;
+        }
+    }
+    else if (max_size < 0)
+    {
+        max_size = len - max_size;
+    }
+    else
+    {
+        max_size = len;
+    }
+
+    fdt = malloc(max_size);
+    dtb = malloc(sizeof(DTBLOB_T));
+    if (!fdt || !dtb)
+    {
+        dtoverlay_error("out of memory");
+        goto error_exit;
+    }
+
+    memcpy(fdt, src_dtb->fdt, len);
+    if (max_size > len)
+        fdt_set_totalsize(fdt, max_size);
+
+    *dtb = *src_dtb;
+    dtb->fdt = fdt;
+    dtb->fdt_is_malloced = 1;
+    dtb->trailer_is_malloced = 0;
+
+    return dtb;
+
+  error_exit:
+    free(fdt);
+    free(dtb);
+    return NULL;
+}
+
 DTBLOB_T *dtoverlay_load_dtb(const char *filename, int max_size)
 {
     FILE *fp = fopen(filename, "rb");
@@ -2733,12 +2966,9 @@ DTBLOB_T *dtoverlay_load_dtb(const char *filename, int max_size)
     return NULL;
 }
 
-void dtoverlay_init_map_from_fp(FILE *fp, const char *compatible,
-                                int compatible_len)
+static const char *dtoverlay_find_platform(const char *compatible,
+                                           int compatible_len)
 {
-    if (!compatible)
-        return;
-
     while (compatible_len > 0)
     {
         const char *p;
@@ -2766,20 +2996,11 @@ void dtoverlay_init_map_from_fp(FILE *fp, const char *compatible,
             strncmp(p, "bcm2835", len) == 0 ||
             strncmp(p, "bcm2836", len) == 0 ||
             strncmp(p, "bcm2837", len) == 0)
-        {
-            platform_name = "bcm2835";
-            break;
-        }
+            return "bcm2835";
         else if (strncmp(p, "bcm2711", len) == 0)
-        {
-            platform_name = "bcm2711";
-            break;
-        }
+            return "bcm2711";
         else if (strncmp(p, "bcm2712", len) == 0)
-        {
-            platform_name = "bcm2712";
-            break;
-        }
+            return "bcm2712";
 
         compatible_len -= (p - compatible);
         compatible = p;
@@ -2789,95 +3010,280 @@ void dtoverlay_init_map_from_fp(FILE *fp, const char *compatible,
         compatible_len -= len;
     }
 
+    return NULL;
+}
+
+static uint32_t remap_hash(const char *name, int len)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    return hash;
+}
+
+static REMAP_ENTRY_T *remap_find_slot(DTOVL_CTX_T *ctx, const char *name,
+                                      int len)
+{
+    unsigned int mask = ctx->remap_size - 1;
+    unsigned int i = remap_hash(name, len) & mask;
+
+    while (ctx->remap_table[i].name)
+    {
+        REMAP_ENTRY_T *entry = &ctx->remap_table[i];
+        if (entry->name_len == len && memcmp(entry->name, name, len) == 0)
+            break;
+        i = (i + 1) & mask;
+    }
+
+    return &ctx->remap_table[i];
+}
+
+static const REMAP_ENTRY_T *remap_lookup(DTOVL_CTX_T *ctx, const char *name)
+{
+    const REMAP_ENTRY_T *entry;
+
+    if (!ctx->remap_table)
+        return NULL;
+    entry = remap_find_slot(ctx, name, strlen(name));
+    return entry->name ? entry : NULL;
+}
+
+// Resolve every overlay in the map for the current platform. The names and
+// values point into the map, which must outlive the table.
+static int dtoverlay_build_remap_table(DTOVL_CTX_T *ctx)
+{
+    const void *fdt = ctx->overlay_map->fdt;
+    unsigned int count = 0;
+    unsigned int i;
+    int node_off;
+
+    free(ctx->remap_table);
+    ctx->remap_table = NULL;
+    ctx->remap_size = 0;
+
+    fdt_for_each_subnode(node_off, fdt, 0)
+        count++;
+
+    // Keep the load factor at or below 50%
+    for (ctx->remap_size = 16; ctx->remap_size < count * 2; ctx->remap_size *= 2)
+        continue;
+
+    ctx->remap_table = calloc(ctx->remap_size, sizeof(REMAP_ENTRY_T));
+    if (!ctx->remap_table)
+    {
+        ctx->remap_size = 0;
+        dtoverlay_error("  out of memory");
+        return -FDT_ERR_NOSPACE;
+    }
+
+    fdt_for_each_subnode(node_off, fdt, 0)
+    {
+        REMAP_ENTRY_T *entry;
+        const char *name;
+        const char *value;
+        int name_len;
+
+        name = fdt_get_name(fdt, node_off, &name_len);
+        if (!name)
+            continue;
+        entry = remap_find_slot(ctx, name, name_len);
+        entry->name = name;
+        entry->name_len = name_len;
+
+        value = fdt_getprop_namelen(fdt, node_off, ctx->platform_name,
+                                    ctx->platform_name_len, NULL);
+        if (value)
+        {
+            entry->type = value[0] ? REMAP_SUBSTITUTE : REMAP_KEEP;
+            entry->value = value;
+            continue;
+        }
+
+        // Has it been renamed or deprecated?
+        value = fdt_getprop_namelen(fdt, node_off, "renamed", 7, NULL);
+        if (value)
+        {
+            entry->type = REMAP_RENAMED;
+            entry->value = value;
+            continue;
+        }
+
+        entry->value = fdt_getprop_namelen(fdt, node_off, "deprecated", 10, NULL);
+        entry->type = entry->value ? REMAP_DEPRECATED : REMAP_UNSUPPORTED;
+    }
+
+    // Collapse chains of renames. A rename with parameters is left alone,
+    // rather than have to deal with multiple sets of parameters.
+    for (i = 0; i < ctx->remap_size; i++)
+    {
+        REMAP_ENTRY_T *entry = &ctx->remap_table[i];
+        int hops;
+
+        if (!entry->name || entry->type != REMAP_RENAMED)
+            continue;
+
+        for (hops = 0; hops < 8 && !strchr(entry->value, ','); hops++)
+        {
+            const REMAP_ENTRY_T *next = remap_lookup(ctx, entry->value);
+            if (!next || next->type != REMAP_RENAMED || next == entry)
+                break;
+            entry->value = next->value;
+        }
+    }
+
+    dtoverlay_debug("overlay map resolved %u overlays for '%s'", count,
+                    ctx->platform_name);
+
+    return 0;
+}
+
+void dtoverlay_ctx_reset_map(DTOVL_CTX_T *ctx)
+{
+    free(ctx->remap_table);
+    ctx->remap_table = NULL;
+    ctx->remap_size = 0;
+    dtoverlay_free_dtb(ctx->overlay_map);
+    ctx->overlay_map = NULL;
+    free(ctx->map_file);
+    ctx->map_file = NULL;
+    ctx->platform_name = NULL;
+    ctx->platform_name_len = 0;
+}
+
+void dtoverlay_init_map_from_fp(FILE *fp, const char *compatible,
+                                int compatible_len)
+{
+    dtoverlay_ctx_init_map_from_fp(&default_ctx, fp, compatible,
+                                   compatible_len);
+}
+
+void dtoverlay_ctx_init_map_from_fp(DTOVL_CTX_T *ctx, FILE *fp,
+                                    const char *compatible, int compatible_len)
+{
+    const char *platform_name;
+
+    if (!compatible)
+    {
+        if (fp)
+            fclose(fp);
+        return;
+    }
+
+    dtoverlay_ctx_reset_map(ctx);
+
+    platform_name = dtoverlay_find_platform(compatible, compatible_len);
     if (platform_name)
     {
         dtoverlay_debug("using platform '%s'", platform_name);
-        platform_name_len = strlen(platform_name);
+        ctx->platform_name = platform_name;
+        ctx->platform_name_len = strlen(platform_name);
         if (fp)
-            overlay_map = dtoverlay_load_dtb_from_fp(fp, 0);
+        {
+            ctx->overlay_map = dtoverlay_load_dtb_from_fp(fp, 0);
+            fp = NULL;
+        }
+        if (ctx->overlay_map &&
+            dtoverlay_build_remap_table(ctx) != 0)
+        {
+            dtoverlay_free_dtb(ctx->overlay_map);
+            ctx->overlay_map = NULL;
+        }
     }
     else
     {
         dtoverlay_warn("no matching platform found");
     }
 
-    dtoverlay_debug("overlay map %sloaded", overlay_map ? "" : "not ");
+    if (fp)
+        fclose(fp);
+
+    dtoverlay_debug("overlay map %sloaded", ctx->overlay_map ? "" : "not ");
 }
 
 void dtoverlay_init_map(const char *overlay_dir, const char *compatible,
                         int compatible_len)
+{
+    dtoverlay_ctx_init_map(&default_ctx, overlay_dir, compatible,
+                           compatible_len);
+}
+
+// Loading the map and building the table is skipped if the same map file has
+// already been resolved for the same platform, and only the table is rebuilt
+// if just the platform has changed.
+void dtoverlay_ctx_init_map(DTOVL_CTX_T *ctx, const char *overlay_dir,
+                            const char *compatible, int compatible_len)
 {
     char map_file[DTOVERLAY_MAX_PATH];
+    const char *platform_name;
     int dir_len = strlen(overlay_dir);
     FILE *fp;
-    static int tried;
-
-    if (tried)
-        return;
-
-    tried = 1;
 
     if (!compatible)
         return;
 
     /* Handle the possibility that the supplied directory may or may not end
        with a slash */
-    sprintf(map_file, "%s%soverlay_map.dtb", overlay_dir,
-            (!dir_len || overlay_dir[dir_len - 1] != '/') ? "/" : "");
+    snprintf(map_file, sizeof(map_file), "%s%soverlay_map.dtb", overlay_dir,
+             (!dir_len || overlay_dir[dir_len - 1] != '/') ? "/" : "");
+
+    if (ctx->map_file && strcmp(ctx->map_file, map_file) == 0)
+    {
+        platform_name = dtoverlay_find_platform(compatible, compatible_len);
+        if (platform_name == ctx->platform_name)
+            return;
+        if (platform_name && ctx->overlay_map)
+        {
+            dtoverlay_debug("using platform '%s'", platform_name);
+            ctx->platform_name = platform_name;
+            ctx->platform_name_len = strlen(platform_name);
+            if (dtoverlay_build_remap_table(ctx) == 0)
+                return;
+        }
+    }
+
     fp = fopen(map_file, "rb");
-    dtoverlay_init_map_from_fp(fp, compatible, compatible_len);
+    dtoverlay_ctx_init_map_from_fp(ctx, fp, compatible, compatible_len);
+    ctx->map_file = strdup(map_file);
 }
 
 const char *dtoverlay_remap_overlay(const char *overlay)
 {
-    while (overlay_map)
-    {
-        const char *deprecated_msg;
-        const char *new_name;
-        int root_off;
-        int overlay_off;
-        int prop_len;
+    return dtoverlay_ctx_remap_overlay(&default_ctx, overlay);
+}
 
-        root_off = fdt_path_offset(overlay_map->fdt, "/");
+const char *dtoverlay_ctx_remap_overlay(DTOVL_CTX_T *ctx, const char *overlay)
+{
+    const REMAP_ENTRY_T *entry = remap_lookup(ctx, overlay);
 
-        overlay_off = fdt_subnode_offset(overlay_map->fdt, root_off, overlay);
-        if (overlay_off < 0)
-            break;
+    if (!entry)
+        return overlay;
 
-        new_name = fdt_getprop_namelen(overlay_map->fdt, overlay_off,
-                                       platform_name, platform_name_len,
-                                       &prop_len);
+    switch (entry->type)
+    {
+    case REMAP_KEEP:
+        return overlay;
 
-        if (new_name)
-        {
-            if (new_name[0])
-                overlay = new_name;
-            break;
-        }
+    case REMAP_SUBSTITUTE:
+        return entry->value;
 
-        // Has it been renamed or deprecated?
-        new_name = fdt_getprop_namelen(overlay_map->fdt, overlay_off,
-                                       "renamed", 7, &prop_len);
-        if (new_name)
-        {
-            dtoverlay_warn("overlay '%s' has been renamed '%s'",
-                           overlay, new_name);
-            overlay = new_name;
-            // Stop at a rename, rather than have to deal with multiple sets of parameters
-            break;
-        }
+    case REMAP_RENAMED:
+        dtoverlay_warn("overlay '%s' has been renamed '%s'",
+                       overlay, entry->value);
+        return entry->value;
 
-        deprecated_msg = fdt_getprop_namelen(overlay_map->fdt, overlay_off,
-                                             "deprecated", 10, &prop_len);
-        if (deprecated_msg)
-            dtoverlay_error("overlay '%s' is deprecated: %s",
-                            overlay, deprecated_msg);
-        else
-            dtoverlay_error("overlay '%s' is not supported on the '%s' platform", overlay, platform_name);
+    case REMAP_DEPRECATED:
+        dtoverlay_error("overlay '%s' is deprecated: %s",
+                        overlay, entry->value);
         return NULL;
-    }
 
-    return overlay;
+    default:
+        dtoverlay_error("overlay '%s' is not supported on the '%s' platform",
+                        overlay, ctx->platform_name);
+        return NULL;
+    }
 }
 
 DTBLOB_T *dtoverlay_import_fdt(void *fdt, int buf_size)
@@ -2966,6 +3372,422 @@ int dtoverlay_save_dtb(const DTBLOB_T *dtb, const char *filename)
     return err;
 }
 
+typedef struct pending_file_struct
+{
+    char *tmp_file;
+    char *filename;
+} PENDING_FILE_T;
+
+struct dtovl_batch_struct
+{
+    pthread_mutex_t lock;
+    PENDING_FILE_T *files;
+    int num_files;
+    int max_files;
+};
+
+#define DTOVERLAY_MAX_TMP_TRIES 100
+
+// Finds the file that saving to filename should replace. Returns 0 with the
+// (malloced) path in *target, following any symlink so that the file it
+// points to is replaced rather than the link, or 1 if filename must be
+// written in place because it isn't a regular file, is a dangling link or is
+// a device or process path such as /dev/stdout (which may be redirected to a
+// regular file), or a negative error code.
+static int dtoverlay_resolve_target(const char *filename, char **target)
+{
+    struct stat st;
+
+    *target = NULL;
+    if (strncmp(filename, "/dev/", 5) == 0 ||
+        strncmp(filename, "/proc/", 6) == 0)
+        return 1;
+    if (lstat(filename, &st) != 0)
+        *target = strdup(filename);
+    else if (S_ISREG(st.st_mode))
+        *target = strdup(filename);
+    else if (!S_ISLNK(st.st_mode) || stat(filename, &st) != 0 ||
+             !S_ISREG(st.st_mode))
+        return 1;
+    else
+        *target = realpath(filename, NULL);
+
+    if (!*target)
+    {
+        dtoverlay_error("failed to resolve '%s' - %d", filename, errno);
+        return -1;
+    }
+    return 0;
+}
+
+// Writes the DTB and any trailer to a new temporary file alongside filename,
+// with the owner and permissions of filename if it exists, returning the
+// name of the temporary file or NULL on error.
+static char *dtoverlay_write_tmp_dtb(const DTBLOB_T *dtb, const char *filename)
+{
+    const char *base = strrchr(filename, '/');
+    const char *chunks[2];
+    int chunk_lens[2];
+    struct stat st;
+    char *tmp_file;
+    int dir_len;
+    int fd;
+    int i;
+
+    base = base ? base + 1 : filename;
+    dir_len = base - filename;
+    tmp_file = malloc(strlen(filename) + 24);
+    if (!tmp_file)
+    {
+        dtoverlay_error("out of memory");
+        return NULL;
+    }
+
+    // Create the file as fopen would, so that the umask applies, rather than
+    // with the 0600 permissions of mkstemp. The names are unique to this
+    // process, and O_EXCL keeps threads saving the same file apart.
+    for (i = 0; i < DTOVERLAY_MAX_TMP_TRIES; i++)
+    {
+        sprintf(tmp_file, "%.*s.%s.%d.%d", dir_len, filename, base,
+                (int)getpid(), i);
+        fd = open(tmp_file, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd >= 0 || errno != EEXIST)
+            break;
+    }
+    if (fd < 0)
+    {
+        dtoverlay_error("failed to create '%s' - %d", tmp_file, errno);
+        free(tmp_file);
+        return NULL;
+    }
+
+    // A file being replaced keeps its owner and permissions. Only root can
+    // give a file away, so a failure to change the owner is just a warning.
+    // The mode is set afterwards, as changing the owner can clear it.
+    if (stat(filename, &st) == 0)
+    {
+        if (fchown(fd, st.st_uid, st.st_gid) != 0)
+            dtoverlay_warn("failed to keep the owner of '%s' - %d", filename,
+                           errno);
+        if (fchmod(fd, st.st_mode & 07777) != 0)
+        {
+            dtoverlay_error("failed to keep the mode of '%s' - %d", filename,
+                            errno);
+            goto error_exit;
+        }
+    }
+
+    chunks[0] = dtb->fdt;
+    chunk_lens[0] = fdt_totalsize(dtb->fdt);
+    chunks[1] = dtb->trailer;
+    chunk_lens[1] = dtb->trailer_len;
+
+    for (i = 0; i < 2; i++)
+    {
+        const char *p = chunks[i];
+        int len = chunk_lens[i];
+
+        while (len > 0)
+        {
+            ssize_t bytes = write(fd, p, len);
+            if (bytes < 0 && errno == EINTR)
+                continue;
+            if (bytes <= 0)
+            {
+                dtoverlay_error("write failed");
+                goto error_exit;
+            }
+            p += bytes;
+            len -= bytes;
+        }
+    }
+
+    if (close(fd) != 0)
+    {
+        fd = -1;
+        dtoverlay_error("write failed");
+        goto error_exit;
+    }
+
+    dtoverlay_debug("wrote %d bytes to '%s'", chunk_lens[0] + chunk_lens[1],
+                    tmp_file);
+    return tmp_file;
+
+  error_exit:
+    if (fd >= 0)
+        close(fd);
+    unlink(tmp_file);
+    free(tmp_file);
+    return NULL;
+}
+
+static int dtoverlay_open_dir_of(const char *filename)
+{
+    const char *base = strrchr(filename, '/');
+    char dir[DTOVERLAY_MAX_PATH];
+
+    if (!base)
+        return open(".", O_RDONLY | O_DIRECTORY);
+    if (base == filename)
+        return open("/", O_RDONLY | O_DIRECTORY);
+    if (base - filename >= (int)sizeof(dir))
+        return -1;
+    sprintf(dir, "%.*s", (int)(base - filename), filename);
+    return open(dir, O_RDONLY | O_DIRECTORY);
+}
+
+// Writes the DTB (and any trailer) to a temporary file, makes it durable and
+// then renames it over filename, so that readers see either the old file or
+// the complete new one, even after a crash. The new file gets the owner and
+// permissions of the one it replaces. A symlink is followed, replacing
+// the file it points to, and anything other than a regular file (such as
+// /dev/stdout) is written in place with dtoverlay_save_dtb. Not for use with
+// configfs. Returns 0 on success, otherwise a negative error code.
+int dtoverlay_save_dtb_atomic(const DTBLOB_T *dtb, const char *filename)
+{
+    char *target;
+    char *tmp_file;
+    int dir_fd;
+    int fd;
+    int err;
+
+    err = dtoverlay_resolve_target(filename, &target);
+    if (err > 0)
+        return dtoverlay_save_dtb(dtb, filename);
+    if (err < 0)
+        return -1;
+    filename = target;
+
+    tmp_file = dtoverlay_write_tmp_dtb(dtb, filename);
+    if (!tmp_file)
+    {
+        free(target);
+        return -2;
+    }
+
+    fd = open(tmp_file, O_RDONLY);
+    if (fd < 0 || fsync(fd) != 0)
+    {
+        dtoverlay_error("failed to sync '%s'", tmp_file);
+        err = -2;
+    }
+    if (fd >= 0)
+        close(fd);
+
+    if (!err && rename(tmp_file, filename) != 0)
+    {
+        dtoverlay_error("failed to rename '%s' - %d", tmp_file, errno);
+        err = -1;
+    }
+
+    if (err)
+    {
+        unlink(tmp_file);
+    }
+    else
+    {
+        // Make the rename durable
+        dir_fd = dtoverlay_open_dir_of(filename);
+        if (dir_fd >= 0)
+        {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+    }
+
+    free(tmp_file);
+    free(target);
+
+    return err;
+}
+
+DTOVL_BATCH_T *dtoverlay_batch_create(void)
+{
+    DTOVL_BATCH_T *batch = calloc(1, sizeof(DTOVL_BATCH_T));
+    if (!batch)
+    {
+        dtoverlay_error("out of memory");
+        return NULL;
+    }
+    pthread_mutex_init(&batch->lock, NULL);
+    return batch;
+}
+
+// Writes the DTB to a temporary file, to be renamed to filename by
+// dtoverlay_batch_commit. Symlinks and files that aren't regular are handled
+// as by dtoverlay_save_dtb_atomic. May be called from multiple threads at once.
+// Returns 0 on success, otherwise a negative error code.
+int dtoverlay_batch_save_dtb(DTOVL_BATCH_T *batch, const DTBLOB_T *dtb,
+                             const char *filename)
+{
+    PENDING_FILE_T *file;
+    char *tmp_file;
+    char *name;
+    int err = 0;
+
+    // Files that can't be replaced are written straight away
+    err = dtoverlay_resolve_target(filename, &name);
+    if (err > 0)
+        return dtoverlay_save_dtb(dtb, filename);
+    if (err < 0)
+        return -1;
+
+    tmp_file = dtoverlay_write_tmp_dtb(dtb, name);
+    if (!tmp_file)
+    {
+        free(name);
+        return -2;
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    if (name && batch->num_files == batch->max_files)
+    {
+        int max_files = batch->max_files ? batch->max_files * 2 : 64;
+        PENDING_FILE_T *files = realloc(batch->files,
+                                        max_files * sizeof(PENDING_FILE_T));
+        if (files)
+        {
+            batch->files = files;
+            batch->max_files = max_files;
+        }
+    }
+    if (name && batch->num_files < batch->max_files)
+    {
+        file = &batch->files[batch->num_files++];
+        file->tmp_file = tmp_file;
+        file->filename = name;
+    }
+    else
+    {
+        err = -FDT_ERR_NOSPACE;
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    if (err)
+    {
+        dtoverlay_error("out of memory");
+        unlink(tmp_file);
+        free(tmp_file);
+        free(name);
+    }
+
+    return err;
+}
+
+// Makes all of the pending files durable with one syncfs per filesystem,
+// renames them into place, then syncs the directories. Must not be called
+// while other threads are adding to the batch.
+// Returns 0 on success, otherwise a negative error code.
+int dtoverlay_batch_commit(DTOVL_BATCH_T *batch)
+{
+    dev_t *synced_devs;
+    int *dir_fds;
+    int num_dirs = 0;
+    int err = 0;
+    int i, j;
+
+    if (!batch->num_files)
+        return 0;
+
+    synced_devs = calloc(batch->num_files, sizeof(dev_t));
+    dir_fds = calloc(batch->num_files, sizeof(int));
+    if (!synced_devs || !dir_fds)
+    {
+        dtoverlay_error("out of memory");
+        free(synced_devs);
+        free(dir_fds);
+        return -FDT_ERR_NOSPACE;
+    }
+
+    // Sync the data of every file, once per filesystem
+    for (i = 0; i < batch->num_files; i++)
+    {
+        struct stat st;
+
+        if (stat(batch->files[i].tmp_file, &st) != 0)
+        {
+            dtoverlay_error("failed to find '%s'", batch->files[i].tmp_file);
+            err = -2;
+            break;
+        }
+        for (j = 0; j < num_dirs; j++)
+        {
+            if (synced_devs[j] == st.st_dev)
+                break;
+        }
+        if (j < num_dirs)
+            continue;
+
+        dir_fds[num_dirs] = dtoverlay_open_dir_of(batch->files[i].filename);
+        if (dir_fds[num_dirs] < 0 || syncfs(dir_fds[num_dirs]) != 0)
+        {
+            dtoverlay_error("failed to sync '%s'", batch->files[i].filename);
+            if (dir_fds[num_dirs] >= 0)
+                close(dir_fds[num_dirs]);
+            err = -2;
+            break;
+        }
+        synced_devs[num_dirs++] = st.st_dev;
+    }
+
+    // Move them into place
+    for (i = 0; !err && i < batch->num_files; i++)
+    {
+        PENDING_FILE_T *file = &batch->files[i];
+        if (rename(file->tmp_file, file->filename) != 0)
+        {
+            dtoverlay_error("failed to rename '%s' - %d", file->tmp_file, errno);
+            err = -1;
+            break;
+        }
+        free(file->tmp_file);
+        file->tmp_file = NULL;
+    }
+
+    // And make the renames durable
+    for (j = 0; j < num_dirs; j++)
+    {
+        if (!err && syncfs(dir_fds[j]) != 0)
+            err = -2;
+        close(dir_fds[j]);
+    }
+
+    free(synced_devs);
+    free(dir_fds);
+
+    // Files that were renamed are no longer pending; any that were not will
+    // be discarded when the batch is freed.
+    for (i = 0, j = 0; i < batch->num_files; i++)
+    {
+        if (batch->files[i].tmp_file)
+            batch->files[j++] = batch->files[i];
+        else
+            free(batch->files[i].filename);
+    }
+    batch->num_files = j;
+
+    return err;
+}
+
+// Frees the batch, deleting any uncommitted files
+void dtoverlay_batch_free(DTOVL_BATCH_T *batch)
+{
+    int i;
+
+    if (!batch)
+        return;
+
+    for (i = 0; i < batch->num_files; i++)
+    {
+        unlink(batch->files[i].tmp_file);
+        free(batch->files[i].tmp_file);
+        free(batch->files[i].filename);
+    }
+    free(batch->files);
+    pthread_mutex_destroy(&batch->lock);
+    free(batch);
+}
+
 int dtoverlay_extend_dtb(DTBLOB_T *dtb, int new_size)
 {
     int size = fdt_totalsize(dtb->fdt);
@@ -3202,7 +4024,10 @@ static void dtoverlay_stdio_logging(dtoverlay_logging_type_t type,
         type_str = "?";
     }
 
+    // Keep messages from concurrent merges intact
+    flockfile(stderr);
     fprintf(stderr, "DTOVERLAY[%s]: ", type_str);
     vfprintf(stderr, fmt, args);
     fprintf(stderr, "\n");
+    funlockfile(stderr);
 }
@@ -98,6 +98,34 @@ typedef int (*override_callback_t)(int override_type,
                                    int target_off, int target_size,
                                    void *callback_state);
 
+/* A DTOVL_CTX_T holds the state that would otherwise be shared by all users
+   of the library - the overlay map, the platform and the callbacks - so that
+   separate merges can proceed concurrently in different threads, each with
+   its own context. A context must not be used by more than one thread at a
+   time. The logging function and debug flag remain process-wide. The
+   functions without a context use a private default context. */
+typedef struct dtovl_ctx_struct DTOVL_CTX_T;
+
+typedef int (*dtovl_ctx_override_callback_t)(DTOVL_CTX_T *ctx,
+                                             int override_type,
+                                             const char *override_value,
+                                             DTBLOB_T *dtb, int node_off,
+                                             const char *prop_name,
+                                             int target_phandle,
+                                             int target_off, int target_size,
+                                             void *callback_state);
+
+typedef void (*dtovl_cell_changed_callback_t)(DTOVL_CTX_T *ctx, DTBLOB_T *dtb,
+                                              int node_off,
+                                              const char *prop_name,
+                                              int target_off,
+                                              int cell_data_offset);
+
+typedef void (*dtovl_intra_fragment_merged_callback_t)(DTOVL_CTX_T *ctx,
+                                                       DTBLOB_T *dtb,
+                                                       int fragment_off,
+                                                       int target_off);
+
 uint8_t dtoverlay_read_u8(const void *src, int off);
 uint16_t dtoverlay_read_u16(const void *src, int off);
 uint32_t dtoverlay_read_u32(const void *src, int off);
@@ -175,12 +203,56 @@ int dtoverlay_set_synonym(DTBLOB_T *dtb, const char *dst, const char *src);
 int dtoverlay_dup_property(DTBLOB_T *dtb, const char *node_name,
                            const char *dst, const char *src);
 
+DTOVL_CTX_T *dtoverlay_ctx_create(void *user_data);
+
+void dtoverlay_ctx_free(DTOVL_CTX_T *ctx);
+
+void *dtoverlay_ctx_user_data(DTOVL_CTX_T *ctx);
+
+void dtoverlay_ctx_set_intra_fragment_merged_callback(DTOVL_CTX_T *ctx,
+                                                      dtovl_intra_fragment_merged_callback_t callback);
+void dtoverlay_ctx_set_cell_changed_callback(DTOVL_CTX_T *ctx,
+                                             dtovl_cell_changed_callback_t callback);
+
+int dtoverlay_ctx_merge_overlay(DTOVL_CTX_T *ctx, DTBLOB_T *base_dtb,
+                                DTBLOB_T *overlay_dtb);
+
+int dtoverlay_ctx_override_one_target(DTOVL_CTX_T *ctx, int override_type,
+                                      const char *override_value,
+                                      DTBLOB_T *dtb, int node_off,
+                                      const char *prop_name, int target_phandle,
+                                      int target_off, int target_size,
+                                      void *callback_state);
+
+int dtoverlay_ctx_foreach_override_target(DTOVL_CTX_T *ctx, DTBLOB_T *dtb,
+                                          const char *override_name,
+                                          const char *override_data, int data_len,
+                                          const char *override_value,
+                                          dtovl_ctx_override_callback_t callback,
+                                          void *callback_state);
+
+int dtoverlay_ctx_apply_override(DTOVL_CTX_T *ctx, DTBLOB_T *dtb,
+                                 const char *override_name,
+                                 const char *override_data, int data_len,
+                                 const char *override_value);
+
+void dtoverlay_ctx_init_map_from_fp(DTOVL_CTX_T *ctx, FILE *fp,
+                                    const char *compatible, int compatible_len);
+void dtoverlay_ctx_init_map(DTOVL_CTX_T *ctx, const char *overlay_dir,
+                            const char *compatible, int compatible_len);
+
+void dtoverlay_ctx_reset_map(DTOVL_CTX_T *ctx);
+
+const char *dtoverlay_ctx_remap_overlay(DTOVL_CTX_T *ctx, const char *overlay);
+
 DTBLOB_T *dtoverlay_create_dtb(int max_size);
 
 DTBLOB_T *dtoverlay_load_dtb_from_fp(FILE *fp, int max_size);
 
 DTBLOB_T *dtoverlay_load_dtb(const char *filename, int max_size);
 
+DTBLOB_T *dtoverlay_clone_dtb(const DTBLOB_T *src_dtb, int max_size);
+
 void dtoverlay_init_map_from_fp(FILE *fp, const char *compatible,
                                 int compatible_len);
 void dtoverlay_init_map(const char *overlay_dir, const char *compatible,
@@ -192,6 +264,22 @@ DTBLOB_T *dtoverlay_import_fdt(void *fdt, int max_size);
 
 int dtoverlay_save_dtb(const DTBLOB_T *dtb, const char *filename);
 
+int dtoverlay_save_dtb_atomic(const DTBLOB_T *dtb, const char *filename);
+
+/* A DTOVL_BATCH_T collects the output of many saves, making them durable and
+   visible together in dtoverlay_batch_commit at the cost of one syncfs per
+   filesystem, rather than an fsync per file. */
+typedef struct dtovl_batch_struct DTOVL_BATCH_T;
+
+DTOVL_BATCH_T *dtoverlay_batch_create(void);
+
+int dtoverlay_batch_save_dtb(DTOVL_BATCH_T *batch, const DTBLOB_T *dtb,
+                             const char *filename);
+
+int dtoverlay_batch_commit(DTOVL_BATCH_T *batch);
+
+void dtoverlay_batch_free(DTOVL_BATCH_T *batch);
+
 int dtoverlay_extend_dtb(DTBLOB_T *dtb, int new_size);
 
 int dtoverlay_dtb_totalsize(DTBLOB_T *dtb);
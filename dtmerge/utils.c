@@ -36,10 +36,20 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "utils.h"
 
 #define OVERLAY_HELP_INDENT 8
+#define STRING_CHUNK_SIZE 4096
+
+typedef struct string_chunk_struct
+{
+    struct string_chunk_struct *next;
+    size_t size;
+    size_t used;
+    char data[0];
+} STRING_CHUNK_T;
 
 int opt_verbose;
 int opt_dry_run;
-static STRING_T *allocated_strings;
+static STRING_CHUNK_T *string_chunks;
+static char *last_string;
 
 struct overlay_help_state_struct
 {
@@ -273,40 +283,52 @@ int run_cmd(const char *fmt, ...)
 }
 
 
-/* Not thread safe */
-void free_string(const char *string)
+/* Returns space for len bytes from the string arena. Not thread safe */
+static char *string_alloc(size_t len)
 {
-    STRING_T *str;
+    STRING_CHUNK_T *chunk = string_chunks;
+    char *str;
 
-    if (!string)
-        return;
+    if (!chunk || (chunk->size - chunk->used) < len)
+    {
+        size_t size = (len > STRING_CHUNK_SIZE) ? len : STRING_CHUNK_SIZE;
+        chunk = malloc(sizeof(STRING_CHUNK_T) + size);
+        if (!chunk)
+            fatal_error("Out of memory");
+        chunk->size = size;
+        chunk->used = 0;
+        chunk->next = string_chunks;
+        string_chunks = chunk;
+    }
+
+    str = chunk->data + chunk->used;
+    chunk->used += len;
+    last_string = str;
+    return str;
+}
 
-    str = (STRING_T *)(string - sizeof(STRING_T));
-    if (str == allocated_strings)
+/* Not thread safe */
+void free_string(const char *string)
+{
+    /* Only the most recent string can be reclaimed - the rest go when the
+       arena is released */
+    if (string && string == last_string)
     {
-        allocated_strings = str->next;
-        if (allocated_strings == str)
-            allocated_strings = NULL;
+        string_chunks->used = string - string_chunks->data;
+        last_string = NULL;
     }
-    str->prev->next = str->next;
-    str->next->prev = str->prev;
-    free(str);
 }
 
 /* Not thread safe */
 void free_strings(void)
 {
-    if (allocated_strings)
+    while (string_chunks)
     {
-        STRING_T *str = allocated_strings;
-        do
-        {
-            STRING_T *t = str;
-            str = t->next;
-            free(t);
-        } while (str != allocated_strings);
-        allocated_strings = NULL;
+        STRING_CHUNK_T *chunk = string_chunks;
+        string_chunks = chunk->next;
+        free(chunk);
     }
+    last_string = NULL;
 }
 
 /* Not thread safe */
@@ -323,34 +345,41 @@ char *sprintf_dup(const char *fmt, ...)
 /* Not thread safe */
 char *vsprintf_dup(const char *fmt, va_list ap)
 {
-    char scratch[512];
+    STRING_CHUNK_T *chunk = string_chunks;
+    size_t space = chunk ? (chunk->size - chunk->used) : 0;
     size_t len;
-    STRING_T *str;
-    len = vsnprintf(scratch, sizeof(scratch), fmt, ap) + 1;
+    va_list ap2;
+    char *str;
+    int ret;
 
-    if (len > sizeof(scratch))
-        fatal_error("Maximum string length exceeded");
+    /* Format directly into the arena, if it fits */
+    va_copy(ap2, ap);
+    ret = vsnprintf(chunk ? chunk->data + chunk->used : NULL, space,
+                    fmt, ap2);
+    va_end(ap2);
+    if (ret < 0)
+        fatal_error("Failed to format '%s'", fmt);
+    len = (size_t)ret + 1;
 
-    str = malloc(sizeof(STRING_T) + len);
-    if (!str)
-        fatal_error("Out of memory");
+    if (len <= space)
+        return string_alloc(len);
 
-    memcpy(str->data, scratch, len);
-    if (allocated_strings)
-    {
-        str->next = allocated_strings;
-        str->prev = allocated_strings->prev;
-        str->next->prev = str;
-        str->prev->next = str;
-    }
-    else
-    {
-        str->next = str;
-        str->prev = str;
-        allocated_strings = str;
-    }
+    str = string_alloc(len);
+    vsnprintf(str, len, fmt, ap);
+    return str;
+}
 
-    return str->data;
+/* Not thread safe */
+char *strndup_arena(const char *str, int len)
+{
+    char *copy;
+
+    if (!len)
+        len = strlen(str);
+    copy = string_alloc(len + 1);
+    strncpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
 }
 
 int dir_exists(const char *dirname)
@@ -370,6 +399,9 @@ void string_vec_init(STRING_VEC_T *vec)
     vec->num_strings = 0;
     vec->max_strings = 0;
     vec->strings = NULL;
+    vec->index = NULL;
+    vec->index_size = 0;
+    vec->num_indexed = 0;
 }
 
 char *string_vec_add(STRING_VEC_T *vec, const char *str, int len)
@@ -386,40 +418,80 @@ char *string_vec_add(STRING_VEC_T *vec, const char *str, int len)
             fatal_error("Out of memory");
     }
 
-    if (len)
-    {
-        copy = malloc(len + 1);
-        strncpy(copy, str, len);
-        copy[len] = '\0';
-    }
-    else
-        copy = strdup(str);
-
-    if (!copy)
-        fatal_error("Out of memory");
+    copy = strndup_arena(str, len);
 
     vec->strings[vec->num_strings++] = copy;
 
     return copy;
 }
 
-int string_vec_find(STRING_VEC_T *vec, const char *str, int len)
+static unsigned int string_hash(const char *str, int len)
 {
+    /* FNV-1a */
+    unsigned int hash = 2166136261u;
     int i;
 
-    for (i = 0; i < vec->num_strings; i++)
+    for (i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+    return hash;
+}
+
+/* Returns the index slot for str, which is either empty or refers to a
+   matching string */
+static int *string_vec_slot(STRING_VEC_T *vec, const char *str, int len)
+{
+    unsigned int mask = vec->index_size - 1;
+    unsigned int i = string_hash(str, len) & mask;
+
+    while (vec->index[i])
     {
-        if (len)
-        {
-            if ((strncmp(vec->strings[i], str, len) == 0) &&
-                (vec->strings[i][len] == '\0'))
-                return i;
-        }
-        else if (strcmp(vec->strings[i], str) == 0)
-            return i;
+        const char *s = vec->strings[vec->index[i] - 1];
+        if ((strncmp(s, str, len) == 0) && (s[len] == '\0'))
+            break;
+        i = (i + 1) & mask;
     }
 
-    return -1;
+    return &vec->index[i];
+}
+
+/* Index any strings added since the last find. This is done lazily because
+   callers may shorten a string immediately after adding it. */
+static void string_vec_update_index(STRING_VEC_T *vec)
+{
+    if (vec->index_size < (vec->num_strings * 2))
+    {
+        int size = vec->index_size ? vec->index_size : 32;
+        while (size < (vec->num_strings * 2))
+            size *= 2;
+        free(vec->index);
+        vec->index = calloc(size, sizeof(int));
+        if (!vec->index)
+            fatal_error("Out of memory");
+        vec->index_size = size;
+        vec->num_indexed = 0;
+    }
+
+    for (; vec->num_indexed < vec->num_strings; vec->num_indexed++)
+    {
+        const char *str = vec->strings[vec->num_indexed];
+        int *slot = string_vec_slot(vec, str, strlen(str));
+        /* Keep the first of any duplicates, as a linear search would */
+        if (!*slot)
+            *slot = vec->num_indexed + 1;
+    }
+}
+
+int string_vec_find(STRING_VEC_T *vec, const char *str, int len)
+{
+    if (!vec->num_strings)
+        return -1;
+
+    if (!len)
+        len = strlen(str);
+
+    string_vec_update_index(vec);
+
+    return *string_vec_slot(vec, str, len) - 1;
 }
 
 int string_vec_compare(const void *a, const void *b)
@@ -430,14 +502,19 @@ int string_vec_compare(const void *a, const void *b)
 void string_vec_sort(STRING_VEC_T *vec)
 {
     qsort(vec->strings, vec->num_strings, sizeof(char *), &string_vec_compare);
+
+    /* The index refers to positions, so rebuild it on the next find */
+    if (vec->index)
+        memset(vec->index, 0, vec->index_size * sizeof(int));
+    vec->num_indexed = 0;
 }
 
 void string_vec_uninit(STRING_VEC_T *vec)
 {
-    int i;
-    for (i = 0; i < vec->num_strings; i++)
-        free(vec->strings[i]);
+    /* The strings themselves belong to the arena */
     free(vec->strings);
+    free(vec->index);
+    string_vec_init(vec);
 }
 
 int error(const char *fmt, ...)
@@ -28,18 +28,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef UTILS_H
 #define UTILS_H
 
-typedef struct string_struct
-{
-    struct string_struct *prev;
-    struct string_struct *next;
-    char data[0];
-} STRING_T;
-
 typedef struct string_vec_struct
 {
     int num_strings;
     int max_strings;
     char **strings;
+    /* A hash index of the strings, updated lazily by string_vec_find.
+       Each slot holds a string index + 1, or 0 if unused. */
+    int *index;
+    int index_size;
+    int num_indexed;
 } STRING_VEC_T;
 
 typedef struct overlay_help_state_struct OVERLAY_HELP_STATE_T;
@@ -57,10 +55,13 @@ void overlay_help_print_field(OVERLAY_HELP_STATE_T *state,
                               int indent, int strip_blanks);
 
 int run_cmd(const char *fmt, ...);
+/* The *sprintf_dup strings and the contents of string vectors are allocated
+   from an arena, which is released by free_strings */
 void free_string(const char *string); /* Not thread safe */
 void free_strings(void); /* Not thread safe */
 char *sprintf_dup(const char *fmt, ...); /* Not thread safe */
 char *vsprintf_dup(const char *fmt, va_list ap); /* Not thread safe */
+char *strndup_arena(const char *str, int len); /* Not thread safe */
 int dir_exists(const char *dirname);
 int file_exists(const char *dirname);
 void string_vec_init(STRING_VEC_T *vec);
@@ -0,0 +1,686 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "capture.h"
+#include "gpiolib.h"
+#include "util.h"
+
+#define CAPTURE_MAX_BANKS ((MAX_GPIO_PINS + 63) / 64)
+#define CAPTURE_RING_SIZE 16384  /* Must be a power of two */
+#define CAPTURE_SPIN_NS   50000  /* Busy-wait the last part of each period */
+#define CAPTURE_IDLE_NS   1000000
+#define CAPTURE_MAX_EVENTS 64
+#define CAPTURE_EVENT_TIMEOUT_MS 100
+
+#define NS_PER_SEC 1000000000ULL
+
+typedef struct
+{
+    uint64_t timestamp;   /* CLOCK_MONOTONIC_RAW, in ns */
+    uint64_t idle_count;  /* Identical samples since the previous record */
+    uint64_t levels[CAPTURE_MAX_BANKS];
+} CAPTURE_SAMPLE_T;
+
+typedef struct
+{
+    const CAPTURE_CONFIG_T *config;
+    const CAPTURE_GPIO_T *gpios;
+    unsigned num_gpios;
+    FILE *fp;
+
+    /* Each polled GPIO is found at bit gpio_bit[n] of bank gpio_bank[n] */
+    unsigned num_banks;
+    unsigned bank_first[CAPTURE_MAX_BANKS];
+    unsigned bank_count[CAPTURE_MAX_BANKS];
+    uint64_t bank_mask[CAPTURE_MAX_BANKS];
+    unsigned *gpio_bank;
+    unsigned *gpio_bit;
+
+    /* Single-producer, single-consumer ring */
+    CAPTURE_SAMPLE_T *ring;
+    atomic_uint head;
+    atomic_uint tail;
+    atomic_int done;
+
+    uint64_t start_time;
+    uint64_t num_samples;
+    uint64_t num_records;
+    uint64_t num_dropped;
+
+    /* Writer state */
+    int have_last;
+    uint64_t last_timestamp;
+    uint64_t last_levels[CAPTURE_MAX_BANKS];
+    uint16_t *toggled;      /* Scratch, for the GPIOs changed by a record */
+    uint64_t *num_edges;    /* Per GPIO, for the deltas summary */
+} CAPTURE_STATE_T;
+
+static const char *format_names[] = { "text", "vcd", "bin" };
+
+static volatile sig_atomic_t capture_stop;
+
+CAPTURE_FORMAT_T capture_format_by_name(const char *name)
+{
+    unsigned i;
+
+    for (i = 0; i < CAPTURE_FORMAT_MAX; i++)
+    {
+        if (strcmp(name, format_names[i]) == 0)
+            return (CAPTURE_FORMAT_T)i;
+    }
+    return CAPTURE_FORMAT_MAX;
+}
+
+static void capture_signal(int sig)
+{
+    (void)sig;
+    capture_stop = 1;
+}
+
+static int capture_level(const CAPTURE_STATE_T *state, const uint64_t *levels,
+                         unsigned n)
+{
+    return (levels[state->gpio_bank[n]] >> state->gpio_bit[n]) & 1;
+}
+
+static void vcd_id(unsigned n, char *buf)
+{
+    do
+    {
+        *(buf++) = '!' + (n % 94);
+        n /= 94;
+    } while (n);
+    *buf = '\0';
+}
+
+static void write_header(CAPTURE_STATE_T *state)
+{
+    FILE *fp = state->fp;
+    unsigned i;
+
+    if (state->config->format == CAPTURE_VCD)
+    {
+        time_t now = time(NULL);
+
+        fprintf(fp, "$date %.24s $end\n", ctime(&now));
+        fprintf(fp, "$version pinctrl $end\n");
+        fprintf(fp, "$timescale 1 ns $end\n");
+        fprintf(fp, "$scope module gpio $end\n");
+        for (i = 0; i < state->num_gpios; i++)
+        {
+            const char *p = state->gpios[i].name;
+            char id[8];
+
+            vcd_id(i, id);
+            fprintf(fp, "$var wire 1 %s ", id);
+            // VCD references can't contain spaces, and '/' is confusing
+            for (; p && *p; p++)
+                fputc((isalnum(*p) || *p == '_') ? *p : '_', fp);
+            fprintf(fp, "_%u $end\n", state->gpios[i].num);
+        }
+        fprintf(fp, "$upscope $end\n");
+        fprintf(fp, "$enddefinitions $end\n");
+    }
+    else if (state->config->format == CAPTURE_BINARY)
+    {
+        CAPTURE_BIN_HEADER_T header;
+
+        memset(&header, 0, sizeof(header));
+        if (state->config->deltas)
+            memcpy(header.magic, CAPTURE_DELTA_MAGIC, sizeof(CAPTURE_DELTA_MAGIC));
+        else
+            memcpy(header.magic, CAPTURE_BIN_MAGIC, sizeof(CAPTURE_BIN_MAGIC));
+        header.version = CAPTURE_BIN_VERSION;
+        header.num_gpios = state->num_gpios;
+        fwrite(&header, sizeof(header), 1, fp);
+        for (i = 0; i < state->num_gpios; i++)
+        {
+            uint32_t num = state->gpios[i].num;
+            fwrite(&num, sizeof(num), 1, fp);
+        }
+    }
+}
+
+static void write_delta(CAPTURE_STATE_T *state, const CAPTURE_SAMPLE_T *sample)
+{
+    FILE *fp = state->fp;
+    uint64_t timestamp = sample->timestamp - state->start_time;
+    // Edge events are not samples, so have no identical ones to count
+    uint64_t idle_count = state->config->events ? 0 : sample->idle_count;
+    uint64_t diff[CAPTURE_MAX_BANKS];
+    uint16_t num_toggled = 0;
+    unsigned i, b;
+
+    // The first record is relative to all GPIOs being low
+    for (b = 0; b < state->num_banks; b++)
+        diff[b] = sample->levels[b] ^ state->last_levels[b];
+    for (i = 0; i < state->num_gpios; i++)
+    {
+        if ((diff[state->gpio_bank[i]] >> state->gpio_bit[i]) & 1)
+            state->toggled[num_toggled++] = i;
+    }
+
+    if (state->config->format == CAPTURE_BINARY)
+    {
+        fwrite(&timestamp, sizeof(timestamp), 1, fp);
+        fwrite(&idle_count, sizeof(idle_count), 1, fp);
+        fwrite(&num_toggled, sizeof(num_toggled), 1, fp);
+        fwrite(state->toggled, sizeof(uint16_t), num_toggled, fp);
+    }
+    else
+    {
+        uint64_t us = timestamp / 1000;
+
+        fprintf(fp, "%" PRIu64 ".%06" PRIu64, us / 1000000, us % 1000000);
+        if (idle_count)
+            fprintf(fp, " (%" PRIu64 " same)", idle_count);
+        fputc(':', fp);
+        if (state->have_last)
+        {
+            for (i = 0; i < num_toggled; i++)
+            {
+                unsigned n = state->toggled[i];
+
+                fprintf(fp, " %d=%s", state->gpios[n].num,
+                        capture_level(state, sample->levels, n) ? "hi" : "lo");
+                state->num_edges[n]++;
+            }
+        }
+        else
+        {
+            // Start with the state of every GPIO
+            for (i = 0; i < state->num_gpios; i++)
+                fprintf(fp, " %d=%s", state->gpios[i].num,
+                        capture_level(state, sample->levels, i) ? "hi" : "lo");
+        }
+        fputc('\n', fp);
+    }
+
+    state->have_last = 1;
+    state->last_timestamp = sample->timestamp;
+    memcpy(state->last_levels, sample->levels, sizeof(state->last_levels));
+}
+
+static void write_summary(CAPTURE_STATE_T *state)
+{
+    FILE *fp = state->fp;
+    unsigned i;
+
+    if (!state->config->deltas || state->config->format != CAPTURE_TEXT)
+        return;
+
+    fprintf(fp, "Changes:\n");
+    for (i = 0; i < state->num_gpios; i++)
+        fprintf(fp, "%2d: %" PRIu64 " // %s\n", state->gpios[i].num,
+                state->num_edges[i], state->gpios[i].name);
+}
+
+static void write_record(CAPTURE_STATE_T *state, const CAPTURE_SAMPLE_T *sample)
+{
+    FILE *fp = state->fp;
+    uint64_t timestamp = sample->timestamp - state->start_time;
+    unsigned i;
+
+    // VCD only ever records changes anyway
+    if (state->config->deltas && state->config->format != CAPTURE_VCD)
+    {
+        write_delta(state, sample);
+        return;
+    }
+
+    switch (state->config->format)
+    {
+    case CAPTURE_TEXT:
+        if (state->have_last && sample->idle_count)
+            fprintf(fp, "+%" PRIu64 "us\n",
+                    (sample->timestamp - state->last_timestamp) / 1000);
+        for (i = 0; i < state->num_gpios; i++)
+        {
+            int level = capture_level(state, sample->levels, i);
+            if (!state->have_last ||
+                level != capture_level(state, state->last_levels, i))
+                fprintf(fp, "%2d: %s // %s\n", state->gpios[i].num,
+                        level ? "hi" : "lo", state->gpios[i].name);
+        }
+        break;
+
+    case CAPTURE_VCD:
+        fprintf(fp, "#%" PRIu64 "\n", timestamp);
+        if (!state->have_last)
+            fprintf(fp, "$dumpvars\n");
+        for (i = 0; i < state->num_gpios; i++)
+        {
+            int level = capture_level(state, sample->levels, i);
+            if (!state->have_last ||
+                level != capture_level(state, state->last_levels, i))
+            {
+                char id[8];
+                vcd_id(i, id);
+                fprintf(fp, "%d%s\n", level, id);
+            }
+        }
+        if (!state->have_last)
+            fprintf(fp, "$end\n");
+        break;
+
+    case CAPTURE_BINARY:
+        fwrite(&timestamp, sizeof(timestamp), 1, fp);
+        for (i = 0; i < state->num_gpios; i += 64)
+        {
+            uint64_t bits = 0;
+            unsigned j;
+
+            for (j = 0; j < 64 && i + j < state->num_gpios; j++)
+                bits |= (uint64_t)capture_level(state, sample->levels, i + j) << j;
+            fwrite(&bits, sizeof(bits), 1, fp);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    state->have_last = 1;
+    state->last_timestamp = sample->timestamp;
+    memcpy(state->last_levels, sample->levels, sizeof(state->last_levels));
+}
+
+static void *capture_writer(void *arg)
+{
+    CAPTURE_STATE_T *state = arg;
+    unsigned tail = atomic_load_explicit(&state->tail, memory_order_relaxed);
+
+    while (1)
+    {
+        int done = atomic_load_explicit(&state->done, memory_order_acquire);
+        unsigned head = atomic_load_explicit(&state->head, memory_order_acquire);
+
+        if (tail == head)
+        {
+            struct timespec idle = { 0, CAPTURE_IDLE_NS };
+
+            if (done)
+                break;
+            fflush(state->fp);
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        while (tail != head)
+        {
+            write_record(state, &state->ring[tail & (CAPTURE_RING_SIZE - 1)]);
+            tail++;
+            atomic_store_explicit(&state->tail, tail, memory_order_release);
+        }
+    }
+
+    write_summary(state);
+    fflush(state->fp);
+    return NULL;
+}
+
+static int capture_init_banks(CAPTURE_STATE_T *state)
+{
+    unsigned i, b;
+
+    state->gpio_bank = calloc(state->num_gpios, sizeof(unsigned));
+    state->gpio_bit = calloc(state->num_gpios, sizeof(unsigned));
+    if (!state->gpio_bank || !state->gpio_bit)
+        return -1;
+
+    // Group the GPIOs into windows of up to 64 that can be read in one call
+    for (i = 0; i < state->num_gpios; i++)
+    {
+        unsigned gpio = state->gpios[i].gpio;
+
+        for (b = 0; b < state->num_banks; b++)
+        {
+            if (gpio >= state->bank_first[b] && gpio < state->bank_first[b] + 64)
+                break;
+        }
+        if (b == state->num_banks)
+        {
+            if (b == CAPTURE_MAX_BANKS)
+                return -1;
+            state->bank_first[b] = gpio;
+            state->bank_count[b] = 0;
+            state->bank_mask[b] = 0;
+            state->num_banks++;
+        }
+        state->gpio_bank[i] = b;
+        state->gpio_bit[i] = gpio - state->bank_first[b];
+        state->bank_mask[b] |= (uint64_t)1 << state->gpio_bit[i];
+        if (state->gpio_bit[i] >= state->bank_count[b])
+            state->bank_count[b] = state->gpio_bit[i] + 1;
+    }
+
+    return 0;
+}
+
+// Called by the producer only
+static int capture_push(CAPTURE_STATE_T *state, unsigned *head,
+                        uint64_t timestamp, uint64_t idle_count,
+                        const uint64_t *levels)
+{
+    CAPTURE_SAMPLE_T *sample;
+
+    if (*head - atomic_load_explicit(&state->tail, memory_order_acquire) >=
+        CAPTURE_RING_SIZE)
+    {
+        state->num_dropped++;
+        return -1;
+    }
+
+    sample = &state->ring[*head & (CAPTURE_RING_SIZE - 1)];
+    sample->timestamp = timestamp;
+    sample->idle_count = idle_count;
+    memcpy(sample->levels, levels, sizeof(sample->levels));
+    (*head)++;
+    atomic_store_explicit(&state->head, *head, memory_order_release);
+    state->num_records++;
+
+    return 0;
+}
+
+static void capture_read_levels(CAPTURE_STATE_T *state, uint64_t *levels)
+{
+    unsigned b;
+
+    for (b = 0; b < state->num_banks; b++)
+    {
+        gpio_get_levels(state->bank_first[b], state->bank_count[b], &levels[b]);
+        levels[b] &= state->bank_mask[b];
+    }
+}
+
+static void capture_sample(CAPTURE_STATE_T *state)
+{
+    const uint64_t period = state->config->rate ?
+        NS_PER_SEC / state->config->rate : 0;
+    uint64_t prev_levels[CAPTURE_MAX_BANKS];
+    uint64_t levels[CAPTURE_MAX_BANKS];
+    uint64_t deadline = get_time_ns(CLOCK_MONOTONIC);
+    uint64_t idle_count = 0;
+    unsigned head = 0;
+    int have_prev = 0;
+    unsigned b;
+
+    memset(prev_levels, 0, sizeof(prev_levels));
+    memset(levels, 0, sizeof(levels));
+
+    while (!capture_stop)
+    {
+        uint64_t timestamp;
+        uint64_t diff = 0;
+
+        if (period)
+        {
+            uint64_t now = get_time_ns(CLOCK_MONOTONIC);
+
+            if (deadline > now + CAPTURE_SPIN_NS)
+            {
+                struct timespec ts;
+                uint64_t wake = deadline - CAPTURE_SPIN_NS;
+
+                ts.tv_sec = wake / NS_PER_SEC;
+                ts.tv_nsec = wake % NS_PER_SEC;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            }
+            while (get_time_ns(CLOCK_MONOTONIC) < deadline)
+                ;
+            deadline += period;
+            // Don't try to catch up after a long stall
+            if (deadline + period < now)
+                deadline = now + period;
+        }
+
+        timestamp = get_time_ns(CLOCK_MONOTONIC_RAW);
+        capture_read_levels(state, levels);
+        for (b = 0; b < state->num_banks; b++)
+            diff |= levels[b] ^ prev_levels[b];
+        state->num_samples++;
+
+        if (have_prev && !diff)
+        {
+            idle_count++;
+            continue;
+        }
+
+        // If the writer has fallen behind, retry on the next sample
+        if (capture_push(state, &head, timestamp, idle_count, levels) != 0)
+            continue;
+
+        memcpy(prev_levels, levels, sizeof(levels));
+        have_prev = 1;
+        idle_count = 0;
+    }
+}
+
+static void capture_events(CAPTURE_STATE_T *state)
+{
+    GPIO_EDGE_EVENT_T events[CAPTURE_MAX_EVENTS];
+    uint64_t levels[CAPTURE_MAX_BANKS];
+    uint64_t last_timestamp;
+    unsigned head = 0;
+    int num_events, i;
+    unsigned b;
+
+    // Start from the current state, then apply the edges
+    memset(levels, 0, sizeof(levels));
+    last_timestamp = get_time_ns(CLOCK_MONOTONIC);
+    capture_read_levels(state, levels);
+    capture_push(state, &head, last_timestamp, 0, levels);
+
+    while (!capture_stop)
+    {
+        num_events = gpio_wait_edges(events, CAPTURE_MAX_EVENTS,
+                                     CAPTURE_EVENT_TIMEOUT_MS);
+        if (num_events < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Failed to wait for edges - %s\n", strerror(errno));
+            break;
+        }
+
+        for (i = 0; i < num_events; i++)
+        {
+            const GPIO_EDGE_EVENT_T *event = &events[i];
+            uint64_t timestamp = event->timestamp_ns;
+
+            for (b = 0; b < state->num_banks; b++)
+            {
+                unsigned bit = event->gpio - state->bank_first[b];
+
+                if (event->gpio >= state->bank_first[b] && bit < 64 &&
+                    (state->bank_mask[b] & ((uint64_t)1 << bit)))
+                {
+                    if (event->level)
+                        levels[b] |= (uint64_t)1 << bit;
+                    else
+                        levels[b] &= ~((uint64_t)1 << bit);
+                    break;
+                }
+            }
+
+            // Edges seen before the initial read mustn't go back in time
+            if (timestamp < last_timestamp)
+                timestamp = last_timestamp;
+            last_timestamp = timestamp;
+            state->num_samples++;
+            capture_push(state, &head, timestamp, 1, levels);
+        }
+    }
+}
+
+static int capture_set_realtime(const CAPTURE_CONFIG_T *config)
+{
+    int err;
+
+    if (config->cpu >= 0)
+    {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(config->cpu, &cpus);
+        err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err)
+        {
+            fprintf(stderr, "Failed to run on CPU %d - %s\n", config->cpu,
+                    strerror(err));
+            return -1;
+        }
+    }
+
+    if (config->priority > 0)
+    {
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = config->priority;
+        err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err)
+        {
+            fprintf(stderr, "Failed to set priority %d - %s\n",
+                    config->priority, strerror(err));
+            return -1;
+        }
+        // Avoid page faults in the sampling loop
+        mlockall(MCL_CURRENT | MCL_FUTURE);
+    }
+
+    return 0;
+}
+
+int capture_run(const CAPTURE_CONFIG_T *config, const CAPTURE_GPIO_T *gpios,
+                unsigned num_gpios)
+{
+    CAPTURE_STATE_T state;
+    struct sigaction sa, old_int, old_term;
+    pthread_t writer;
+    uint64_t elapsed;
+    int ret = -1;
+
+    memset(&state, 0, sizeof(state));
+    state.config = config;
+    state.gpios = gpios;
+    state.num_gpios = num_gpios;
+    atomic_init(&state.head, 0);
+    atomic_init(&state.tail, 0);
+    atomic_init(&state.done, 0);
+
+    if (capture_init_banks(&state) != 0)
+    {
+        printf("Too many GPIOs to poll\n");
+        goto out;
+    }
+
+    state.ring = calloc(CAPTURE_RING_SIZE, sizeof(CAPTURE_SAMPLE_T));
+    state.toggled = calloc(num_gpios, sizeof(uint16_t));
+    state.num_edges = calloc(num_gpios, sizeof(uint64_t));
+    if (!state.ring || !state.toggled || !state.num_edges)
+        goto out;
+
+    if (config->output)
+    {
+        state.fp = fopen(config->output, (config->format == CAPTURE_BINARY) ? "wb" : "w");
+        if (!state.fp)
+        {
+            printf("Failed to open '%s' - %s\n", config->output, strerror(errno));
+            goto out;
+        }
+    }
+    else
+    {
+        state.fp = stdout;
+    }
+
+    if (config->events)
+    {
+        unsigned *lines = calloc(num_gpios, sizeof(unsigned));
+        unsigned i;
+
+        if (!lines)
+            goto out;
+        for (i = 0; i < num_gpios; i++)
+            lines[i] = gpios[i].gpio;
+        // Kernel event timestamps use CLOCK_MONOTONIC
+        state.start_time = get_time_ns(CLOCK_MONOTONIC);
+        ret = gpio_request_edges(lines, num_gpios);
+        free(lines);
+        if (ret != 0)
+        {
+            printf("Failed to request edge events - %s\n", strerror(errno));
+            ret = -1;
+            goto out;
+        }
+    }
+
+    write_header(&state);
+
+    capture_stop = 0;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = capture_signal;
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+
+    // Start the writer before the sampler becomes real-time, so that it
+    // doesn't inherit the affinity or scheduling policy
+    if (pthread_create(&writer, NULL, capture_writer, &state) != 0)
+        goto out_signals;
+
+    if (capture_set_realtime(config) == 0)
+    {
+        if (config->events)
+        {
+            capture_events(&state);
+        }
+        else
+        {
+            state.start_time = get_time_ns(CLOCK_MONOTONIC_RAW);
+            capture_sample(&state);
+        }
+        ret = 0;
+    }
+
+    atomic_store_explicit(&state.done, 1, memory_order_release);
+    pthread_join(writer, NULL);
+
+    elapsed = get_time_ns(config->events ? CLOCK_MONOTONIC : CLOCK_MONOTONIC_RAW) -
+              state.start_time;
+    if (!ret && config->verbose && elapsed)
+        fprintf(stderr, "%" PRIu64 " samples in %" PRIu64 "ms (%.0f/s), %"
+                PRIu64 " changes\n", state.num_samples, elapsed / 1000000,
+                (double)state.num_samples * NS_PER_SEC / elapsed,
+                state.num_records);
+    if (state.num_dropped)
+        fprintf(stderr, "Output overran - %" PRIu64 " samples dropped\n",
+                state.num_dropped);
+
+out_signals:
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+
+out:
+    if (config->events)
+        gpio_release_edges();
+    if (state.fp && state.fp != stdout)
+        fclose(state.fp);
+    free(state.ring);
+    free(state.toggled);
+    free(state.num_edges);
+    free(state.gpio_bank);
+    free(state.gpio_bit);
+    return ret;
+}
@@ -0,0 +1,66 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+typedef enum
+{
+    CAPTURE_TEXT,
+    CAPTURE_VCD,
+    CAPTURE_BINARY,
+    CAPTURE_FORMAT_MAX
+} CAPTURE_FORMAT_T;
+
+typedef struct
+{
+    CAPTURE_FORMAT_T format;
+    const char *output;  /* NULL for stdout */
+    unsigned rate;       /* Target samples per second, or 0 for flat out */
+    int cpu;             /* CPU to run the sampler on, or -1 for any */
+    int priority;        /* SCHED_FIFO priority for the sampler, or 0 */
+    int events;          /* Wait for kernel edge events instead of sampling */
+    int deltas;          /* Write only the GPIOs that changed in each record */
+    int verbose;
+} CAPTURE_CONFIG_T;
+
+typedef struct
+{
+    unsigned num;        /* GPIO or pin number, as displayed */
+    unsigned gpio;
+    const char *name;
+} CAPTURE_GPIO_T;
+
+/* Binary stream layout (host byte order):
+ *   CAPTURE_BIN_HEADER_T
+ *   uint32_t num[num_gpios]
+ *   records of { uint64_t timestamp_ns; uint64_t levels[(num_gpios + 63) / 64]; }
+ * where bit n of levels is the level of the nth GPIO in the header.
+ */
+#define CAPTURE_BIN_MAGIC "PCTLCAP"
+#define CAPTURE_BIN_VERSION 1
+
+/* With deltas set, the binary stream has the same header and numbers, but
+ * with CAPTURE_DELTA_MAGIC, followed by records of
+ *   { uint64_t timestamp_ns; uint64_t idle_count; uint16_t num_toggled;
+ *     uint16_t toggled[num_toggled]; }
+ * (packed) where idle_count is the number of samples identical to the
+ * previous record, and toggled holds the indexes in the header of the GPIOs
+ * whose levels changed. All GPIOs start low, so the first record lists the
+ * GPIOs that were high.
+ */
+#define CAPTURE_DELTA_MAGIC "PCTLDLT"
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_gpios;
+} CAPTURE_BIN_HEADER_T;
+
+CAPTURE_FORMAT_T capture_format_by_name(const char *name);
+
+/* Samples the GPIOs until interrupted, writing every change */
+int capture_run(const CAPTURE_CONFIG_T *config, const CAPTURE_GPIO_T *gpios,
+                unsigned num_gpios);
+
+#endif
@@ -2,6 +2,7 @@
 #define GPIOCHIP_H
 
 #include "gpiolib.h"
+#include "util.h"
 
 #if LIBRARY_BUILD
 #define DECLARE_GPIO_CHIP(name, compatible, iface, size, data) \
@@ -39,8 +40,52 @@ struct GPIO_CHIP_INTERFACE_
     void (*gpio_set_pull)(void *priv, uint32_t gpio, GPIO_PULL_T pull);
     const char * (*gpio_get_name)(void *priv, uint32_t gpio);
     const char * (*gpio_get_fsel_name)(void *priv, uint32_t gpio, GPIO_FSEL_T fsel);
+
+    /* Optional bulk accessors - bit n of the mask corresponds to gpio first + n.
+     * Return 0 on success, or non-zero to fall back to per-GPIO accesses.
+     */
+    int (*gpio_get_levels)(void *priv, uint32_t first, uint32_t count, uint64_t *levels);
+    int (*gpio_set_drives)(void *priv, uint32_t first, uint64_t mask, GPIO_DRIVE_T drv);
+
+    /* Optional - the chip-specific pad settings (input enable, slew rate,
+     * Schmitt trigger etc.) as a raw value, for gpio_snapshot and
+     * gpio_restore. get returns 0, or non-zero if the GPIO has no pad control.
+     */
+    int (*gpio_get_pad)(void *priv, uint32_t gpio, uint32_t *pad);
+    void (*gpio_set_pad)(void *priv, uint32_t gpio, uint32_t pad);
+
+    /* Optional - fill in the type, num_banks and register pointers of regs,
+     * returning 0, or non-zero if the registers can't be accessed directly.
+     */
+    int (*gpio_get_regs)(void *priv, GPIO_CHIP_REGS_T *regs);
 };
 
+const GPIO_CHIP_T *gpio_find_chip(const char *name);
+
+/* Serialise a read-modify-write of a register shared between GPIOs. The
+ * locks are striped by register address, so GPIOs in different registers
+ * rarely contend. Writes to set/clear aliases are atomic and need no lock.
+ */
+void gpio_reg_lock(const volatile uint32_t *reg);
+void gpio_reg_unlock(const volatile uint32_t *reg);
+
+/* Instrumentation for GPIOLIB_STATS builds, attributed to the chip and
+ * operation being dispatched by gpiolib. Drivers report their register
+ * accesses with GPIO_STATS_MMIO and wrap each mailbox call in
+ * GPIO_STATS_MBOX. Both compile to nothing otherwise.
+ */
+#if GPIOLIB_STATS
+void gpio_stats_mmio(unsigned reads, unsigned writes);
+void gpio_stats_mbox(uint64_t start_ns);
+#define GPIO_STATS_MMIO(reads, writes) gpio_stats_mmio(reads, writes)
+#define GPIO_STATS_MBOX(call) \
+    ({ uint64_t start_ = get_time_ns(CLOCK_MONOTONIC); __typeof__(call) ret_ = (call); \
+       gpio_stats_mbox(start_); ret_; })
+#else
+#define GPIO_STATS_MMIO(reads, writes) do { } while (0)
+#define GPIO_STATS_MBOX(call) (call)
+#endif
+
 #if LIBRARY_BUILD
 extern const GPIO_CHIP_T *const library_gpiochips[];
 extern const int library_gpiochips_count;
@@ -27,6 +27,19 @@
 #define FLAGS_GPIO             8
 #define FLAGS_PINCTRL          16
 
+/* The registers of a GPIO, found at probe time so that the accessors don't
+ * have to repeat the bank, D0 remapping and AON special cases.
+ */
+struct bcm2712_pin
+{
+    volatile uint32_t *gio;         /* The bank's GIO registers, or NULL */
+    volatile uint32_t *pinmux;      /* NULL if there is no pinmux */
+    volatile uint32_t *pad;         /* NULL if there is no pad control */
+    uint32_t gio_mask;
+    uint8_t pinmux_shift;
+    uint8_t pad_shift;
+};
+
 struct bcm2712_inst
 {
     volatile uint32_t *gpio_base;
@@ -36,6 +49,8 @@ struct bcm2712_inst
     unsigned flags;
     unsigned num_gpios;
     unsigned num_banks;
+    unsigned num_pins;
+    struct bcm2712_pin *pins;       /* num_pins entries */
 };
 
 static unsigned num_instances;
@@ -324,88 +339,201 @@ static volatile uint32_t *bcm2712_pad_base(struct bcm2712_inst *inst,
     return inst->pinmux_base + (gpio / 15);
 }
 
+// Called whenever one of the register blocks is mapped. Returns 0 on success,
+// or -1 if the pin table can't be allocated.
+static int bcm2712_build_pins(struct bcm2712_inst *inst)
+{
+    struct bcm2712_pin *pins;
+    unsigned gpio;
+
+    if (inst->num_pins != inst->num_gpios)
+    {
+        pins = realloc(inst->pins, inst->num_gpios * sizeof(*pins));
+        if (!pins && inst->num_gpios)
+            return -1;
+        inst->pins = pins;
+        inst->num_pins = inst->num_gpios;
+    }
+
+    for (gpio = 0; gpio < inst->num_pins; gpio++)
+    {
+        struct bcm2712_pin *pin = &inst->pins[gpio];
+        unsigned bit = 0;
+
+        pin->gio = bcm2712_gpio_base(inst, gpio, &bit);
+        pin->gio_mask = 1U << bit;
+        pin->pinmux = bcm2712_pinmux_base(inst, gpio, &bit);
+        pin->pinmux_shift = bit;
+        pin->pad = bcm2712_pad_base(inst, gpio, &bit);
+        pin->pad_shift = bit;
+    }
+
+    return 0;
+}
+
+static const struct bcm2712_pin *bcm2712_pin(struct bcm2712_inst *inst,
+                                             unsigned gpio)
+{
+    static const struct bcm2712_pin no_pin;
+
+    return (gpio < inst->num_pins) ? &inst->pins[gpio] : &no_pin;
+}
+
 static int bcm2712_gpio_get_level(void *priv, unsigned gpio)
+{
+    const struct bcm2712_pin *pin = bcm2712_pin(priv, gpio);
+
+    if (!pin->gio)
+        return -1;
+
+    GPIO_STATS_MMIO(1, 0);
+    return !!(pin->gio[BCM2712_GIO_DATA / 4] & pin->gio_mask);
+}
+
+static uint32_t bcm2712_bank_mask(struct bcm2712_inst *inst, unsigned bank)
+{
+    unsigned width = inst->bank_widths[bank];
+
+    return (width >= 32) ? ~0U : ((1U << width) - 1);
+}
+
+static int bcm2712_gpio_get_levels(void *priv, uint32_t first, uint32_t count,
+                                   uint64_t *levels)
 {
     struct bcm2712_inst *inst = priv;
-    unsigned int bit;
-    volatile uint32_t *gpio_base = bcm2712_gpio_base(inst, gpio, &bit);
+    uint64_t bits = 0;
+    unsigned bank;
 
-    if (!gpio_base)
+    if (!inst->gpio_base || first + count > inst->num_banks * 32)
         return -1;
 
-    return !!(gpio_base[BCM2712_GIO_DATA / 4] & (1 << bit));
+    for (bank = first / 32; bank * 32 < first + count; bank++)
+    {
+        int shift = (int)(bank * 32) - (int)first;
+        uint32_t val = inst->gpio_base[bank * (0x20 / 4) + BCM2712_GIO_DATA / 4] &
+                       bcm2712_bank_mask(inst, bank);
+
+        GPIO_STATS_MMIO(1, 0);
+        bits |= (shift < 0) ? (val >> -shift) : ((uint64_t)val << shift);
+    }
+
+    *levels = bits & MASK64(count);
+    return 0;
 }
 
-static void bcm2712_gpio_set_drive(void *priv, unsigned gpio, GPIO_DRIVE_T drv)
+static int bcm2712_gpio_set_drives(void *priv, uint32_t first, uint64_t mask,
+                                   GPIO_DRIVE_T drv)
+{
+    struct bcm2712_inst *inst = priv;
+    unsigned bank;
+
+    if (!inst->gpio_base || first >= inst->num_banks * 32 || drv > DRIVE_HIGH)
+        return -1;
+
+    /* A single read-modify-write of each bank's data register */
+    for (bank = first / 32; bank < inst->num_banks && bank * 32 < first + 64; bank++)
+    {
+        volatile uint32_t *data = inst->gpio_base + bank * (0x20 / 4) + BCM2712_GIO_DATA / 4;
+        int shift = (int)(bank * 32) - (int)first;
+        uint32_t bits = (shift < 0) ? (uint32_t)(mask << -shift) :
+                                      (uint32_t)(mask >> shift);
+
+        bits &= bcm2712_bank_mask(inst, bank);
+        if (bits)
+        {
+            gpio_reg_lock(data);
+            GPIO_STATS_MMIO(1, 1);
+            *data = drv ? (*data | bits) : (*data & ~bits);
+            gpio_reg_unlock(data);
+        }
+    }
+
+    return 0;
+}
+
+static int bcm2712_gpio_get_regs(void *priv, GPIO_CHIP_REGS_T *regs)
 {
     struct bcm2712_inst *inst = priv;
-    unsigned int bit;
-    volatile uint32_t *gpio_base = bcm2712_gpio_base(inst, gpio, &bit);
-    uint32_t gpio_val;
+    unsigned bank;
+
+    if (!inst->gpio_base || inst->num_banks > GPIO_REGS_MAX_BANKS)
+        return -1;
 
-    if (!gpio_base)
+    /* No set/clear aliases - outputs are changed by read-modify-write */
+    regs->type = GPIO_REGS_BCM2712;
+    regs->num_banks = inst->num_banks;
+    for (bank = 0; bank < inst->num_banks; bank++)
+    {
+        volatile uint32_t *data = inst->gpio_base + bank * (0x20 / 4) + BCM2712_GIO_DATA / 4;
+
+        regs->out[bank] = data;
+        regs->lev[bank] = data;
+    }
+    return 0;
+}
+
+static void bcm2712_gpio_set_drive(void *priv, unsigned gpio, GPIO_DRIVE_T drv)
+{
+    const struct bcm2712_pin *pin = bcm2712_pin(priv, gpio);
+    volatile uint32_t *data;
+
+    if (!pin->gio)
         return;
 
-    gpio_val = gpio_base[BCM2712_GIO_DATA / 4];
-    gpio_val = (gpio_val & ~(1U << bit)) | (drv << bit);
-    gpio_base[BCM2712_GIO_DATA / 4] = gpio_val;
+    data = &pin->gio[BCM2712_GIO_DATA / 4];
+    gpio_reg_lock(data);
+    GPIO_STATS_MMIO(1, 1);
+    *data = (drv == DRIVE_HIGH) ? (*data | pin->gio_mask) : (*data & ~pin->gio_mask);
+    gpio_reg_unlock(data);
 }
 
 static GPIO_DRIVE_T bcm2712_gpio_get_drive(void *priv, unsigned gpio)
 {
-    struct bcm2712_inst *inst = priv;
-    unsigned int bit;
-    volatile uint32_t *gpio_base = bcm2712_gpio_base(inst, gpio, &bit);
-    uint32_t gpio_val;
+    const struct bcm2712_pin *pin = bcm2712_pin(priv, gpio);
 
-    if (!gpio_base)
+    if (!pin->gio)
         return DRIVE_MAX;
 
-    gpio_val = gpio_base[BCM2712_GIO_DATA / 4];
-    return (gpio_val & (1U << bit)) ? DRIVE_HIGH : DRIVE_LOW;
+    GPIO_STATS_MMIO(1, 0);
+    return (pin->gio[BCM2712_GIO_DATA / 4] & pin->gio_mask) ? DRIVE_HIGH : DRIVE_LOW;
 }
 
 static void bcm2712_gpio_set_dir(void *priv, unsigned gpio, GPIO_DIR_T dir)
 {
-    struct bcm2712_inst *inst = priv;
-    unsigned int bit;
-    volatile uint32_t *gpio_base = bcm2712_gpio_base(inst, gpio, &bit);
-    uint32_t gpio_val;
+    const struct bcm2712_pin *pin = bcm2712_pin(priv, gpio);
+    volatile uint32_t *iodir;
 
-    if (!gpio_base)
+    if (!pin->gio)
         return;
 
-    gpio_val = gpio_base[BCM2712_GIO_IODIR / 4];
-    gpio_val &= ~(1U << bit);
-    gpio_val |= ((dir == DIR_INPUT) << bit);
-    gpio_base[BCM2712_GIO_IODIR / 4] = gpio_val;
+    iodir = &pin->gio[BCM2712_GIO_IODIR / 4];
+    gpio_reg_lock(iodir);
+    GPIO_STATS_MMIO(1, 1);
+    *iodir = (dir == DIR_INPUT) ? (*iodir | pin->gio_mask) : (*iodir & ~pin->gio_mask);
+    gpio_reg_unlock(iodir);
 }
 
 static GPIO_DIR_T bcm2712_gpio_get_dir(void *priv, unsigned gpio)
 {
-    struct bcm2712_inst *inst = priv;
-    unsigned int bit;
-    volatile uint32_t *gpio_base = bcm2712_gpio_base(inst, gpio, &bit);
-    uint32_t gpio_val;
+    const struct bcm2712_pin *pin = bcm2712_pin(priv, gpio);
 
-    if (!gpio_base)
+    if (!pin->gio)
         return DIR_MAX;
 
-    gpio_val = gpio_base[BCM2712_GIO_IODIR / 4];
-    return (gpio_val & (1U << bit)) ? DIR_INPUT : DIR_OUTPUT;
+    GPIO_STATS_MMIO(1, 0);
+    return (pin->gio[BCM2712_GIO_IODIR / 4] & pin->gio_mask) ? DIR_INPUT : DIR_OUTPUT;
 }
 
 static GPIO_FSEL_T bcm2712_pinctrl_get_fsel(void *priv, unsigned gpio)
 {
-    struct bcm2712_inst *inst = priv;
-    unsigned int pinmux_bit;
-    volatile uint32_t *pinmux_base = bcm2712_pinmux_base(inst, gpio, &pinmux_bit);
+    const struct bcm2712_pin *pin = bcm2712_pin(priv, gpio);
     int fsel;
 
-    if (!pinmux_base)
+    if (!pin->pinmux)
         return -1;
 
-    fsel = ((*pinmux_base >> pinmux_bit) & 0xf);
+    fsel = ((*pin->pinmux >> pin->pinmux_shift) & 0xf);
+    GPIO_STATS_MMIO(1, 0);
 
     if (fsel == 0)
         return GPIO_FSEL_GPIO;
@@ -420,13 +548,11 @@ static GPIO_FSEL_T bcm2712_pinctrl_get_fsel(void *priv, unsigned gpio)
 
 static void bcm2712_pinctrl_set_fsel(void *priv, unsigned gpio, const GPIO_FSEL_T func)
 {
-    struct bcm2712_inst *inst = priv;
-    unsigned int pinmux_bit;
-    volatile uint32_t *pinmux_base = bcm2712_pinmux_base(inst, gpio, &pinmux_bit);
+    const struct bcm2712_pin *pin = bcm2712_pin(priv, gpio);
     uint32_t pinmux_val;
     int fsel;
 
-    if (!pinmux_base)
+    if (!pin->pinmux)
         return;
 
     if (func == GPIO_FSEL_INPUT || func == GPIO_FSEL_OUTPUT || func == GPIO_FSEL_GPIO)
@@ -448,23 +574,25 @@ static void bcm2712_pinctrl_set_fsel(void *priv, unsigned gpio, const GPIO_FSEL_
         return;
     }
 
-    pinmux_val = *pinmux_base;
-    pinmux_val &= ~(0xf << pinmux_bit);
-    pinmux_val |= (fsel << pinmux_bit);
-    *pinmux_base = pinmux_val;
+    gpio_reg_lock(pin->pinmux);
+    pinmux_val = *pin->pinmux;
+    pinmux_val &= ~(0xf << pin->pinmux_shift);
+    pinmux_val |= (fsel << pin->pinmux_shift);
+    *pin->pinmux = pinmux_val;
+    GPIO_STATS_MMIO(1, 1);
+    gpio_reg_unlock(pin->pinmux);
 }
 
 static GPIO_PULL_T bcm2712_pinctrl_get_pull(void *priv, unsigned gpio)
 {
-    struct bcm2712_inst *inst = priv;
-    unsigned int bit;
-    volatile uint32_t *pad_base = bcm2712_pad_base(inst, gpio, &bit);
+    const struct bcm2712_pin *pin = bcm2712_pin(priv, gpio);
     uint32_t pad_val;
 
-    if (!pad_base)
+    if (!pin->pad)
         return PULL_MAX;
 
-    pad_val = (*pad_base >> bit) & 0x3;
+    pad_val = (*pin->pad >> pin->pad_shift) & 0x3;
+    GPIO_STATS_MMIO(1, 0);
     switch (pad_val)
     {
     case BCM2712_PAD_PULL_OFF:
@@ -480,13 +608,11 @@ static GPIO_PULL_T bcm2712_pinctrl_get_pull(void *priv, unsigned gpio)
 
 static void bcm2712_pinctrl_set_pull(void *priv, unsigned gpio, GPIO_PULL_T pull)
 {
-    struct bcm2712_inst *inst = priv;
-    unsigned int bit = 0;
-    volatile uint32_t *pad_base = bcm2712_pad_base(inst, gpio, &bit);
+    const struct bcm2712_pin *pin = bcm2712_pin(priv, gpio);
     uint32_t padval;
     int val;
 
-    if (!pad_base)
+    if (!pin->pad)
         return;
 
     switch (pull)
@@ -505,11 +631,46 @@ static void bcm2712_pinctrl_set_pull(void *priv, unsigned gpio, GPIO_PULL_T pull
         return;
     }
 
-    padval = *pad_base;
-    padval &= ~(3 << bit);
-    padval |= (val << bit);
+    gpio_reg_lock(pin->pad);
+    padval = *pin->pad;
+    padval &= ~(3 << pin->pad_shift);
+    padval |= (val << pin->pad_shift);
+
+    *pin->pad = padval;
+    GPIO_STATS_MMIO(1, 1);
+    gpio_reg_unlock(pin->pad);
+}
+
+/* The pad field only holds the pull, but a raw copy also preserves the
+ * reserved value that get_pull can't express.
+ */
+static int bcm2712_pinctrl_get_pad(void *priv, unsigned gpio, uint32_t *pad)
+{
+    const struct bcm2712_pin *pin = bcm2712_pin(priv, gpio);
+
+    if (!pin->pad)
+        return -1;
+
+    *pad = (*pin->pad >> pin->pad_shift) & 0x3;
+    GPIO_STATS_MMIO(1, 0);
+    return 0;
+}
+
+static void bcm2712_pinctrl_set_pad(void *priv, unsigned gpio, uint32_t pad)
+{
+    const struct bcm2712_pin *pin = bcm2712_pin(priv, gpio);
+    uint32_t padval;
+
+    if (!pin->pad)
+        return;
 
-    *pad_base = padval;
+    gpio_reg_lock(pin->pad);
+    padval = *pin->pad;
+    padval &= ~(3 << pin->pad_shift);
+    padval |= ((pad & 0x3) << pin->pad_shift);
+    *pin->pad = padval;
+    GPIO_STATS_MMIO(1, 1);
+    gpio_reg_unlock(pin->pad);
 }
 
 static void *bcm2712_gpio_create_instance(const GPIO_CHIP_T *chip,
@@ -597,6 +758,8 @@ static void *bcm2712_gpio_probe_instance(void *priv, volatile uint32_t *base)
     struct bcm2712_inst *inst = priv;
 
     inst->gpio_base = base;
+    if (bcm2712_build_pins(inst) != 0)
+        return NULL;
 
     return inst;
 }
@@ -723,6 +886,8 @@ static void *bcm2712_pinctrl_probe_instance(void *priv, volatile uint32_t *base)
     }
 
     inst->pad_offset = pad_offset;
+    if (bcm2712_build_pins(inst) != 0)
+        return NULL;
 
     return inst;
 }
@@ -834,6 +999,11 @@ static const GPIO_CHIP_INTERFACE_T bcm2712_gpio_interface =
     .gpio_set_pull = bcm2712_pinctrl_set_pull,
     .gpio_get_name = bcm2712_gpio_get_name,
     .gpio_get_fsel_name = bcm2712_pinctrl_get_fsel_name,
+    .gpio_get_levels = bcm2712_gpio_get_levels,
+    .gpio_set_drives = bcm2712_gpio_set_drives,
+    .gpio_get_pad = bcm2712_pinctrl_get_pad,
+    .gpio_set_pad = bcm2712_pinctrl_set_pad,
+    .gpio_get_regs = bcm2712_gpio_get_regs,
 };
 
 DECLARE_GPIO_CHIP(brcmstb, "brcm,brcmstb-gpio",
@@ -855,6 +1025,10 @@ static const GPIO_CHIP_INTERFACE_T bcm2712_pinctrl_interface =
     .gpio_set_pull = bcm2712_pinctrl_set_pull,
     .gpio_get_name = bcm2712_gpio_get_name,
     .gpio_get_fsel_name = bcm2712_pinctrl_get_fsel_name,
+    .gpio_get_levels = bcm2712_gpio_get_levels,
+    .gpio_set_drives = bcm2712_gpio_set_drives,
+    .gpio_get_pad = bcm2712_pinctrl_get_pad,
+    .gpio_set_pad = bcm2712_pinctrl_set_pad,
 };
 
 DECLARE_GPIO_CHIP(bcm2712, "brcm,bcm2712-pinctrl",
@@ -177,6 +177,7 @@ static GPIO_FSEL_T bcm2835_gpio_get_fsel(void *priv, unsigned gpio)
 
     if (gpio < inst->num_gpios)
     {
+        GPIO_STATS_MMIO(1, 0);
         switch ((base[reg] >> lsb) & 7)
         {
         case 0: return GPIO_FSEL_INPUT;
@@ -217,7 +218,12 @@ static void bcm2835_gpio_set_fsel(void *priv, unsigned gpio, const GPIO_FSEL_T f
     }
 
     if (gpio < inst->num_gpios)
+    {
+        gpio_reg_lock(&base[reg]);
+        GPIO_STATS_MMIO(1, 1);
         base[reg] = (base[reg] & ~(0x7 << lsb)) | (fsel << lsb);
+        gpio_reg_unlock(&base[reg]);
+    }
 }
 
 static GPIO_DIR_T bcm2835_gpio_get_dir(void *priv, unsigned gpio)
@@ -252,9 +258,61 @@ static int bcm2835_gpio_get_level(void *priv, unsigned gpio)
     if (gpio >= inst->num_gpios)
         return -1;
 
+    GPIO_STATS_MMIO(1, 0);
     return (base[GPLEV0 + (gpio / 32)] >> (gpio % 32)) & 1;
 }
 
+static int bcm2835_gpio_get_levels(void *priv, uint32_t first, uint32_t count,
+                                   uint64_t *levels)
+{
+    struct bcm2835_inst *inst = priv;
+    volatile uint32_t *base = inst->base;
+    uint64_t bits = 0;
+    unsigned bank;
+
+    if (!base || first + count > inst->num_gpios)
+        return -1;
+
+    for (bank = first / 32; bank * 32 < first + count; bank++)
+    {
+        int shift = (int)(bank * 32) - (int)first;
+        uint32_t val = base[GPLEV0 + bank];
+
+        GPIO_STATS_MMIO(1, 0);
+        bits |= (shift < 0) ? (val >> -shift) : ((uint64_t)val << shift);
+    }
+
+    *levels = bits & MASK64(count);
+    return 0;
+}
+
+static int bcm2835_gpio_set_drives(void *priv, uint32_t first, uint64_t mask,
+                                   GPIO_DRIVE_T drv)
+{
+    struct bcm2835_inst *inst = priv;
+    volatile uint32_t *base = inst->base;
+    unsigned bank;
+
+    if (!base || first >= inst->num_gpios || drv > DRIVE_HIGH)
+        return -1;
+
+    /* One write per bank register, so each bank changes atomically */
+    mask &= MASK64(inst->num_gpios - first);
+    for (bank = first / 32; bank * 32 < inst->num_gpios && bank * 32 < first + 64; bank++)
+    {
+        int shift = (int)(bank * 32) - (int)first;
+        uint32_t bits = (shift < 0) ? (uint32_t)(mask << -shift) :
+                                      (uint32_t)(mask >> shift);
+        if (bits)
+        {
+            base[(drv ? GPSET0 : GPCLR0) + bank] = bits;
+            GPIO_STATS_MMIO(0, 1);
+        }
+    }
+
+    return 0;
+}
+
 GPIO_DRIVE_T bcm2835_gpio_get_drive(void *priv, unsigned gpio)
 {
     /* This is a write-only mechanism */
@@ -269,7 +327,10 @@ static void bcm2835_gpio_set_drive(void *priv, unsigned gpio, GPIO_DRIVE_T drv)
     volatile uint32_t *base = inst->base;
 
     if (gpio < inst->num_gpios && drv <= DRIVE_HIGH)
+    {
         base[(drv ? GPSET0 : GPCLR0) + (gpio / 32)] = (1 << (gpio % 32));
+        GPIO_STATS_MMIO(0, 1);
+    }
 }
 
 static GPIO_PULL_T bcm2835_gpio_get_pull(void *priv, unsigned gpio)
@@ -290,6 +351,8 @@ static void bcm2835_gpio_set_pull(void *priv, unsigned gpio, GPIO_PULL_T pull)
     if (gpio >= inst->num_gpios || pull < PULL_NONE || pull > PULL_UP)
         return;
 
+    // GPPUD is shared by all GPIOs, so hold it for the whole sequence
+    gpio_reg_lock(&base[GPPUD]);
     base[GPPUD] = pull;
     usleep(10);
     base[clkreg] = clkbit;
@@ -298,6 +361,8 @@ static void bcm2835_gpio_set_pull(void *priv, unsigned gpio, GPIO_PULL_T pull)
     usleep(10);
     base[clkreg] = 0;
     usleep(10);
+    GPIO_STATS_MMIO(0, 4);
+    gpio_reg_unlock(&base[GPPUD]);
 }
 
 static const char *bcm2835_gpio_get_name(void *priv, unsigned gpio)
@@ -350,6 +415,7 @@ static GPIO_PULL_T bcm2711_gpio_get_pull(void *priv, unsigned gpio)
 
     if (gpio < BCM2711_NUM_GPIOS)
     {
+        GPIO_STATS_MMIO(1, 0);
         switch ((base[reg] >> lsb) & 3)
         {
         case 0: return PULL_NONE;
@@ -387,7 +453,10 @@ static void bcm2711_gpio_set_pull(void *priv, unsigned gpio, GPIO_PULL_T pull)
         return;
     }
 
+    gpio_reg_lock(&base[reg]);
+    GPIO_STATS_MMIO(1, 1);
     base[reg] = (base[reg] & ~(3 << lsb)) | (pull_val << lsb);
+    gpio_reg_unlock(&base[reg]);
 }
 
 static const char *bcm2711_gpio_get_fsel_name(void *priv, unsigned gpio, GPIO_FSEL_T fsel)
@@ -442,6 +511,25 @@ static void *bcm2835_gpio_probe_instance(void *priv, volatile uint32_t *base)
     return priv;
 }
 
+static int bcm2835_gpio_get_regs(void *priv, GPIO_CHIP_REGS_T *regs)
+{
+    struct bcm2835_inst *inst = priv;
+    unsigned bank;
+
+    if (!inst->base)
+        return -1;
+
+    regs->type = GPIO_REGS_BCM2835;
+    regs->num_banks = (inst->num_gpios + 31) / 32;
+    for (bank = 0; bank < regs->num_banks; bank++)
+    {
+        regs->set[bank] = &inst->base[GPSET0 + bank];
+        regs->clr[bank] = &inst->base[GPCLR0 + bank];
+        regs->lev[bank] = &inst->base[GPLEV0 + bank];
+    }
+    return 0;
+}
+
 static const GPIO_CHIP_INTERFACE_T bcm2835_gpio_interface =
 {
     .gpio_create_instance = bcm2835_gpio_create_instance,
@@ -458,6 +546,9 @@ static const GPIO_CHIP_INTERFACE_T bcm2835_gpio_interface =
     .gpio_set_pull = bcm2835_gpio_set_pull,
     .gpio_get_name = bcm2835_gpio_get_name,
     .gpio_get_fsel_name = bcm2835_gpio_get_fsel_name,
+    .gpio_get_levels = bcm2835_gpio_get_levels,
+    .gpio_set_drives = bcm2835_gpio_set_drives,
+    .gpio_get_regs = bcm2835_gpio_get_regs,
 };
 
 DECLARE_GPIO_CHIP(bcm2835, "brcm,bcm2835-gpio", &bcm2835_gpio_interface,
@@ -487,6 +578,9 @@ static const GPIO_CHIP_INTERFACE_T bcm2711_gpio_interface =
     .gpio_set_pull = bcm2711_gpio_set_pull,
     .gpio_get_name = bcm2835_gpio_get_name,
     .gpio_get_fsel_name = bcm2711_gpio_get_fsel_name,
+    .gpio_get_levels = bcm2835_gpio_get_levels,
+    .gpio_set_drives = bcm2835_gpio_set_drives,
+    .gpio_get_regs = bcm2835_gpio_get_regs,
 };
 
 DECLARE_GPIO_CHIP(bcm2711, "brcm,bcm2711-gpio",
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 
@@ -28,11 +29,20 @@
 #define RPI_FIRMWARE_GET_GPIO_CONFIG 0x00030043
 #define RPI_FIRMWARE_SET_GPIO_CONFIG 0x00038043
 
-struct firmware_inst
-{
-    unsigned num_gpios;
-    int mbox_fd;
-};
+/* Each mailbox round trip to VideoCore is slow, and "pinctrl get" asks for
+ * the function, pull and drive of each GPIO separately, all of which come
+ * from its config. So the configs of all the expander GPIOs are read
+ * together in one batch of tags and cached for just long enough to answer
+ * a single get. Older firmware reports the drive of a config as ~0, so the
+ * states are read in the same batch to stand in for it, and a cached
+ * config always holds a real drive - it is safe to modify and write back.
+ * A tag that fails only invalidates its own GPIO, any write through this
+ * instance discards the cache, and get_level never uses the cache.
+ * The cache and the mailbox are guarded by the instance lock.
+ */
+#define FIRMWARE_CACHE_NS       10000000 /* 10ms */
+#define FIRMWARE_MAX_TAGS       (2 * NUM_GPIOS)
+#define FIRMWARE_BUF_WORDS      (2 + FIRMWARE_MAX_TAGS * (3 + 6) + 1)
 
 struct gpio_config
 {
@@ -55,15 +65,44 @@ struct gpio_get_set_state
     uint32_t state;
 };
 
+struct firmware_tag
+{
+    uint32_t tag;
+    void *data;
+    unsigned size;
+    int err;                /* Set by firmware_properties */
+};
+
+struct firmware_inst
+{
+    unsigned num_gpios;
+    int mbox_fd;
+    pthread_mutex_t lock;
+    uint64_t cache_time;    /* CLOCK_MONOTONIC ns when filled, or 0 */
+    uint32_t cache_valid;   /* Bit n set if configs[n] was read */
+    struct gpio_config configs[NUM_GPIOS];
+};
+
 static struct firmware_inst firmware_instance;
 
-static int firmware_property(struct firmware_inst *inst, uint32_t tag, void *tag_data, int tag_size)
+/* Returns 0 if every tag succeeded. Otherwise the err of each tag says
+ * whether its data was filled in.
+ */
+static int firmware_properties(struct firmware_inst *inst,
+                               struct firmware_tag *tags, unsigned num_tags)
 {
-    uint32_t buf[16];
-    int words = 5 + (tag_size + 3) / 4 + 1;
+    uint32_t buf[FIRMWARE_BUF_WORDS];
+    unsigned words = 2 + 1;
+    unsigned pos;
+    unsigned i;
     int err;
 
-    if (words > (int)ARRAY_SIZE(buf))
+    for (i = 0; i < num_tags; i++)
+        tags[i].err = -1;
+
+    for (i = 0; i < num_tags; i++)
+        words += 3 + (tags[i].size + 3) / 4;
+    if (words > ARRAY_SIZE(buf))
         return -1;
     if (!inst->mbox_fd)
         inst->mbox_fd = open(DEVICE_FILE_NAME, 0);
@@ -72,26 +111,106 @@ static int firmware_property(struct firmware_inst *inst, uint32_t tag, void *tag
 
     buf[0] = words * sizeof(buf[0]);
     buf[1] = RPI_FIRMWARE_STATUS_REQUEST; // process request
-    buf[2] = tag;
-    buf[3] = tag_size;
-    buf[4] = tag_size; // set to response length
-    memcpy(&buf[5], tag_data, tag_size);
-    buf[words - 1] = RPI_FIRMWARE_PROPERTY_END;
-    err = ioctl(inst->mbox_fd, IOCTL_MBOX_PROPERTY, buf);
-    if (!err)
+    for (i = 0, pos = 2; i < num_tags; i++)
     {
-        if (buf[4] & RPI_FIRMWARE_STATUS_SUCCESS)
-            memcpy(tag_data, &buf[5], buf[4] & ~RPI_FIRMWARE_STATUS_SUCCESS);
+        buf[pos] = tags[i].tag;
+        buf[pos + 1] = tags[i].size;
+        buf[pos + 2] = tags[i].size; // set to response length
+        memcpy(&buf[pos + 3], tags[i].data, tags[i].size);
+        pos += 3 + (tags[i].size + 3) / 4;
+    }
+    buf[pos] = RPI_FIRMWARE_PROPERTY_END;
+
+    err = GPIO_STATS_MBOX(ioctl(inst->mbox_fd, IOCTL_MBOX_PROPERTY, buf));
+    if (err)
+        return err;
+
+    for (i = 0, pos = 2; i < num_tags; i++)
+    {
+        uint32_t len = buf[pos + 2];
+
+        if (len & RPI_FIRMWARE_STATUS_SUCCESS)
+        {
+            len &= ~RPI_FIRMWARE_STATUS_SUCCESS;
+            memcpy(tags[i].data, &buf[pos + 3], (len < tags[i].size) ? len : tags[i].size);
+            tags[i].err = 0;
+        }
         else
+        {
+            tags[i].err = -EREMOTEIO;
             err = -EREMOTEIO;
+        }
+        pos += 3 + (tags[i].size + 3) / 4;
     }
     return err;
 }
 
+static int firmware_property(struct firmware_inst *inst, uint32_t tag, void *tag_data, int tag_size)
+{
+    struct firmware_tag prop = { tag, tag_data, tag_size, 0 };
+
+    return firmware_properties(inst, &prop, 1);
+}
+
+/* The remaining helpers must be called with inst->lock held */
+
+static void firmware_refresh(struct firmware_inst *inst)
+{
+    struct firmware_tag tags[FIRMWARE_MAX_TAGS];
+    struct firmware_tag *state_tags = tags + inst->num_gpios;
+    struct gpio_get_set_config configs[NUM_GPIOS];
+    struct gpio_get_set_state states[NUM_GPIOS];
+    unsigned gpio;
+    int ret;
+
+    for (gpio = 0; gpio < inst->num_gpios; gpio++)
+    {
+        configs[gpio].gpio = RPI_EXP_GPIO_BASE + gpio;
+        configs[gpio].config.drive = ~0;
+        tags[gpio].tag = RPI_FIRMWARE_GET_GPIO_CONFIG;
+        tags[gpio].data = &configs[gpio];
+        tags[gpio].size = sizeof(configs[gpio]);
+
+        states[gpio].gpio = RPI_EXP_GPIO_BASE + gpio;
+        states[gpio].state = 0;
+        state_tags[gpio].tag = RPI_FIRMWARE_GET_GPIO_STATE;
+        state_tags[gpio].data = &states[gpio];
+        state_tags[gpio].size = sizeof(states[gpio]);
+    }
+
+    inst->cache_time = 0;
+    inst->cache_valid = 0;
+    ret = firmware_properties(inst, tags, 2 * inst->num_gpios);
+    if (ret && ret != -EREMOTEIO)
+        return; // The mailbox call itself failed
+
+    for (gpio = 0; gpio < inst->num_gpios; gpio++)
+    {
+        struct gpio_config *config = &configs[gpio].config;
+
+        if (tags[gpio].err)
+            continue;
+        // Older firmware doesn't report the drive, which is then the level
+        if (config->drive == ~0u)
+        {
+            if (state_tags[gpio].err)
+                continue;
+            config->drive = states[gpio].state;
+        }
+        inst->configs[gpio] = *config;
+        inst->cache_valid |= 1u << gpio;
+    }
+    inst->cache_time = get_time_ns(CLOCK_MONOTONIC);
+}
+
 static int firmware_get_gpio_state(struct firmware_inst *inst, unsigned gpio)
 {
     struct gpio_get_set_state prop;
+
+    if (gpio >= inst->num_gpios)
+        return -1;
     prop.gpio = RPI_EXP_GPIO_BASE + gpio;
+    prop.state = 0;
     if (firmware_property(inst, RPI_FIRMWARE_GET_GPIO_STATE, &prop, sizeof(prop)))
         return -1;
     return prop.state;
@@ -102,19 +221,20 @@ static int firmware_set_gpio_state(struct firmware_inst *inst, unsigned gpio, un
     struct gpio_get_set_state prop;
     prop.gpio = RPI_EXP_GPIO_BASE + gpio;
     prop.state = state;
+    inst->cache_time = 0;
     return firmware_property(inst, RPI_FIRMWARE_SET_GPIO_STATE, &prop, sizeof(prop));
 }
 
 static int firmware_get_gpio_config(struct firmware_inst *inst, int gpio, struct gpio_config *config)
 {
-    struct gpio_get_set_config prop;
-    prop.gpio = RPI_EXP_GPIO_BASE + gpio;
-    prop.config.drive = ~0;
-    if (firmware_property(inst, RPI_FIRMWARE_GET_GPIO_CONFIG, &prop, sizeof(prop)) < 0)
+    if (gpio < 0 || (unsigned)gpio >= inst->num_gpios)
+        return -1;
+    if (!inst->cache_time ||
+        get_time_ns(CLOCK_MONOTONIC) - inst->cache_time >= FIRMWARE_CACHE_NS)
+        firmware_refresh(inst);
+    if (!(inst->cache_valid & (1u << gpio)))
         return -1;
-    if (prop.config.drive == ~0u)
-        prop.config.drive = firmware_get_gpio_state(inst, gpio);
-    *config = prop.config;
+    *config = inst->configs[gpio];
     return 0;
 }
 
@@ -123,6 +243,7 @@ static int firmware_set_gpio_config(struct firmware_inst *inst, int gpio, const
     struct gpio_get_set_config prop;
     prop.gpio = RPI_EXP_GPIO_BASE + gpio;
     prop.config = *config;
+    inst->cache_time = 0;
     return firmware_property(inst, RPI_FIRMWARE_SET_GPIO_CONFIG, &prop, sizeof(prop));
 }
 
@@ -130,8 +251,12 @@ static GPIO_DIR_T firmware_gpio_get_dir(void *priv, unsigned gpio)
 {
     struct firmware_inst *inst = priv;
     struct gpio_config config;
-    if (gpio < inst->num_gpios &&
-        !firmware_get_gpio_config(inst, gpio, &config))
+    int ret;
+
+    pthread_mutex_lock(&inst->lock);
+    ret = firmware_get_gpio_config(inst, gpio, &config);
+    pthread_mutex_unlock(&inst->lock);
+    if (!ret)
         return (config.direction == 1) ? DIR_OUTPUT : DIR_INPUT;
     return DIR_MAX;
 }
@@ -144,6 +269,7 @@ static void firmware_gpio_set_dir(void *priv, unsigned gpio, GPIO_DIR_T dir)
     if (gpio >= inst->num_gpios)
         return;
 
+    pthread_mutex_lock(&inst->lock);
     if (!firmware_get_gpio_config(inst, gpio, &config))
     {
         if (dir != config.direction)
@@ -152,6 +278,7 @@ static void firmware_gpio_set_dir(void *priv, unsigned gpio, GPIO_DIR_T dir)
             firmware_set_gpio_config(inst, gpio, &config);
         }
     }
+    pthread_mutex_unlock(&inst->lock);
 }
 
 static GPIO_FSEL_T firmware_gpio_get_fsel(void *priv, unsigned gpio)
@@ -183,18 +310,24 @@ static void firmware_gpio_set_fsel(void *priv, unsigned gpio, const GPIO_FSEL_T
 static int firmware_gpio_get_level(void *priv, unsigned gpio)
 {
     struct firmware_inst *inst = priv;
+    int level;
 
-    if (gpio >= inst->num_gpios)
-        return -1;
-
-    return firmware_get_gpio_state(inst, gpio);
+    pthread_mutex_lock(&inst->lock);
+    level = firmware_get_gpio_state(inst, gpio);
+    pthread_mutex_unlock(&inst->lock);
+    return level;
 }
 
 GPIO_DRIVE_T firmware_gpio_get_drive(void *priv, unsigned gpio)
 {
     struct firmware_inst *inst = priv;
     struct gpio_config config;
-    if (!firmware_get_gpio_config(inst, gpio, &config))
+    int ret;
+
+    pthread_mutex_lock(&inst->lock);
+    ret = firmware_get_gpio_config(inst, gpio, &config);
+    pthread_mutex_unlock(&inst->lock);
+    if (!ret)
     {
         if (config.direction == 1)
             return config.drive ? DRIVE_HIGH : DRIVE_LOW;
@@ -209,14 +342,89 @@ static void firmware_gpio_set_drive(void *priv, unsigned gpio, GPIO_DRIVE_T drv)
     if (gpio >= inst->num_gpios)
         return;
 
+    pthread_mutex_lock(&inst->lock);
     firmware_set_gpio_state(inst, gpio, drv == DRIVE_HIGH);
+    pthread_mutex_unlock(&inst->lock);
+}
+
+static int firmware_gpio_get_levels(void *priv, uint32_t first, uint32_t count,
+                                    uint64_t *levels)
+{
+    struct firmware_inst *inst = priv;
+    struct firmware_tag tags[NUM_GPIOS];
+    struct gpio_get_set_state states[NUM_GPIOS];
+    unsigned i;
+    int ret;
+
+    if (first + count > inst->num_gpios)
+        return -1;
+
+    /* Always sampled afresh, in a single round trip */
+    for (i = 0; i < count; i++)
+    {
+        states[i].gpio = RPI_EXP_GPIO_BASE + first + i;
+        tags[i].tag = RPI_FIRMWARE_GET_GPIO_STATE;
+        tags[i].data = &states[i];
+        tags[i].size = sizeof(states[i]);
+    }
+
+    pthread_mutex_lock(&inst->lock);
+    ret = firmware_properties(inst, tags, count);
+    pthread_mutex_unlock(&inst->lock);
+    if (ret)
+        return -1;
+
+    *levels = 0;
+    for (i = 0; i < count; i++)
+    {
+        if (states[i].state)
+            *levels |= (uint64_t)1 << i;
+    }
+    return 0;
+}
+
+static int firmware_gpio_set_drives(void *priv, uint32_t first, uint64_t mask,
+                                    GPIO_DRIVE_T drv)
+{
+    struct firmware_inst *inst = priv;
+    struct firmware_tag tags[NUM_GPIOS];
+    struct gpio_get_set_state states[NUM_GPIOS];
+    unsigned count = 0;
+    unsigned i;
+    int ret;
+
+    if (first >= inst->num_gpios || (mask >> (inst->num_gpios - first)))
+        return -1;
+
+    for (i = 0; i < inst->num_gpios - first; i++)
+    {
+        if (!((mask >> i) & 1))
+            continue;
+        states[count].gpio = RPI_EXP_GPIO_BASE + first + i;
+        states[count].state = (drv == DRIVE_HIGH);
+        tags[count].tag = RPI_FIRMWARE_SET_GPIO_STATE;
+        tags[count].data = &states[count];
+        tags[count].size = sizeof(states[count]);
+        count++;
+    }
+
+    pthread_mutex_lock(&inst->lock);
+    inst->cache_time = 0;
+    ret = firmware_properties(inst, tags, count);
+    pthread_mutex_unlock(&inst->lock);
+    return ret ? -1 : 0;
 }
 
 static GPIO_PULL_T firmware_gpio_get_pull(void *priv, unsigned gpio)
 {
     struct firmware_inst *inst = priv;
     struct gpio_config config;
-    if (!firmware_get_gpio_config(inst, gpio, &config))
+    int ret;
+
+    pthread_mutex_lock(&inst->lock);
+    ret = firmware_get_gpio_config(inst, gpio, &config);
+    pthread_mutex_unlock(&inst->lock);
+    if (!ret)
     {
         if (!config.term_en)
             return PULL_NONE;
@@ -249,6 +457,7 @@ static void firmware_gpio_set_pull(void *priv, unsigned gpio, GPIO_PULL_T pull)
         return;
     }
 
+    pthread_mutex_lock(&inst->lock);
     if (!firmware_get_gpio_config(inst, gpio, &config))
     {
         if (term_en != config.term_en ||
@@ -259,6 +468,7 @@ static void firmware_gpio_set_pull(void *priv, unsigned gpio, GPIO_PULL_T pull)
             firmware_set_gpio_config(inst, gpio, &config);
         }
     }
+    pthread_mutex_unlock(&inst->lock);
 }
 
 static const char *firmware_gpio_get_name(void *priv, unsigned gpio)
@@ -293,6 +503,9 @@ static void *firmware_gpio_create_instance(const GPIO_CHIP_T *chip,
     UNUSED(dtnode);
     firmware_instance.num_gpios = NUM_GPIOS;
     firmware_instance.mbox_fd = 0;
+    firmware_instance.cache_time = 0;
+    firmware_instance.cache_valid = 0;
+    pthread_mutex_init(&firmware_instance.lock, NULL);
     return &firmware_instance;
 }
 
@@ -317,6 +530,8 @@ static const GPIO_CHIP_INTERFACE_T firmware_gpio_interface =
     .gpio_set_pull = firmware_gpio_set_pull,
     .gpio_get_name = firmware_gpio_get_name,
     .gpio_get_fsel_name = firmware_gpio_get_fsel_name,
+    .gpio_get_levels = firmware_gpio_get_levels,
+    .gpio_set_drives = firmware_gpio_set_drives,
 };
 
 DECLARE_GPIO_CHIP(firmware, "raspberrypi,firmware-gpio", &firmware_gpio_interface,
@@ -30,6 +30,7 @@
 #define RP1_GPIO_CTRL_OEOVER_LSB   14
 #define RP1_GPIO_CTRL_OEOVER_MASK  (0x03 << RP1_GPIO_CTRL_OEOVER_LSB)
 
+#define RP1_PADS_MASK         0xff
 #define RP1_PADS_OD_SET       (1 << 7)
 #define RP1_PADS_IE_SET       (1 << 6)
 #define RP1_PADS_PUE_SET      (1 << 3)
@@ -56,6 +57,21 @@ typedef struct
    uint32_t sys_rio[3];
 } GPIO_STATE_T;
 
+/* The registers of a GPIO, found at probe time to keep the accessors simple */
+struct rp1_pin
+{
+    volatile uint32_t *ctrl;
+    volatile uint32_t *pads;
+    volatile uint32_t *sys_rio;     /* The bank's SYS_RIO registers */
+    uint32_t mask;                  /* The GPIO's bit in the bank */
+};
+
+struct rp1_inst
+{
+    volatile uint32_t *base;
+    struct rp1_pin pins[RP1_NUM_GPIOS];
+};
+
 typedef enum
 {
     RP1_FSEL_ALT0       = 0x0,
@@ -138,135 +154,53 @@ static const char *rp1_gpio_fsel_names[RP1_NUM_GPIOS][RP1_FSEL_COUNT] =
     { "SPI8_CE1"  , "SPI7_CE0"     , 0              , "PCIE_CLKREQ_N", "VBUS_OC3"     , "SYS_RIO219", "PROC_RIO219", },
 };
 
-static void rp1_gpio_get_bank(int num, int *bank, int *offset)
-{
-    *bank = *offset = 0;
-    if (num >= RP1_NUM_GPIOS)
-    {
-        assert(0);
-        return;
-    }
-
-    if (num < rp1_bank_base[1])
-        *bank = 0;
-    else if (num < rp1_bank_base[2])
-        *bank = 1;
-    else
-        *bank = 2;
-
-   *offset = num - rp1_bank_base[*bank];
-}
-
-static uint32_t rp1_gpio_ctrl_read(volatile uint32_t *base, int bank, int offset)
+static struct rp1_pin *rp1_gpio_pin(void *priv, unsigned gpio)
 {
-    return rp1_gpio_read32(base, gpio_state.io[bank], RP1_GPIO_IO_REG_CTRL_OFFSET(offset));
-}
+    struct rp1_inst *inst = priv;
 
-static void rp1_gpio_ctrl_write(volatile uint32_t *base, int bank, int offset,
-                                uint32_t value)
-{
-    rp1_gpio_write32(base, gpio_state.io[bank], RP1_GPIO_IO_REG_CTRL_OFFSET(offset), value);
+    assert(gpio < RP1_NUM_GPIOS);
+    return &inst->pins[gpio];
 }
 
-static uint32_t rp1_gpio_pads_read(volatile uint32_t *base, int bank, int offset)
+/* Each GPIO has its own CTRL and PADS registers, so their read-modify-writes
+ * can't disturb other GPIOs, and the SYS_RIO registers are only written via
+ * the atomic set/clear aliases - no register locks are needed.
+ */
+static void rp1_gpio_sys_rio_write(const struct rp1_pin *pin, uint32_t reg_offset)
 {
-    return rp1_gpio_read32(base, gpio_state.pads[bank], RP1_GPIO_PADS_REG_OFFSET(offset));
-}
-
-static void rp1_gpio_pads_write(volatile uint32_t *base, int bank, int offset,
-                                uint32_t value)
-{
-    rp1_gpio_write32(base, gpio_state.pads[bank], RP1_GPIO_PADS_REG_OFFSET(offset), value);
-}
-
-static uint32_t rp1_gpio_sys_rio_out_read(volatile uint32_t *base, int bank,
-                                          int offset)
-{
-    UNUSED(offset);
-    return rp1_gpio_read32(base, gpio_state.sys_rio[bank], RP1_GPIO_SYS_RIO_REG_OUT_OFFSET);
-}
-
-static uint32_t rp1_gpio_sys_rio_sync_in_read(volatile uint32_t *base, int bank,
-                                              int offset)
-{
-    UNUSED(offset);
-    return rp1_gpio_read32(base, gpio_state.sys_rio[bank],
-                           RP1_GPIO_SYS_RIO_REG_SYNC_IN_OFFSET);
-}
-
-static void rp1_gpio_sys_rio_out_set(volatile uint32_t *base, int bank, int offset)
-{
-    rp1_gpio_write32(base, gpio_state.sys_rio[bank],
-                     RP1_GPIO_SYS_RIO_REG_OUT_OFFSET + RP1_SET_OFFSET, 1U << offset);
-}
-
-static void rp1_gpio_sys_rio_out_clr(volatile uint32_t *base, int bank, int offset)
-{
-    rp1_gpio_write32(base, gpio_state.sys_rio[bank],
-                     RP1_GPIO_SYS_RIO_REG_OUT_OFFSET + RP1_CLR_OFFSET, 1U << offset);
-}
-
-static uint32_t rp1_gpio_sys_rio_oe_read(volatile uint32_t *base, int bank)
-{
-    return rp1_gpio_read32(base, gpio_state.sys_rio[bank],
-                           RP1_GPIO_SYS_RIO_REG_OE_OFFSET);
-}
-
-static void rp1_gpio_sys_rio_oe_clr(volatile uint32_t *base, int bank, int offset)
-{
-    rp1_gpio_write32(base, gpio_state.sys_rio[bank],
-                     RP1_GPIO_SYS_RIO_REG_OE_OFFSET + RP1_CLR_OFFSET,
-                     1U << offset);
-}
-
-static void rp1_gpio_sys_rio_oe_set(volatile uint32_t *base, int bank, int offset)
-{
-    rp1_gpio_write32(base, gpio_state.sys_rio[bank],
-                     RP1_GPIO_SYS_RIO_REG_OE_OFFSET + RP1_SET_OFFSET,
-                     1U << offset);
+    pin->sys_rio[reg_offset / 4] = pin->mask;
+    GPIO_STATS_MMIO(0, 1);
 }
 
 static void rp1_gpio_set_dir(void *priv, uint32_t gpio, GPIO_DIR_T dir)
 {
-    volatile uint32_t *base = priv;
-    int bank, offset;
-
-    rp1_gpio_get_bank(gpio, &bank, &offset);
+    const struct rp1_pin *pin = rp1_gpio_pin(priv, gpio);
 
     if (dir == DIR_INPUT)
-        rp1_gpio_sys_rio_oe_clr(base, bank, offset);
+        rp1_gpio_sys_rio_write(pin, RP1_GPIO_SYS_RIO_REG_OE_OFFSET + RP1_CLR_OFFSET);
     else if (dir == DIR_OUTPUT)
-        rp1_gpio_sys_rio_oe_set(base, bank, offset);
+        rp1_gpio_sys_rio_write(pin, RP1_GPIO_SYS_RIO_REG_OE_OFFSET + RP1_SET_OFFSET);
     else
         assert(0);
 }
 
 static GPIO_DIR_T rp1_gpio_get_dir(void *priv, unsigned gpio)
 {
-    volatile uint32_t *base = priv;
-    int bank, offset;
-    GPIO_DIR_T dir;
-    uint32_t reg;
-
-    rp1_gpio_get_bank(gpio, &bank, &offset);
-    reg = rp1_gpio_sys_rio_oe_read(base, bank);
+    const struct rp1_pin *pin = rp1_gpio_pin(priv, gpio);
+    uint32_t reg = pin->sys_rio[RP1_GPIO_SYS_RIO_REG_OE_OFFSET / 4];
 
-    dir = (reg & (1U << offset)) ? DIR_OUTPUT : DIR_INPUT;
-
-    return dir;
+    GPIO_STATS_MMIO(1, 0);
+    return (reg & pin->mask) ? DIR_OUTPUT : DIR_INPUT;
 }
 
 static GPIO_FSEL_T rp1_gpio_get_fsel(void *priv, unsigned gpio)
 {
-    volatile uint32_t *base = priv;
-    int bank, offset;
-    uint32_t reg;
+    const struct rp1_pin *pin = rp1_gpio_pin(priv, gpio);
     GPIO_FSEL_T fsel;
     RP1_FSEL_T rsel;
 
-    rp1_gpio_get_bank(gpio, &bank, &offset);
-    reg = rp1_gpio_ctrl_read(base, bank, offset);
-    rsel = ((reg & RP1_GPIO_CTRL_FSEL_MASK) >> RP1_GPIO_CTRL_FSEL_LSB);
+    rsel = ((*pin->ctrl & RP1_GPIO_CTRL_FSEL_MASK) >> RP1_GPIO_CTRL_FSEL_LSB);
+    GPIO_STATS_MMIO(1, 0);
     if (rsel == RP1_FSEL_SYS_RIO)
         fsel = GPIO_FSEL_GPIO;
     else if (rsel == RP1_FSEL_NULL)
@@ -281,8 +215,7 @@ static GPIO_FSEL_T rp1_gpio_get_fsel(void *priv, unsigned gpio)
 
 static void rp1_gpio_set_fsel(void *priv, unsigned gpio, const GPIO_FSEL_T func)
 {
-    volatile uint32_t *base = priv;
-    int bank, offset;
+    const struct rp1_pin *pin = rp1_gpio_pin(priv, gpio);
     uint32_t ctrl_reg;
     uint32_t pad_reg;
     uint32_t old_pad_reg;
@@ -299,17 +232,17 @@ static void rp1_gpio_set_fsel(void *priv, unsigned gpio, const GPIO_FSEL_T func)
     else
         return;
 
-    rp1_gpio_get_bank(gpio, &bank, &offset);
     if (func == GPIO_FSEL_INPUT)
         rp1_gpio_set_dir(priv, gpio, DIR_INPUT);
     else if (func == GPIO_FSEL_OUTPUT)
         rp1_gpio_set_dir(priv, gpio, DIR_OUTPUT);
 
-    ctrl_reg = rp1_gpio_ctrl_read(base, bank, offset) & ~RP1_GPIO_CTRL_FSEL_MASK;
+    ctrl_reg = *pin->ctrl & ~RP1_GPIO_CTRL_FSEL_MASK;
     ctrl_reg |= rsel << RP1_GPIO_CTRL_FSEL_LSB;
-    rp1_gpio_ctrl_write(base, bank, offset, ctrl_reg);
+    *pin->ctrl = ctrl_reg;
+    GPIO_STATS_MMIO(1, 1);
 
-    pad_reg = rp1_gpio_pads_read(base, bank, offset);
+    pad_reg = *pin->pads;
     old_pad_reg = pad_reg;
     if (rsel == RP1_FSEL_NULL)
     {
@@ -333,65 +266,147 @@ static void rp1_gpio_set_fsel(void *priv, unsigned gpio, const GPIO_FSEL_T func)
         pad_reg |= RP1_PADS_OD_SET;
     }
 
+    GPIO_STATS_MMIO(1, 0);
     if (pad_reg != old_pad_reg)
-        rp1_gpio_pads_write(base, bank, offset, pad_reg);
+    {
+        *pin->pads = pad_reg;
+        GPIO_STATS_MMIO(0, 1);
+    }
 }
 
 static int rp1_gpio_get_level(void *priv, unsigned gpio)
 {
-    volatile uint32_t *base = priv;
-    int bank, offset;
-    uint32_t pad_reg;
-    uint32_t reg;
-    int level;
+    const struct rp1_pin *pin = rp1_gpio_pin(priv, gpio);
 
-    rp1_gpio_get_bank(gpio, &bank, &offset);
-    pad_reg = rp1_gpio_pads_read(base, bank, offset);
-    if (!(pad_reg & RP1_PADS_IE_SET))
+    GPIO_STATS_MMIO(1, 0);
+    if (!(*pin->pads & RP1_PADS_IE_SET))
 	return -1;
-    reg = rp1_gpio_sys_rio_sync_in_read(base, bank, offset);
-    level = (reg & (1U << offset)) ? 1 : 0;
-
-    return level;
+    GPIO_STATS_MMIO(1, 0);
+    return (pin->sys_rio[RP1_GPIO_SYS_RIO_REG_SYNC_IN_OFFSET / 4] & pin->mask) ? 1 : 0;
 }
 
 static void rp1_gpio_set_drive(void *priv, unsigned gpio, GPIO_DRIVE_T drv)
 {
-    volatile uint32_t *base = priv;
-    int bank, offset;
+    const struct rp1_pin *pin = rp1_gpio_pin(priv, gpio);
 
-    rp1_gpio_get_bank(gpio, &bank, &offset);
     if (drv == DRIVE_HIGH)
-        rp1_gpio_sys_rio_out_set(base, bank, offset);
+        rp1_gpio_sys_rio_write(pin, RP1_GPIO_SYS_RIO_REG_OUT_OFFSET + RP1_SET_OFFSET);
     else if (drv == DRIVE_LOW)
-        rp1_gpio_sys_rio_out_clr(base, bank, offset);
+        rp1_gpio_sys_rio_write(pin, RP1_GPIO_SYS_RIO_REG_OUT_OFFSET + RP1_CLR_OFFSET);
+}
+
+static unsigned rp1_bank_end(int bank)
+{
+    return (bank < 2) ? rp1_bank_base[bank + 1] : RP1_NUM_GPIOS;
+}
+
+static int rp1_gpio_get_levels(void *priv, uint32_t first, uint32_t count,
+                               uint64_t *levels)
+{
+    struct rp1_inst *inst = priv;
+    uint64_t bits = 0;
+    int bank;
+
+    if (first + count > RP1_NUM_GPIOS)
+        return -1;
+
+    /* One sync_in read per bank, assembled into a 54-bit image */
+    for (bank = 0; bank < 3; bank++)
+    {
+        unsigned bank_first = rp1_bank_base[bank];
+        unsigned bank_end = rp1_bank_end(bank);
+        uint32_t reg;
+
+        if (bank_end <= first || bank_first >= first + count)
+            continue;
+        reg = rp1_gpio_read32(inst->base, gpio_state.sys_rio[bank],
+                              RP1_GPIO_SYS_RIO_REG_SYNC_IN_OFFSET);
+        GPIO_STATS_MMIO(1, 0);
+        bits |= (uint64_t)(reg & MASK64(bank_end - bank_first)) << bank_first;
+    }
+
+    *levels = (bits >> first) & MASK64(count);
+    return 0;
+}
+
+static int rp1_gpio_set_drives(void *priv, uint32_t first, uint64_t mask,
+                               GPIO_DRIVE_T drv)
+{
+    struct rp1_inst *inst = priv;
+    uint32_t reg_offset;
+    int bank;
+
+    if (first >= RP1_NUM_GPIOS)
+        return -1;
+
+    if (drv == DRIVE_HIGH)
+        reg_offset = RP1_GPIO_SYS_RIO_REG_OUT_OFFSET + RP1_SET_OFFSET;
+    else if (drv == DRIVE_LOW)
+        reg_offset = RP1_GPIO_SYS_RIO_REG_OUT_OFFSET + RP1_CLR_OFFSET;
+    else
+        return -1;
+
+    /* The atomic set/clear aliases change a whole bank in one write */
+    mask = (mask & MASK64(RP1_NUM_GPIOS - first)) << first;
+    for (bank = 0; bank < 3; bank++)
+    {
+        unsigned bank_first = rp1_bank_base[bank];
+        uint32_t bits = (mask >> bank_first) & MASK64(rp1_bank_end(bank) - bank_first);
+
+        if (bits)
+        {
+            rp1_gpio_write32(inst->base, gpio_state.sys_rio[bank], reg_offset, bits);
+            GPIO_STATS_MMIO(0, 1);
+        }
+    }
+
+    return 0;
+}
+
+static int rp1_gpio_get_regs(void *priv, GPIO_CHIP_REGS_T *regs)
+{
+    struct rp1_inst *inst = priv;
+    int bank;
+
+    if (!inst->base)
+        return -1;
+
+    regs->type = GPIO_REGS_RP1;
+    regs->num_banks = 3;
+    for (bank = 0; bank < 3; bank++)
+    {
+        regs->set[bank] = &rp1_gpio_read32(inst->base, gpio_state.sys_rio[bank],
+                                           RP1_GPIO_SYS_RIO_REG_OUT_OFFSET + RP1_SET_OFFSET);
+        regs->clr[bank] = &rp1_gpio_read32(inst->base, gpio_state.sys_rio[bank],
+                                           RP1_GPIO_SYS_RIO_REG_OUT_OFFSET + RP1_CLR_OFFSET);
+        regs->lev[bank] = &rp1_gpio_read32(inst->base, gpio_state.sys_rio[bank],
+                                           RP1_GPIO_SYS_RIO_REG_SYNC_IN_OFFSET);
+    }
+    return 0;
 }
 
 static void rp1_gpio_set_pull(void *priv, unsigned gpio, GPIO_PULL_T pull)
 {
-    volatile uint32_t *base = priv;
+    const struct rp1_pin *pin = rp1_gpio_pin(priv, gpio);
     uint32_t reg;
-    int bank, offset;
 
-    rp1_gpio_get_bank(gpio, &bank, &offset);
-    reg = rp1_gpio_pads_read(base, bank, offset);
+    reg = *pin->pads;
     reg &= ~(RP1_PADS_PDE_SET | RP1_PADS_PUE_SET);
     if (pull == PULL_UP)
         reg |= RP1_PADS_PUE_SET;
     else if (pull == PULL_DOWN)
         reg |= RP1_PADS_PDE_SET;
-    rp1_gpio_pads_write(base, bank, offset, reg);
+    *pin->pads = reg;
+    GPIO_STATS_MMIO(1, 1);
 }
 
 static GPIO_PULL_T rp1_gpio_get_pull(void *priv, unsigned gpio)
 {
-    volatile uint32_t *base = priv;
-    uint32_t reg;
+    const struct rp1_pin *pin = rp1_gpio_pin(priv, gpio);
+    uint32_t reg = *pin->pads;
     GPIO_PULL_T pull = PULL_NONE;
-    int bank, offset;
 
-    rp1_gpio_get_bank(gpio, &bank, &offset);
-    reg = rp1_gpio_pads_read(base, bank, offset);
+    GPIO_STATS_MMIO(1, 0);
     if (reg & RP1_PADS_PUE_SET)
         pull = PULL_UP;
     else if (reg & RP1_PADS_PDE_SET)
@@ -400,15 +415,30 @@ static GPIO_PULL_T rp1_gpio_get_pull(void *priv, unsigned gpio)
     return pull;
 }
 
+static int rp1_gpio_get_pad(void *priv, unsigned gpio, uint32_t *pad)
+{
+    const struct rp1_pin *pin = rp1_gpio_pin(priv, gpio);
+
+    *pad = *pin->pads & RP1_PADS_MASK;
+    GPIO_STATS_MMIO(1, 0);
+    return 0;
+}
+
+static void rp1_gpio_set_pad(void *priv, unsigned gpio, uint32_t pad)
+{
+    const struct rp1_pin *pin = rp1_gpio_pin(priv, gpio);
+
+    *pin->pads = (*pin->pads & ~RP1_PADS_MASK) | (pad & RP1_PADS_MASK);
+    GPIO_STATS_MMIO(1, 1);
+}
+
 static GPIO_DRIVE_T rp1_gpio_get_drive(void *priv, unsigned gpio)
 {
-    volatile uint32_t *base = priv;
-    uint32_t reg;
-    int bank, offset;
+    const struct rp1_pin *pin = rp1_gpio_pin(priv, gpio);
+    uint32_t reg = pin->sys_rio[RP1_GPIO_SYS_RIO_REG_OUT_OFFSET / 4];
 
-    rp1_gpio_get_bank(gpio, &bank, &offset);
-    reg = rp1_gpio_sys_rio_out_read(base, bank, offset);
-    return (reg & (1U << offset)) ? DRIVE_HIGH : DRIVE_LOW;
+    GPIO_STATS_MMIO(1, 0);
+    return (reg & pin->mask) ? DRIVE_HIGH : DRIVE_LOW;
 }
 
 static const char *rp1_gpio_get_name(void *priv, unsigned gpio)
@@ -478,8 +508,35 @@ static int rp1_gpio_count(void *priv)
 
 static void *rp1_gpio_probe_instance(void *priv, volatile uint32_t *base)
 {
+    struct rp1_inst *inst;
+    unsigned gpio;
+    int bank = 0;
+
     UNUSED(priv);
-    return (void *)base;
+
+    inst = calloc(1, sizeof(*inst));
+    if (!inst)
+        return NULL;
+
+    inst->base = base;
+    for (gpio = 0; gpio < RP1_NUM_GPIOS; gpio++)
+    {
+        struct rp1_pin *pin = &inst->pins[gpio];
+        unsigned offset;
+
+        if (gpio == rp1_bank_end(bank))
+            bank++;
+        offset = gpio - rp1_bank_base[bank];
+
+        pin->ctrl = &rp1_gpio_read32(base, gpio_state.io[bank],
+                                     RP1_GPIO_IO_REG_CTRL_OFFSET(offset));
+        pin->pads = &rp1_gpio_read32(base, gpio_state.pads[bank],
+                                     RP1_GPIO_PADS_REG_OFFSET(offset));
+        pin->sys_rio = &rp1_gpio_read32(base, gpio_state.sys_rio[bank], 0);
+        pin->mask = 1U << offset;
+    }
+
+    return inst;
 }
 
 static const GPIO_CHIP_INTERFACE_T rp1_gpio_interface =
@@ -498,6 +555,11 @@ static const GPIO_CHIP_INTERFACE_T rp1_gpio_interface =
     .gpio_set_pull = rp1_gpio_set_pull,
     .gpio_get_name = rp1_gpio_get_name,
     .gpio_get_fsel_name = rp1_gpio_get_fsel_name,
+    .gpio_get_levels = rp1_gpio_get_levels,
+    .gpio_set_drives = rp1_gpio_set_drives,
+    .gpio_get_pad = rp1_gpio_get_pad,
+    .gpio_set_pad = rp1_gpio_set_pad,
+    .gpio_get_regs = rp1_gpio_get_regs,
 };
 
 DECLARE_GPIO_CHIP(rp1, "raspberrypi,rp1-gpio",
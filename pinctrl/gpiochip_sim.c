@@ -0,0 +1,482 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gpiochip.h"
+#include "util.h"
+
+/*
+ * A simulated GPIO chip, for running gpiolib and pinctrl without hardware.
+ *
+ * A DT node with compatible "raspberrypi,gpiochip-sim" names the chip to be
+ * emulated in its "raspberrypi,sim-compatible" property. That chip's driver
+ * is then run against an anonymous mapping instead of the real registers,
+ * and after each change the register side effects that plain memory lacks
+ * (set/clear aliases, level registers) are applied. Undriven inputs read as
+ * the level of the last pull selected.
+ *
+ * An optional "raspberrypi,sim-file" property names a file to hold the
+ * registers instead, so that the state persists between processes.
+ */
+
+#define SIM_MAX_INSTANCES  4
+#define SIM_MAX_GPIOS      128
+
+#define SIM_DEFAULT_COMPATIBLE "brcm,bcm2711-gpio"
+
+/* bcm2835 register offsets, in words */
+#define SIM_BCM2835_GPFSEL0    0
+#define SIM_BCM2835_GPSET0     7
+#define SIM_BCM2835_GPCLR0     10
+#define SIM_BCM2835_GPLEV0     13
+
+/* brcmstb GIO bank registers, in words */
+#define SIM_GIO_BANK_STRIDE    8
+#define SIM_GIO_DATA           1
+#define SIM_GIO_IODIR          2
+
+/* RP1 blocks, and the atomic aliases within each of them */
+#define SIM_RP1_IO_BANK0       0x00000
+#define SIM_RP1_SYS_RIO_BANK0  0x10000
+#define SIM_RP1_PADS_BANK0     0x20000
+#define SIM_RP1_BANK_STRIDE    0x4000
+#define SIM_RP1_XOR_OFFSET     0x1000
+#define SIM_RP1_SET_OFFSET     0x2000
+#define SIM_RP1_CLR_OFFSET     0x3000
+#define SIM_RP1_FOLD_WORDS     64     /* Enough for the largest bank */
+#define SIM_RP1_CTRL_FSEL_NULL 0x1f
+#define SIM_RP1_PADS_IE_PDE    0x44
+
+typedef struct SIM_INST_ SIM_INST_T;
+
+typedef struct
+{
+    const char *name;
+    void (*reset)(SIM_INST_T *sim);
+    void (*sync)(SIM_INST_T *sim);
+} SIM_LAYOUT_T;
+
+struct SIM_INST_
+{
+    const GPIO_CHIP_T *target;
+    const GPIO_CHIP_INTERFACE_T *iface;
+    const SIM_LAYOUT_T *layout;
+    void *priv;                     /* The emulated chip's private data */
+    volatile uint32_t *base;
+    unsigned num_gpios;
+    uint32_t latch[2];              /* bcm2835 output latches */
+    uint8_t input_level[SIM_MAX_GPIOS];
+    pthread_mutex_t lock;           /* Plain memory has no atomic aliases */
+};
+
+static SIM_INST_T sim_instances[SIM_MAX_INSTANCES];
+static unsigned num_sim_instances;
+
+static const unsigned sim_rp1_bank_base[] = { 0, 28, 34, 54 };
+
+static uint32_t sim_input_bits(const SIM_INST_T *sim, unsigned first,
+                               unsigned count)
+{
+    uint32_t bits = 0;
+    unsigned i;
+
+    for (i = 0; i < count && first + i < SIM_MAX_GPIOS; i++)
+        bits |= (uint32_t)sim->input_level[first + i] << i;
+    return bits;
+}
+
+static void sim_bcm2835_sync(SIM_INST_T *sim)
+{
+    volatile uint32_t *base = sim->base;
+    uint32_t out[2] = { 0, 0 };
+    unsigned gpio, bank;
+
+    for (gpio = 0; gpio < sim->num_gpios; gpio++)
+    {
+        uint32_t fsel = base[SIM_BCM2835_GPFSEL0 + gpio / 10] >> ((gpio % 10) * 3);
+        if ((fsel & 7) == 1)
+            out[gpio / 32] |= 1U << (gpio % 32);
+    }
+
+    for (bank = 0; bank < 2; bank++)
+    {
+        sim->latch[bank] |= base[SIM_BCM2835_GPSET0 + bank];
+        sim->latch[bank] &= ~base[SIM_BCM2835_GPCLR0 + bank];
+        base[SIM_BCM2835_GPSET0 + bank] = 0;
+        base[SIM_BCM2835_GPCLR0 + bank] = 0;
+        base[SIM_BCM2835_GPLEV0 + bank] = (sim->latch[bank] & out[bank]) |
+            (sim_input_bits(sim, bank * 32, 32) & ~out[bank]);
+    }
+}
+
+static void sim_gio_reset(SIM_INST_T *sim)
+{
+    unsigned bank;
+
+    // All inputs
+    for (bank = 0; bank * 32 < sim->num_gpios; bank++)
+        sim->base[bank * SIM_GIO_BANK_STRIDE + SIM_GIO_IODIR] = ~0U;
+}
+
+static void sim_gio_sync(SIM_INST_T *sim)
+{
+    unsigned bank;
+
+    for (bank = 0; bank * 32 < sim->num_gpios; bank++)
+    {
+        volatile uint32_t *regs = sim->base + bank * SIM_GIO_BANK_STRIDE;
+        uint32_t in = regs[SIM_GIO_IODIR];
+
+        regs[SIM_GIO_DATA] = (regs[SIM_GIO_DATA] & ~in) |
+            (sim_input_bits(sim, bank * 32, 32) & in);
+    }
+}
+
+static void sim_rp1_reset(SIM_INST_T *sim)
+{
+    unsigned bank, gpio;
+
+    for (bank = 0; bank < 3; bank++)
+    {
+        volatile uint32_t *io = sim->base + (SIM_RP1_IO_BANK0 + bank * SIM_RP1_BANK_STRIDE) / 4;
+        volatile uint32_t *pads = sim->base + (SIM_RP1_PADS_BANK0 + bank * SIM_RP1_BANK_STRIDE) / 4;
+
+        for (gpio = 0; gpio < sim_rp1_bank_base[bank + 1] - sim_rp1_bank_base[bank]; gpio++)
+        {
+            io[gpio * 2 + 1] = SIM_RP1_CTRL_FSEL_NULL;
+            pads[gpio + 1] = SIM_RP1_PADS_IE_PDE;
+        }
+    }
+}
+
+static void sim_rp1_fold(volatile uint32_t *block)
+{
+    volatile uint32_t *xor_alias = block + SIM_RP1_XOR_OFFSET / 4;
+    volatile uint32_t *set_alias = block + SIM_RP1_SET_OFFSET / 4;
+    volatile uint32_t *clr_alias = block + SIM_RP1_CLR_OFFSET / 4;
+    unsigned i;
+
+    for (i = 0; i < SIM_RP1_FOLD_WORDS; i++)
+    {
+        if (xor_alias[i] | set_alias[i] | clr_alias[i])
+        {
+            block[i] = ((block[i] ^ xor_alias[i]) | set_alias[i]) & ~clr_alias[i];
+            xor_alias[i] = set_alias[i] = clr_alias[i] = 0;
+        }
+    }
+}
+
+static void sim_rp1_sync(SIM_INST_T *sim)
+{
+    unsigned bank;
+
+    for (bank = 0; bank < 3; bank++)
+    {
+        unsigned first = sim_rp1_bank_base[bank];
+        unsigned count = sim_rp1_bank_base[bank + 1] - first;
+        volatile uint32_t *rio;
+        uint32_t oe;
+
+        sim_rp1_fold(sim->base + (SIM_RP1_IO_BANK0 + bank * SIM_RP1_BANK_STRIDE) / 4);
+        sim_rp1_fold(sim->base + (SIM_RP1_PADS_BANK0 + bank * SIM_RP1_BANK_STRIDE) / 4);
+
+        rio = sim->base + (SIM_RP1_SYS_RIO_BANK0 + bank * SIM_RP1_BANK_STRIDE) / 4;
+        sim_rp1_fold(rio);
+        oe = rio[1];
+        rio[2] = ((rio[0] & oe) | (sim_input_bits(sim, first, count) & ~oe)) &
+                 (uint32_t)MASK64(count);
+    }
+}
+
+static const SIM_LAYOUT_T sim_layouts[] =
+{
+    { "bcm2835", NULL, sim_bcm2835_sync },
+    { "bcm2711", NULL, sim_bcm2835_sync },
+    { "brcmstb", sim_gio_reset, sim_gio_sync },
+    { "rp1", sim_rp1_reset, sim_rp1_sync },
+};
+
+static void sim_sync(SIM_INST_T *sim)
+{
+    if (sim->layout && sim->layout->sync)
+        sim->layout->sync(sim);
+}
+
+// Returns the register block, setting *restored if it has existing content
+static void *sim_map(const char *dtnode, size_t size, int *restored)
+{
+    struct stat st;
+    char *file = NULL;
+    void *map;
+    int fd;
+
+    *restored = 0;
+    if (dtnode)
+        file = dt_read_prop(dtnode, "raspberrypi,sim-file", NULL);
+    if (!file)
+        return mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    fd = open(file, O_RDWR | O_CREAT, 0666);
+    dt_free(file);
+    if (fd < 0)
+        return MAP_FAILED;
+
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= size)
+        *restored = 1;
+    else if (ftruncate(fd, size) != 0)
+    {
+        close(fd);
+        return MAP_FAILED;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return map;
+}
+
+static void *sim_gpio_create_instance(const GPIO_CHIP_T *chip,
+                                      const char *dtnode)
+{
+    const GPIO_CHIP_T *target;
+    SIM_INST_T *sim;
+    char *compatible = NULL;
+    void *map;
+    unsigned i;
+    int count, restored;
+
+    if (dtnode)
+        compatible = dt_read_prop(dtnode, "raspberrypi,sim-compatible", NULL);
+    target = gpio_find_chip(compatible ? compatible : SIM_DEFAULT_COMPATIBLE);
+    dt_free(compatible);
+
+    // Only memory-mapped chips can be emulated
+    if (!target || target == chip || !target->size ||
+        !target->interface->gpio_probe_instance)
+        return NULL;
+
+    if (num_sim_instances == SIM_MAX_INSTANCES)
+        return NULL;
+    sim = &sim_instances[num_sim_instances];
+    memset(sim, 0, sizeof(*sim));
+
+    sim->target = target;
+    sim->iface = target->interface;
+    sim->priv = sim->iface->gpio_create_instance(target, dtnode);
+    if (!sim->priv)
+        return NULL;
+
+    map = sim_map(dtnode, target->size, &restored);
+    if (map == MAP_FAILED)
+        return NULL;
+    sim->base = map;
+
+    sim->priv = sim->iface->gpio_probe_instance(sim->priv, sim->base);
+    if (!sim->priv)
+    {
+        munmap(map, target->size);
+        return NULL;
+    }
+
+    count = sim->iface->gpio_count(sim->priv);
+    sim->num_gpios = (count > 0) ? (unsigned)count : 0;
+    if (sim->num_gpios > SIM_MAX_GPIOS)
+        sim->num_gpios = SIM_MAX_GPIOS;
+
+    for (i = 0; i < ARRAY_SIZE(sim_layouts); i++)
+    {
+        if (strcmp(target->name, sim_layouts[i].name) == 0)
+        {
+            sim->layout = &sim_layouts[i];
+            break;
+        }
+    }
+
+    if (!restored)
+    {
+        if (sim->layout && sim->layout->reset)
+            sim->layout->reset(sim);
+    }
+    else
+    {
+        // Recover the state that isn't held in the registers
+        for (i = 0; i < sim->num_gpios; i++)
+            sim->input_level[i] = (sim->iface->gpio_get_pull(sim->priv, i) == PULL_UP);
+        if (sim->layout && sim->layout->sync == sim_bcm2835_sync)
+        {
+            sim->latch[0] = sim->base[SIM_BCM2835_GPLEV0];
+            sim->latch[1] = sim->base[SIM_BCM2835_GPLEV0 + 1];
+        }
+    }
+    sim_sync(sim);
+
+    pthread_mutex_init(&sim->lock, NULL);
+    num_sim_instances++;
+
+    return sim;
+}
+
+static int sim_gpio_count(void *priv)
+{
+    SIM_INST_T *sim = priv;
+    return sim->iface->gpio_count(sim->priv);
+}
+
+static GPIO_FSEL_T sim_gpio_get_fsel(void *priv, uint32_t gpio)
+{
+    SIM_INST_T *sim = priv;
+    return sim->iface->gpio_get_fsel(sim->priv, gpio);
+}
+
+static void sim_gpio_set_fsel(void *priv, uint32_t gpio, const GPIO_FSEL_T func)
+{
+    SIM_INST_T *sim = priv;
+
+    pthread_mutex_lock(&sim->lock);
+    sim->iface->gpio_set_fsel(sim->priv, gpio, func);
+    sim_sync(sim);
+    pthread_mutex_unlock(&sim->lock);
+}
+
+static void sim_gpio_set_drive(void *priv, uint32_t gpio, GPIO_DRIVE_T drv)
+{
+    SIM_INST_T *sim = priv;
+
+    pthread_mutex_lock(&sim->lock);
+    sim->iface->gpio_set_drive(sim->priv, gpio, drv);
+    sim_sync(sim);
+    pthread_mutex_unlock(&sim->lock);
+}
+
+static void sim_gpio_set_dir(void *priv, uint32_t gpio, GPIO_DIR_T dir)
+{
+    SIM_INST_T *sim = priv;
+
+    pthread_mutex_lock(&sim->lock);
+    sim->iface->gpio_set_dir(sim->priv, gpio, dir);
+    sim_sync(sim);
+    pthread_mutex_unlock(&sim->lock);
+}
+
+static GPIO_DIR_T sim_gpio_get_dir(void *priv, uint32_t gpio)
+{
+    SIM_INST_T *sim = priv;
+    return sim->iface->gpio_get_dir(sim->priv, gpio);
+}
+
+static int sim_gpio_get_level(void *priv, uint32_t gpio)
+{
+    SIM_INST_T *sim = priv;
+    return sim->iface->gpio_get_level(sim->priv, gpio);
+}
+
+static GPIO_DRIVE_T sim_gpio_get_drive(void *priv, uint32_t gpio)
+{
+    SIM_INST_T *sim = priv;
+    return sim->iface->gpio_get_drive(sim->priv, gpio);
+}
+
+static GPIO_PULL_T sim_gpio_get_pull(void *priv, uint32_t gpio)
+{
+    SIM_INST_T *sim = priv;
+    return sim->iface->gpio_get_pull(sim->priv, gpio);
+}
+
+static void sim_gpio_set_pull(void *priv, uint32_t gpio, GPIO_PULL_T pull)
+{
+    SIM_INST_T *sim = priv;
+
+    pthread_mutex_lock(&sim->lock);
+    sim->iface->gpio_set_pull(sim->priv, gpio, pull);
+    if (gpio < SIM_MAX_GPIOS && (pull == PULL_UP || pull == PULL_DOWN))
+        sim->input_level[gpio] = (pull == PULL_UP);
+    sim_sync(sim);
+    pthread_mutex_unlock(&sim->lock);
+}
+
+static const char *sim_gpio_get_name(void *priv, uint32_t gpio)
+{
+    SIM_INST_T *sim = priv;
+    return sim->iface->gpio_get_name(sim->priv, gpio);
+}
+
+static const char *sim_gpio_get_fsel_name(void *priv, uint32_t gpio, GPIO_FSEL_T fsel)
+{
+    SIM_INST_T *sim = priv;
+    return sim->iface->gpio_get_fsel_name(sim->priv, gpio, fsel);
+}
+
+static int sim_gpio_get_levels(void *priv, uint32_t first, uint32_t count,
+                               uint64_t *levels)
+{
+    SIM_INST_T *sim = priv;
+
+    if (!sim->iface->gpio_get_levels)
+        return -1;
+    return sim->iface->gpio_get_levels(sim->priv, first, count, levels);
+}
+
+static int sim_gpio_set_drives(void *priv, uint32_t first, uint64_t mask,
+                               GPIO_DRIVE_T drv)
+{
+    SIM_INST_T *sim = priv;
+    int ret;
+
+    if (!sim->iface->gpio_set_drives)
+        return -1;
+    pthread_mutex_lock(&sim->lock);
+    ret = sim->iface->gpio_set_drives(sim->priv, first, mask, drv);
+    sim_sync(sim);
+    pthread_mutex_unlock(&sim->lock);
+    return ret;
+}
+
+static int sim_gpio_get_pad(void *priv, uint32_t gpio, uint32_t *pad)
+{
+    SIM_INST_T *sim = priv;
+
+    if (!sim->iface->gpio_get_pad)
+        return -1;
+    return sim->iface->gpio_get_pad(sim->priv, gpio, pad);
+}
+
+static void sim_gpio_set_pad(void *priv, uint32_t gpio, uint32_t pad)
+{
+    SIM_INST_T *sim = priv;
+
+    if (!sim->iface->gpio_set_pad)
+        return;
+    pthread_mutex_lock(&sim->lock);
+    sim->iface->gpio_set_pad(sim->priv, gpio, pad);
+    sim_sync(sim);
+    pthread_mutex_unlock(&sim->lock);
+}
+
+static const GPIO_CHIP_INTERFACE_T sim_gpio_interface =
+{
+    .gpio_create_instance = sim_gpio_create_instance,
+    .gpio_count = sim_gpio_count,
+    .gpio_get_fsel = sim_gpio_get_fsel,
+    .gpio_set_fsel = sim_gpio_set_fsel,
+    .gpio_set_drive = sim_gpio_set_drive,
+    .gpio_set_dir = sim_gpio_set_dir,
+    .gpio_get_dir = sim_gpio_get_dir,
+    .gpio_get_level = sim_gpio_get_level,
+    .gpio_get_drive = sim_gpio_get_drive,
+    .gpio_get_pull = sim_gpio_get_pull,
+    .gpio_set_pull = sim_gpio_set_pull,
+    .gpio_get_name = sim_gpio_get_name,
+    .gpio_get_fsel_name = sim_gpio_get_fsel_name,
+    .gpio_get_levels = sim_gpio_get_levels,
+    .gpio_set_drives = sim_gpio_set_drives,
+    .gpio_get_pad = sim_gpio_get_pad,
+    .gpio_set_pad = sim_gpio_set_pad,
+};
+
+/* No registers of its own - the emulated chip is mapped at creation */
+DECLARE_GPIO_CHIP(sim, "raspberrypi,gpiochip-sim", &sim_gpio_interface, 0, 0);
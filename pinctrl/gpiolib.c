@@ -1,25 +1,46 @@
+#define _GNU_SOURCE
 #define _FILE_OFFSET_BITS 64
 #include <assert.h>
+#include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
 #include <inttypes.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
+#include <linux/gpio.h>
 
 #include "gpiochip.h"
 #include "util.h"
 
 #define MAX_GPIO_CHIPS 8
+#define MAX_CHARDEVS 4      // Per GPIO chip instance, e.g. one per bank
+#define MAX_EDGE_REQUESTS 16
+#define MAX_DT_DEPTH 32
+#define NAME_HASH_SIZE 1024 // A power of two, comfortably > 2 * MAX_GPIO_PINS
+#define MAX_FUNC_LINKS (MAX_GPIO_PINS * (GPIO_FSEL_FUNC8 + 1))
+#define FUNC_HASH_SIZE 4096 // A power of two, > MAX_FUNC_LINKS
+#define NUM_REG_LOCKS 64    // A power of two
+
+#define CACHE_MAGIC "GPIOLIBC"
+#define CACHE_VERSION 2     // Bump if gpiolib_init reads different properties
 
 typedef struct GPIO_CHIP_INSTANCE_
 {
     const GPIO_CHIP_T *chip;
     const char *name;
     const char *dtnode;
+    char gpiomem_idx[4];
     int mem_fd;
     void *priv;
     uint64_t phys_addr;
@@ -27,8 +48,90 @@ typedef struct GPIO_CHIP_INSTANCE_
     uint32_t base;
 } GPIO_CHIP_INSTANCE_T;
 
+// The discovery cache file starts with this header, followed by the
+// gpiomem index and DT node of each chip (as pairs of strings) and then a
+// record of the DT properties read during discovery.
+typedef struct GPIOLIB_CACHE_HEADER_
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_chips;
+    uint64_t overlays_hash;
+    char boot_id[40];
+    uint32_t chips_len;
+    uint32_t record_len;
+} GPIOLIB_CACHE_HEADER_T;
+
+// Per-GPIO dispatch entry, saving a search of the chip list on every access
+typedef struct GPIO_DISPATCH_
+{
+    const GPIO_CHIP_INTERFACE_T *iface;
+    void *priv;
+    unsigned offset;
+} GPIO_DISPATCH_T;
+
+// The hardware state is process-wide, so all handles share one context
+struct GPIOLIB_CTX_
+{
+    unsigned refs;
+    int status;             // 0 before initialisation, then num_gpios or -1
+};
+
+#if GPIOLIB_STATS
+// Times a call into a chip driver, and collects the accesses it reports
+typedef struct GPIO_STATS_SCOPE_
+{
+    GPIO_OP_STATS_T *stats;
+    GPIO_OP_STATS_T *prev;
+    uint64_t start_ns;
+} GPIO_STATS_SCOPE_T;
+
+// Runs stmt, a call into the driver behind priv, attributing it to op
+#define GPIO_STATS_CALL(priv, op, stmt) \
+    do { \
+        GPIO_STATS_SCOPE_T stats_scope_; \
+        gpio_stats_begin(&stats_scope_, priv, op); \
+        stmt; \
+        gpio_stats_end(&stats_scope_); \
+    } while (0)
+#else
+#define GPIO_STATS_CALL(priv, op, stmt) do { stmt; } while (0)
+#endif
+
+// Each GPIO name contributes one entry per '/'-separated component
+typedef struct GPIO_NAME_ENTRY_
+{
+    const char *name;
+    unsigned len;
+    unsigned gpio;
+} GPIO_NAME_ENTRY_T;
+
+// Each alternate function name has one entry, heading a list of the
+// GPIOs (in GPIO order) that provide it
+typedef struct GPIO_FUNC_ENTRY_
+{
+    const char *name;
+    unsigned head;          // Index into gpio_func_links
+    unsigned tail;
+} GPIO_FUNC_ENTRY_T;
+
+typedef struct GPIO_FUNC_LINK_
+{
+    uint16_t gpio;
+    uint8_t fsel;
+    uint16_t entry;         // Index into gpio_func_hash
+    uint16_t next;          // Index into gpio_func_links, or 0xffff
+} GPIO_FUNC_LINK_T;
+
 static unsigned num_gpio_chips;
 static GPIO_CHIP_INSTANCE_T gpio_chips[MAX_GPIO_CHIPS];
+static GPIO_DISPATCH_T gpio_dispatch[MAX_GPIO_PINS];
+static GPIO_NAME_ENTRY_T gpio_name_hash[NAME_HASH_SIZE];
+static unsigned num_name_entries;
+static GPIO_FUNC_ENTRY_T gpio_func_hash[FUNC_HASH_SIZE];
+static GPIO_FUNC_LINK_T gpio_func_links[MAX_FUNC_LINKS];
+static unsigned num_func_links;
+static int gpio_pins[MAX_GPIO_PINS];
 
 static unsigned num_gpios;
 static unsigned first_hdr_pin = GPIO_INVALID;
@@ -36,6 +139,18 @@ static unsigned last_hdr_pin = GPIO_INVALID;
 static const char *gpio_names[MAX_GPIO_PINS];
 static unsigned hdr_gpios[NUM_HDR_PINS + 1];
 
+static GPIOLIB_CTX_T gpiolib_ctx;
+static pthread_mutex_t gpiolib_ctx_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t gpio_reg_locks[NUM_REG_LOCKS] =
+{
+    [0 ... NUM_REG_LOCKS - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+
+#if GPIOLIB_STATS
+static GPIO_OP_STATS_T gpio_stats[MAX_GPIO_CHIPS][GPIO_OP_MAX];
+static __thread GPIO_OP_STATS_T *gpio_stats_current;
+#endif
+
 const char *pull_names[] = { "pn", "pd", "pu", "--" };
 const char *drive_names[] = { "dl", "dh", "--" };
 const char *fsel_names[] =
@@ -44,23 +159,40 @@ const char *fsel_names[] =
     "a8", "??", "??", "??", "??", "??", "??", "??",
     "ip", "op", "gp", "no"
 };
+const char *op_names[] =
+{
+    "get_fsel", "set_fsel", "get_dir", "set_dir", "get_level", "get_drive",
+    "set_drive", "get_pull", "set_pull", "get_levels", "set_drives",
+    "get_pad", "set_pad"
+};
 
 void (*verbose_callback)(const char *);
 
+static const char *gpiolib_dt_path;  // NULL for the live device tree
+static const char *gpiolib_cache_path;
+
+static int gpio_chip_is_known(const char *dtnode)
+{
+    unsigned i;
+
+    for (i = 0; i < num_gpio_chips; i++)
+    {
+        if (!strcmp(gpio_chips[i].dtnode, dtnode))
+            return 1;
+    }
+    return 0;
+}
+
 static GPIO_CHIP_INSTANCE_T *gpio_create_instance(const GPIO_CHIP_T *chip,
                                                   uint64_t phys_addr,
                                                   const char *name,
                                                   const char *dtnode)
 {
     GPIO_CHIP_INSTANCE_T *inst;
-    unsigned i;
 
     // Skip it if already discovered
-    for (i = 0; i < num_gpio_chips; i++)
-    {
-        if (!strcmp(gpio_chips[i].dtnode, dtnode))
-            return NULL;
-    }
+    if (gpio_chip_is_known(dtnode))
+        return NULL;
 
     if (num_gpio_chips >= MAX_GPIO_CHIPS)
     {
@@ -86,26 +218,282 @@ static GPIO_CHIP_INSTANCE_T *gpio_create_instance(const GPIO_CHIP_T *chip,
     return inst;
 }
 
+static pthread_mutex_t *gpio_reg_lock_for(const volatile uint32_t *reg)
+{
+    return &gpio_reg_locks[((uintptr_t)reg / sizeof(*reg)) & (NUM_REG_LOCKS - 1)];
+}
+
+void gpio_reg_lock(const volatile uint32_t *reg)
+{
+    pthread_mutex_lock(gpio_reg_lock_for(reg));
+}
+
+void gpio_reg_unlock(const volatile uint32_t *reg)
+{
+    pthread_mutex_unlock(gpio_reg_lock_for(reg));
+}
+
+#if GPIOLIB_STATS
+
+static void gpio_stats_add(uint64_t *counter, uint64_t n)
+{
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static void gpio_stats_begin(GPIO_STATS_SCOPE_T *scope, void *priv, GPIO_OP_T op)
+{
+    unsigned i;
+
+    // The chip list is short, and this is only built in when measuring
+    scope->stats = NULL;
+    for (i = 0; i < num_gpio_chips; i++)
+    {
+        if (gpio_chips[i].priv == priv)
+        {
+            scope->stats = &gpio_stats[i][op];
+            break;
+        }
+    }
+    scope->prev = gpio_stats_current;
+    gpio_stats_current = scope->stats;
+    scope->start_ns = get_time_ns(CLOCK_MONOTONIC);
+}
+
+static void gpio_stats_end(GPIO_STATS_SCOPE_T *scope)
+{
+    GPIO_OP_STATS_T *stats = scope->stats;
+    uint64_t ns = get_time_ns(CLOCK_MONOTONIC) - scope->start_ns;
+    uint64_t max;
+    unsigned bucket;
+
+    gpio_stats_current = scope->prev;
+    if (!stats)
+        return;
+
+    for (bucket = 0; bucket < GPIO_STATS_BUCKETS - 1; bucket++)
+    {
+        if (ns < GPIO_STATS_BUCKET_NS(bucket))
+            break;
+    }
+    gpio_stats_add(&stats->calls, 1);
+    gpio_stats_add(&stats->total_ns, ns);
+    gpio_stats_add(&stats->histogram[bucket], 1);
+    max = __atomic_load_n(&stats->max_ns, __ATOMIC_RELAXED);
+    while (ns > max &&
+           !__atomic_compare_exchange_n(&stats->max_ns, &max, ns, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        continue;
+}
+
+void gpio_stats_mmio(unsigned reads, unsigned writes)
+{
+    GPIO_OP_STATS_T *stats = gpio_stats_current;
+
+    if (!stats)
+        return;
+    if (reads)
+        gpio_stats_add(&stats->mmio_reads, reads);
+    if (writes)
+        gpio_stats_add(&stats->mmio_writes, writes);
+}
+
+void gpio_stats_mbox(uint64_t start_ns)
+{
+    GPIO_OP_STATS_T *stats = gpio_stats_current;
+
+    if (!stats)
+        return;
+    gpio_stats_add(&stats->mbox_calls, 1);
+    gpio_stats_add(&stats->mbox_ns, get_time_ns(CLOCK_MONOTONIC) - start_ns);
+}
+
+#endif
+
 static int gpio_get_interface(unsigned gpio,
                               const GPIO_CHIP_INTERFACE_T **iface_ptr,
                               void **priv, unsigned *offset)
 {
-    unsigned i;
+    const GPIO_DISPATCH_T *entry;
 
     *iface_ptr = NULL;
+    if (gpio >= MAX_GPIO_PINS)
+        return -1;
+
+    entry = &gpio_dispatch[gpio];
+    if (!entry->iface)
+        return -1;
+
+    *iface_ptr = entry->iface;
+    *priv = entry->priv;
+    *offset = entry->offset;
+    return 0;
+}
+
+static void gpio_build_dispatch(void)
+{
+    unsigned i, gpio;
+
+    memset(gpio_dispatch, 0, sizeof(gpio_dispatch));
     for (i = 0; i < num_gpio_chips; i++)
     {
         GPIO_CHIP_INSTANCE_T *inst = &gpio_chips[i];
-        const GPIO_CHIP_T *chip = inst->chip;
-        if (gpio >= inst->base && gpio < (inst->base + inst->num_gpios))
+
+        for (gpio = 0; gpio < inst->num_gpios; gpio++)
         {
-            *iface_ptr = chip->interface;
-            *priv = inst->priv;
-            *offset = gpio - inst->base;
-            return 0;
+            GPIO_DISPATCH_T *entry;
+
+            if (inst->base + gpio >= MAX_GPIO_PINS)
+                break;
+            entry = &gpio_dispatch[inst->base + gpio];
+            // Like the old search, the first chip claiming a GPIO wins
+            if (entry->iface)
+                continue;
+            entry->iface = inst->chip->interface;
+            entry->priv = inst->priv;
+            entry->offset = gpio;
         }
     }
-    return -1;
+}
+
+static GPIO_NAME_ENTRY_T *gpio_name_find_slot(const char *name, unsigned len)
+{
+    unsigned slot = fnv1a(FNV1A_INIT, name, len) & (NAME_HASH_SIZE - 1);
+    GPIO_NAME_ENTRY_T *entry;
+
+    while (1)
+    {
+        entry = &gpio_name_hash[slot];
+        if (!entry->name ||
+            (entry->len == len && memcmp(entry->name, name, len) == 0))
+            return entry;
+        slot = (slot + 1) & (NAME_HASH_SIZE - 1);
+    }
+}
+
+static void gpio_build_name_hash(void)
+{
+    unsigned gpio;
+
+    // The table starts out zeroed, and touching all of it is a noticeable
+    // part of startup, so only clear it when rebuilding
+    if (num_name_entries)
+        memset(gpio_name_hash, 0, sizeof(gpio_name_hash));
+    num_name_entries = 0;
+    for (gpio = 0; gpio < num_gpios; gpio++)
+    {
+        const char *gpio_name = gpio_names[gpio];
+        const char *p;
+
+        if (!gpio_name)
+            continue;
+
+        for (p = gpio_name; *p; )
+        {
+            unsigned len = strcspn(p, "/");
+            GPIO_NAME_ENTRY_T *entry;
+
+            // Keep at least one slot free so that searches terminate
+            if (num_name_entries == NAME_HASH_SIZE - 1)
+                return;
+
+            // The lowest numbered GPIO with a given name wins
+            entry = gpio_name_find_slot(p, len);
+            if (!entry->name)
+            {
+                entry->name = p;
+                entry->len = len;
+                entry->gpio = gpio;
+                num_name_entries++;
+            }
+            p += len;
+            if (*p == '/')
+                p++;
+        }
+    }
+}
+
+static uint64_t gpio_func_hash_fn(const char *name)
+{
+    uint64_t hash = FNV1A_INIT;
+    uint8_t c;
+
+    // Ignoring case
+    for (; *name; name++)
+    {
+        c = (uint8_t)tolower((unsigned char)*name);
+        hash = fnv1a(hash, &c, 1);
+    }
+    return hash;
+}
+
+static GPIO_FUNC_ENTRY_T *gpio_func_find_slot(const char *name)
+{
+    unsigned slot = gpio_func_hash_fn(name) & (FUNC_HASH_SIZE - 1);
+    GPIO_FUNC_ENTRY_T *entry;
+
+    while (1)
+    {
+        entry = &gpio_func_hash[slot];
+        if (!entry->name || strcasecmp(entry->name, name) == 0)
+            return entry;
+        slot = (slot + 1) & (FUNC_HASH_SIZE - 1);
+    }
+}
+
+static void gpio_build_func_hash(void)
+{
+    unsigned gpio;
+    int fsel;
+
+    // As for the name hash, only clear the table when rebuilding
+    if (num_func_links)
+        memset(gpio_func_hash, 0, sizeof(gpio_func_hash));
+    num_func_links = 0;
+    for (gpio = 0; gpio < num_gpios; gpio++)
+    {
+        if (!gpio_num_is_valid(gpio))
+            continue;
+
+        for (fsel = GPIO_FSEL_FUNC0; fsel <= GPIO_FSEL_FUNC8; fsel++)
+        {
+            const char *name = gpio_get_gpio_fsel_name(gpio, fsel);
+            GPIO_FUNC_ENTRY_T *entry;
+            GPIO_FUNC_LINK_T *link;
+
+            if (!gpio_fsel_name_is_valid(name))
+                continue;
+
+            // There are fewer names than links, so slots can't run out
+            entry = gpio_func_find_slot(name);
+            link = &gpio_func_links[num_func_links];
+            link->gpio = gpio;
+            link->fsel = fsel;
+            link->entry = entry - gpio_func_hash;
+            link->next = 0xffff;
+            if (entry->name)
+                gpio_func_links[entry->tail].next = num_func_links;
+            else
+            {
+                entry->name = name;
+                entry->head = num_func_links;
+            }
+            entry->tail = num_func_links;
+            num_func_links++;
+        }
+    }
+}
+
+static void gpio_build_pin_map(void)
+{
+    int pin;
+
+    memset(gpio_pins, 0xff, sizeof(gpio_pins));
+    // Work downwards so that the lowest numbered pin wins
+    for (pin = NUM_HDR_PINS; pin >= 1; pin--)
+    {
+        if (hdr_gpios[pin] < MAX_GPIO_PINS)
+            gpio_pins[hdr_gpios[pin]] = pin;
+    }
 }
 
 int gpio_num_is_valid(unsigned gpio)
@@ -116,12 +504,14 @@ int gpio_num_is_valid(unsigned gpio)
 GPIO_DIR_T gpio_get_dir(unsigned gpio)
 {
     const GPIO_CHIP_INTERFACE_T *iface = NULL;
+    GPIO_DIR_T dir = DIR_MAX;
     unsigned gpio_offset;
     void *priv;
 
     if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-        return iface->gpio_get_dir(priv, gpio_offset);
-    return DIR_MAX;
+        GPIO_STATS_CALL(priv, GPIO_OP_GET_DIR,
+                        dir = iface->gpio_get_dir(priv, gpio_offset));
+    return dir;
 }
 
 void gpio_set_dir(unsigned gpio, GPIO_DIR_T dir)
@@ -131,7 +521,8 @@ void gpio_set_dir(unsigned gpio, GPIO_DIR_T dir)
     void *priv;
 
     if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-        iface->gpio_set_dir(priv, gpio_offset, dir);
+        GPIO_STATS_CALL(priv, GPIO_OP_SET_DIR,
+                        iface->gpio_set_dir(priv, gpio_offset, dir));
 }
 
 GPIO_FSEL_T gpio_get_fsel(unsigned gpio)
@@ -142,7 +533,8 @@ GPIO_FSEL_T gpio_get_fsel(unsigned gpio)
     void *priv;
 
     if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-        fsel = iface->gpio_get_fsel(priv, gpio_offset);
+        GPIO_STATS_CALL(priv, GPIO_OP_GET_FSEL,
+                        fsel = iface->gpio_get_fsel(priv, gpio_offset));
 
     if (fsel == GPIO_FSEL_GPIO)
     {
@@ -162,7 +554,8 @@ void gpio_set_fsel(unsigned gpio, const GPIO_FSEL_T func)
     void *priv;
 
     if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-        iface->gpio_set_fsel(priv, gpio_offset, func);
+        GPIO_STATS_CALL(priv, GPIO_OP_SET_FSEL,
+                        iface->gpio_set_fsel(priv, gpio_offset, func));
 }
 
 void gpio_set_drive(unsigned gpio, GPIO_DRIVE_T drv)
@@ -172,128 +565,528 @@ void gpio_set_drive(unsigned gpio, GPIO_DRIVE_T drv)
     void *priv;
 
     if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-        iface->gpio_set_drive(priv, gpio_offset, drv);
+        GPIO_STATS_CALL(priv, GPIO_OP_SET_DRIVE,
+                        iface->gpio_set_drive(priv, gpio_offset, drv));
 }
 
 void gpio_set(unsigned gpio)
+{
+    gpio_set_drive(gpio, DRIVE_HIGH);
+    gpio_set_dir(gpio, DIR_OUTPUT);
+}
+
+void gpio_clear(unsigned gpio)
+{
+    gpio_set_drive(gpio, DRIVE_LOW);
+    gpio_set_dir(gpio, DIR_OUTPUT);
+}
+
+int gpio_get_level(unsigned gpio)
 {
     const GPIO_CHIP_INTERFACE_T *iface = NULL;
+    int level = 0;
     unsigned gpio_offset;
     void *priv;
 
     if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-    {
-        iface->gpio_set_drive(priv, gpio_offset, 1);
-        iface->gpio_set_dir(priv, gpio_offset, DIR_OUTPUT);
-    }
+        GPIO_STATS_CALL(priv, GPIO_OP_GET_LEVEL,
+                        level = iface->gpio_get_level(priv, gpio_offset));
+    return level;
 }
 
-void gpio_clear(unsigned gpio)
+GPIO_DRIVE_T gpio_get_drive(unsigned gpio)
 {
     const GPIO_CHIP_INTERFACE_T *iface = NULL;
+    GPIO_DRIVE_T drive = DRIVE_MAX;
     unsigned gpio_offset;
     void *priv;
 
     if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-    {
-        iface->gpio_set_drive(priv, gpio_offset, 0);
-        iface->gpio_set_dir(priv, gpio_offset, DIR_OUTPUT);
-    }
+        GPIO_STATS_CALL(priv, GPIO_OP_GET_DRIVE,
+                        drive = iface->gpio_get_drive(priv, gpio_offset));
+    return drive;
 }
 
-int gpio_get_level(unsigned gpio)
+GPIO_PULL_T gpio_get_pull(unsigned gpio)
 {
     const GPIO_CHIP_INTERFACE_T *iface = NULL;
+    GPIO_PULL_T pull = PULL_MAX;
     unsigned gpio_offset;
     void *priv;
 
     if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-        return iface->gpio_get_level(priv, gpio_offset);
-    return 0;
+        GPIO_STATS_CALL(priv, GPIO_OP_GET_PULL,
+                        pull = iface->gpio_get_pull(priv, gpio_offset));
+    return pull;
 }
 
-GPIO_DRIVE_T gpio_get_drive(unsigned gpio)
+void gpio_set_pull(unsigned gpio, GPIO_PULL_T pull)
 {
     const GPIO_CHIP_INTERFACE_T *iface = NULL;
     unsigned gpio_offset;
     void *priv;
 
     if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-        return iface->gpio_get_drive(priv, gpio_offset);
-    return DRIVE_MAX;
+        GPIO_STATS_CALL(priv, GPIO_OP_SET_PULL,
+                        iface->gpio_set_pull(priv, gpio_offset, pull));
 }
 
-GPIO_PULL_T gpio_get_pull(unsigned gpio)
+// Returns the number of GPIOs (up to max) from gpio onwards that can be
+// passed to the same chip in a single bulk call, or 0 if gpio is invalid.
+static unsigned gpio_get_run(unsigned gpio, unsigned max)
+{
+    const GPIO_DISPATCH_T *entry;
+    unsigned run;
+
+    if (gpio >= MAX_GPIO_PINS || !gpio_dispatch[gpio].iface)
+        return 0;
+
+    entry = &gpio_dispatch[gpio];
+    for (run = 1; run < max && gpio + run < MAX_GPIO_PINS; run++)
+    {
+        const GPIO_DISPATCH_T *next = &gpio_dispatch[gpio + run];
+        if (next->iface != entry->iface || next->priv != entry->priv ||
+            next->offset != entry->offset + run)
+            break;
+    }
+    return run;
+}
+
+int gpio_get_levels(unsigned first, unsigned count, uint64_t *levels)
+{
+    unsigned i = 0;
+
+    *levels = 0;
+    if (count > 64)
+        return -1;
+
+    while (i < count)
+    {
+        const GPIO_DISPATCH_T *entry;
+        unsigned run = gpio_get_run(first + i, count - i);
+        uint64_t bits = 0;
+        unsigned j;
+        int ret = -1;
+
+        if (!run)
+        {
+            i++;
+            continue;
+        }
+
+        entry = &gpio_dispatch[first + i];
+        if (entry->iface->gpio_get_levels)
+            GPIO_STATS_CALL(entry->priv, GPIO_OP_GET_LEVELS,
+                            ret = entry->iface->gpio_get_levels(entry->priv, entry->offset,
+                                                                run, &bits));
+        if (ret != 0)
+        {
+            bits = 0;
+            for (j = 0; j < run; j++)
+            {
+                if (gpio_get_level(first + i + j) == 1)
+                    bits |= (uint64_t)1 << j;
+            }
+        }
+        *levels |= (bits & MASK64(run)) << i;
+        i += run;
+    }
+
+    return 0;
+}
+
+static void gpio_drive_mask(unsigned first, uint64_t mask, GPIO_DRIVE_T drv)
+{
+    unsigned i = 0;
+
+    while (i < 64)
+    {
+        const GPIO_DISPATCH_T *entry;
+        unsigned run;
+        uint64_t bits;
+        unsigned j;
+        int ret;
+
+        if (!(mask >> i))
+            break;
+        if (!((mask >> i) & 1))
+        {
+            i++;
+            continue;
+        }
+
+        run = gpio_get_run(first + i, 64 - i);
+        if (!run)
+        {
+            i++;
+            continue;
+        }
+
+        entry = &gpio_dispatch[first + i];
+        bits = (mask >> i) & MASK64(run);
+        ret = -1;
+        if (entry->iface->gpio_set_drives)
+            GPIO_STATS_CALL(entry->priv, GPIO_OP_SET_DRIVES,
+                            ret = entry->iface->gpio_set_drives(entry->priv, entry->offset,
+                                                                bits, drv));
+        if (ret != 0)
+        {
+            for (j = 0; j < run; j++)
+            {
+                if (bits & ((uint64_t)1 << j))
+                    gpio_set_drive(first + i + j, drv);
+            }
+        }
+        i += run;
+    }
+}
+
+void gpio_set_mask(unsigned first, uint64_t mask)
+{
+    gpio_drive_mask(first, mask, DRIVE_HIGH);
+}
+
+void gpio_clear_mask(unsigned first, uint64_t mask)
+{
+    gpio_drive_mask(first, mask, DRIVE_LOW);
+}
+
+// The raw pad settings, which only snapshot and restore need
+static uint32_t gpio_get_pad(unsigned gpio)
 {
     const GPIO_CHIP_INTERFACE_T *iface = NULL;
+    uint32_t pad = GPIO_PAD_NONE;
     unsigned gpio_offset;
     void *priv;
+    int ret = -1;
 
-    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-        return iface->gpio_get_pull(priv, gpio_offset);
-    return PULL_MAX;
+    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0 &&
+        iface->gpio_get_pad)
+        GPIO_STATS_CALL(priv, GPIO_OP_GET_PAD,
+                        ret = iface->gpio_get_pad(priv, gpio_offset, &pad));
+    return (ret == 0) ? pad : GPIO_PAD_NONE;
 }
 
-void gpio_set_pull(unsigned gpio, GPIO_PULL_T pull)
+static void gpio_set_pad(unsigned gpio, uint32_t pad)
 {
     const GPIO_CHIP_INTERFACE_T *iface = NULL;
     unsigned gpio_offset;
     void *priv;
 
-    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0)
-        iface->gpio_set_pull(priv, gpio_offset, pull);
+    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) == 0 &&
+        iface->gpio_set_pad)
+        GPIO_STATS_CALL(priv, GPIO_OP_SET_PAD,
+                        iface->gpio_set_pad(priv, gpio_offset, pad));
 }
 
-void gpio_get_pin_range(unsigned *first, unsigned *last)
+int gpio_snapshot(GPIO_PIN_STATE_T *states, unsigned max_states)
 {
-    if (first_hdr_pin == GPIO_INVALID)
+    unsigned levels_first = GPIO_INVALID;
+    uint64_t levels = 0;
+    unsigned count = 0;
+    unsigned gpio;
+
+    for (gpio = 0; gpio < num_gpios; gpio++)
     {
-        unsigned i;
+        GPIO_PIN_STATE_T *state;
+        GPIO_DRIVE_T drive = DRIVE_MAX;
+        GPIO_FSEL_T fsel;
 
-        for (i = 0; i < num_gpio_chips; i++)
+        if (!gpio_num_is_valid(gpio))
+            continue;
+        if (count++ >= max_states)
+            continue;
+
+        // Some GPIOs have no pinmux, and report an invalid function
+        fsel = gpio_get_fsel(gpio);
+        if ((unsigned)fsel > GPIO_FSEL_MAX)
+            fsel = GPIO_FSEL_MAX;
+        if (fsel == GPIO_FSEL_OUTPUT)
         {
-            if (!strncmp(gpio_chips[i].name, "bcm2", 4) ||
-                !strcmp(gpio_chips[i].name, "rp1"))
+            drive = gpio_get_drive(gpio);
+            if (drive == DRIVE_MAX)
             {
-                // Assume it's the standard RPi 40-pin header layout
-                uint32_t base = gpio_chips[i].base;
-
-                hdr_gpios[3] = base + 2;
-                hdr_gpios[5] = base + 3;
-                hdr_gpios[7] = base + 4;
-                hdr_gpios[8] = base + 14;
-                hdr_gpios[10] = base + 15;
-                hdr_gpios[11] = base + 17;
-                hdr_gpios[12] = base + 18;
-                hdr_gpios[13] = base + 27;
-                hdr_gpios[15] = base + 22;
-                hdr_gpios[16] = base + 23;
-                hdr_gpios[18] = base + 24;
-                hdr_gpios[19] = base + 10;
-                hdr_gpios[21] = base + 9;
-                hdr_gpios[18] = base + 24;
-                hdr_gpios[22] = base + 25;
-                hdr_gpios[23] = base + 11;
-                hdr_gpios[24] = base + 8;
-                hdr_gpios[26] = base + 7;
-                hdr_gpios[27] = base + 0;
-                hdr_gpios[28] = base + 1;
-                hdr_gpios[29] = base + 5;
-                hdr_gpios[31] = base + 6;
-                hdr_gpios[32] = base + 12;
-                hdr_gpios[33] = base + 13;
-                hdr_gpios[35] = base + 19;
-                hdr_gpios[36] = base + 16;
-                hdr_gpios[37] = base + 26;
-                hdr_gpios[38] = base + 20;
-                hdr_gpios[40] = base + 21;
-
-                first_hdr_pin = 1;
-                last_hdr_pin = 40;
-                break;
+                // The drive can't be read back, but an output's level is
+                // what it is driving - read 64 levels at a time
+                if (levels_first == GPIO_INVALID || gpio >= levels_first + 64)
+                {
+                    levels_first = gpio;
+                    gpio_get_levels(levels_first,
+                                    (num_gpios - gpio < 64) ? (num_gpios - gpio) : 64,
+                                    &levels);
+                }
+                drive = ((levels >> (gpio - levels_first)) & 1) ? DRIVE_HIGH : DRIVE_LOW;
+            }
+        }
+
+        state = &states[count - 1];
+        state->gpio = gpio;
+        state->fsel = fsel;
+        state->drive = drive;
+        state->pull = gpio_get_pull(gpio);
+        state->reserved = 0;
+        state->pad = gpio_get_pad(gpio);
+    }
+
+    return (int)count;
+}
+
+int gpio_restore(const GPIO_PIN_STATE_T *states, unsigned num_states)
+{
+    unsigned drive_first = GPIO_INVALID;
+    uint64_t set_mask = 0, clear_mask = 0;
+    unsigned i;
+
+    // Check everything before changing anything
+    for (i = 0; i < num_states; i++)
+    {
+        const GPIO_PIN_STATE_T *state = &states[i];
+
+        if (!gpio_num_is_valid(state->gpio) || state->fsel > GPIO_FSEL_MAX ||
+            state->drive > DRIVE_MAX || state->pull > PULL_MAX)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    // Pulls first, so that pins about to become inputs don't float
+    for (i = 0; i < num_states; i++)
+    {
+        const GPIO_PIN_STATE_T *state = &states[i];
+
+        if (state->pull != PULL_MAX && gpio_get_pull(state->gpio) != state->pull)
+            gpio_set_pull(state->gpio, state->pull);
+    }
+
+    // Then the output levels, while the directions are unchanged, so that
+    // pins that become outputs start at the right level
+    for (i = 0; i < num_states; i++)
+    {
+        const GPIO_PIN_STATE_T *state = &states[i];
+
+        if (state->fsel != GPIO_FSEL_OUTPUT || state->drive == DRIVE_MAX ||
+            gpio_get_drive(state->gpio) == state->drive)
+            continue;
+
+        if (drive_first == GPIO_INVALID || state->gpio < drive_first ||
+            state->gpio >= drive_first + 64)
+        {
+            if (drive_first != GPIO_INVALID)
+            {
+                gpio_set_mask(drive_first, set_mask);
+                gpio_clear_mask(drive_first, clear_mask);
             }
+            drive_first = state->gpio;
+            set_mask = clear_mask = 0;
+        }
+        if (state->drive == DRIVE_HIGH)
+            set_mask |= (uint64_t)1 << (state->gpio - drive_first);
+        else
+            clear_mask |= (uint64_t)1 << (state->gpio - drive_first);
+    }
+    if (drive_first != GPIO_INVALID)
+    {
+        gpio_set_mask(drive_first, set_mask);
+        gpio_clear_mask(drive_first, clear_mask);
+    }
+
+    // Then the functions and directions
+    for (i = 0; i < num_states; i++)
+    {
+        const GPIO_PIN_STATE_T *state = &states[i];
+
+        if (state->fsel != GPIO_FSEL_MAX &&
+            gpio_get_fsel(state->gpio) != state->fsel)
+            gpio_set_fsel(state->gpio, state->fsel);
+    }
+
+    // Finally the pads, because changing the function can change them
+    for (i = 0; i < num_states; i++)
+    {
+        const GPIO_PIN_STATE_T *state = &states[i];
+
+        if (state->pad != GPIO_PAD_NONE && gpio_get_pad(state->gpio) != state->pad)
+            gpio_set_pad(state->gpio, state->pad);
+    }
+
+    return 0;
+}
+
+static void gpio_play_sleep_until(uint64_t time_ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = time_ns / 1000000000;
+    ts.tv_nsec = time_ns % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        continue;
+}
+
+static int gpio_play_check(const GPIO_STEP_T *steps, unsigned num_steps)
+{
+    unsigned i, j;
+
+    for (i = 0; i < num_steps; i++)
+    {
+        const GPIO_STEP_T *step = &steps[i];
+        uint64_t mask = step->set_mask | step->clear_mask;
+
+        if ((step->set_mask & step->clear_mask) ||
+            (i && step->time_ns < steps[i - 1].time_ns))
+            return -1;
+        for (j = 0; j < 64; j++)
+        {
+            if (((mask >> j) & 1) && !gpio_num_is_valid(step->first + j))
+                return -1;
         }
     }
+    return 0;
+}
+
+int gpio_play(const GPIO_STEP_T *steps, unsigned num_steps,
+              const GPIO_PLAY_CONFIG_T *config, GPIO_PLAY_RESULT_T *result)
+{
+    const GPIO_PLAY_CONFIG_T default_config = { .cpu = -1 };
+    struct sched_param old_param;
+    cpu_set_t old_cpus;
+    int64_t total_error = 0, min_error = 0, max_error = 0;
+    uint64_t start;
+    int old_policy;
+    int err = 0;
+    unsigned i;
+
+    if (!config)
+        config = &default_config;
+    if (gpio_play_check(steps, num_steps) != 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_getaffinity_np(pthread_self(), sizeof(old_cpus), &old_cpus);
+    pthread_getschedparam(pthread_self(), &old_policy, &old_param);
+    if (config->cpu >= 0)
+    {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(config->cpu, &cpus);
+        err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+    if (!err && config->priority > 0)
+    {
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = config->priority;
+        err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    }
+    if (err)
+        goto done;
+
+    start = get_time_ns(CLOCK_MONOTONIC);
+    for (i = 0; i < num_steps; i++)
+    {
+        const GPIO_STEP_T *step = &steps[i];
+        uint64_t deadline = start + step->time_ns;
+        uint64_t now = get_time_ns(CLOCK_MONOTONIC);
+        int64_t error;
+
+        // Sleep until close to the deadline, then spin for the rest, as
+        // waking from a sleep takes tens of microseconds
+        if (deadline > now + config->spin_ns)
+            gpio_play_sleep_until(deadline - config->spin_ns);
+        while (config->spin_ns && get_time_ns(CLOCK_MONOTONIC) < deadline)
+            continue;
+
+        // Measured when the writes start, so that it doesn't include them
+        error = (int64_t)(get_time_ns(CLOCK_MONOTONIC) - deadline);
+        gpio_clear_mask(step->first, step->clear_mask);
+        gpio_set_mask(step->first, step->set_mask);
+
+        total_error += error;
+        if (!i || error < min_error)
+            min_error = error;
+        if (!i || error > max_error)
+            max_error = error;
+    }
+
+    if (result)
+    {
+        result->num_steps = num_steps;
+        result->min_error_ns = min_error;
+        result->max_error_ns = max_error;
+        result->mean_error_ns = num_steps ? total_error / (int64_t)num_steps : 0;
+        result->duration_ns = get_time_ns(CLOCK_MONOTONIC) - start;
+    }
+
+done:
+    pthread_setschedparam(pthread_self(), old_policy, &old_param);
+    pthread_setaffinity_np(pthread_self(), sizeof(old_cpus), &old_cpus);
+    if (err)
+    {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+// Without header pin names in the Device Tree, assume the standard RPi
+// 40-pin header layout on the first Broadcom or RP1 chip
+static void gpio_build_hdr_map(void)
+{
+    unsigned i;
+
+    if (first_hdr_pin != GPIO_INVALID)
+        return;
+
+    for (i = 0; i < num_gpio_chips; i++)
+    {
+        if (!strncmp(gpio_chips[i].name, "bcm2", 4) ||
+            !strcmp(gpio_chips[i].name, "rp1"))
+        {
+            uint32_t base = gpio_chips[i].base;
+
+            hdr_gpios[3] = base + 2;
+            hdr_gpios[5] = base + 3;
+            hdr_gpios[7] = base + 4;
+            hdr_gpios[8] = base + 14;
+            hdr_gpios[10] = base + 15;
+            hdr_gpios[11] = base + 17;
+            hdr_gpios[12] = base + 18;
+            hdr_gpios[13] = base + 27;
+            hdr_gpios[15] = base + 22;
+            hdr_gpios[16] = base + 23;
+            hdr_gpios[18] = base + 24;
+            hdr_gpios[19] = base + 10;
+            hdr_gpios[21] = base + 9;
+            hdr_gpios[18] = base + 24;
+            hdr_gpios[22] = base + 25;
+            hdr_gpios[23] = base + 11;
+            hdr_gpios[24] = base + 8;
+            hdr_gpios[26] = base + 7;
+            hdr_gpios[27] = base + 0;
+            hdr_gpios[28] = base + 1;
+            hdr_gpios[29] = base + 5;
+            hdr_gpios[31] = base + 6;
+            hdr_gpios[32] = base + 12;
+            hdr_gpios[33] = base + 13;
+            hdr_gpios[35] = base + 19;
+            hdr_gpios[36] = base + 16;
+            hdr_gpios[37] = base + 26;
+            hdr_gpios[38] = base + 20;
+            hdr_gpios[40] = base + 21;
+
+            first_hdr_pin = 1;
+            last_hdr_pin = 40;
+            break;
+        }
+    }
+}
+
+void gpio_get_pin_range(unsigned *first, unsigned *last)
+{
     if (first)
         *first = first_hdr_pin;
     if (last)
@@ -311,6 +1104,10 @@ int gpio_to_pin(unsigned gpio)
 {
     int i;
 
+    if (gpio < MAX_GPIO_PINS)
+        return gpio_pins[gpio];
+
+    // Power and ground pins aren't worth indexing
     for (i = 1; i <= NUM_HDR_PINS; i++)
     {
         if (hdr_gpios[i] == gpio)
@@ -321,30 +1118,61 @@ int gpio_to_pin(unsigned gpio)
 
 unsigned gpio_get_gpio_by_name(const char *name, int name_len)
 {
-    unsigned gpio;
+    const GPIO_NAME_ENTRY_T *entry;
 
     if (!name_len)
         name_len = strlen(name);
-    for (gpio = 0; gpio < num_gpios; gpio++)
-    {
-        const char *gpio_name = gpio_names[gpio];
-        const char *p;
+    if (name_len < 0)
+        return GPIO_INVALID;
 
-        if (!gpio_name)
-            continue;
+    entry = gpio_name_find_slot(name, name_len);
+    return entry->name ? entry->gpio : GPIO_INVALID;
+}
 
-        for (p = gpio_name; *p; )
+int gpio_find_function(const char *pattern, GPIO_FUNCTION_T *funcs,
+                       unsigned max_funcs)
+{
+    uint8_t matches[FUNC_HASH_SIZE];
+    unsigned count = 0;
+    unsigned i;
+
+    if (!strpbrk(pattern, "*?["))
+    {
+        const GPIO_FUNC_ENTRY_T *entry = gpio_func_find_slot(pattern);
+
+        for (i = entry->name ? entry->head : 0xffff; i != 0xffff;
+             i = gpio_func_links[i].next, count++)
         {
-            int len = strcspn(p, "/");
-            if (len == name_len && memcmp(name, p, name_len) == 0)
-                return gpio;
-            p += len;
-            if (*p == '/')
-                p++;
+            if (count < max_funcs)
+            {
+                funcs[count].gpio = gpio_func_links[i].gpio;
+                funcs[count].fsel = gpio_func_links[i].fsel;
+                funcs[count].name = entry->name;
+            }
         }
+        return count;
     }
 
-    return GPIO_INVALID;
+    // Match each distinct name once, then report the links in GPIO order
+    for (i = 0; i < FUNC_HASH_SIZE; i++)
+        matches[i] = gpio_func_hash[i].name &&
+            fnmatch(pattern, gpio_func_hash[i].name, FNM_CASEFOLD) == 0;
+
+    for (i = 0; i < num_func_links; i++)
+    {
+        const GPIO_FUNC_LINK_T *link = &gpio_func_links[i];
+
+        if (!matches[link->entry])
+            continue;
+        if (count < max_funcs)
+        {
+            funcs[count].gpio = link->gpio;
+            funcs[count].fsel = link->fsel;
+            funcs[count].name = gpio_func_hash[link->entry].name;
+        }
+        count++;
+    }
+    return count;
 }
 
 const char *gpio_get_name(unsigned gpio)
@@ -380,6 +1208,12 @@ const char *gpio_get_gpio_fsel_name(unsigned gpio, GPIO_FSEL_T fsel)
     return NULL;
 }
 
+int gpio_fsel_name_is_valid(const char *name)
+{
+    // Unnamed alternates are "-" or empty
+    return name && name[0] && strcmp(name, "-") != 0;
+}
+
 const char *gpio_get_fsel_name(GPIO_FSEL_T fsel)
 {
     if ((unsigned)fsel < ARRAY_SIZE(fsel_names))
@@ -401,7 +1235,106 @@ const char *gpio_get_drive_name(GPIO_DRIVE_T drive)
     return NULL;
 }
 
-static const GPIO_CHIP_T *gpio_find_chip(const char *name)
+const char *gpio_get_op_name(GPIO_OP_T op)
+{
+    if ((unsigned)op < ARRAY_SIZE(op_names))
+        return op_names[op];
+    return NULL;
+}
+
+int gpiolib_get_chips(GPIO_CHIP_INFO_T *chips, unsigned max_chips)
+{
+    unsigned i;
+
+    for (i = 0; i < num_gpio_chips && i < max_chips; i++)
+    {
+        chips[i].name = gpio_chips[i].name;
+        chips[i].base = gpio_chips[i].base;
+        chips[i].num_gpios = gpio_chips[i].num_gpios;
+    }
+    return num_gpio_chips;
+}
+
+int gpio_get_chip_regs(unsigned gpio, GPIO_CHIP_REGS_T *regs)
+{
+    const GPIO_CHIP_INTERFACE_T *iface;
+    unsigned gpio_offset;
+    void *priv;
+
+    memset(regs, 0, sizeof(*regs));
+    if (gpio_get_interface(gpio, &iface, &priv, &gpio_offset) != 0)
+        return -1;
+
+    if (!iface->gpio_get_regs || iface->gpio_get_regs(priv, regs) != 0)
+    {
+        memset(regs, 0, sizeof(*regs));
+        regs->type = GPIO_REGS_MAX;
+    }
+    regs->base = gpio - gpio_offset;
+    regs->num_gpios = iface->gpio_count(priv);
+    return 0;
+}
+
+int gpiolib_get_stats(GPIO_CHIP_STATS_T *stats, unsigned max_chips)
+{
+#if GPIOLIB_STATS
+    unsigned i;
+    unsigned op;
+
+    for (i = 0; i < num_gpio_chips && i < max_chips; i++)
+    {
+        const GPIO_CHIP_INSTANCE_T *inst = &gpio_chips[i];
+
+        stats[i].name = inst->name;
+        stats[i].base = inst->base;
+        stats[i].num_gpios = inst->num_gpios;
+        // Each counter is consistent, but a busy chip may move on meanwhile
+        for (op = 0; op < GPIO_OP_MAX; op++)
+        {
+            uint64_t *src = (uint64_t *)&gpio_stats[i][op];
+            uint64_t *dst = (uint64_t *)&stats[i].ops[op];
+            unsigned j;
+
+            for (j = 0; j < sizeof(GPIO_OP_STATS_T) / sizeof(uint64_t); j++)
+                dst[j] = __atomic_load_n(&src[j], __ATOMIC_RELAXED);
+        }
+    }
+    return num_gpio_chips;
+#else
+    UNUSED(stats);
+    UNUSED(max_chips);
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+void gpiolib_reset_stats(void)
+{
+#if GPIOLIB_STATS
+    memset(gpio_stats, 0, sizeof(gpio_stats));
+#endif
+}
+
+int gpiolib_get_drivers(const char **names, unsigned max_names)
+{
+#if LIBRARY_BUILD
+    const GPIO_CHIP_T *const *start = &library_gpiochips[0];
+    const GPIO_CHIP_T *const *end = &library_gpiochips[0] + library_gpiochips_count;
+#else
+    const GPIO_CHIP_T *const *start = &__start_gpiochips;
+    const GPIO_CHIP_T *const *end = &__stop_gpiochips;
+#endif
+    unsigned count = 0;
+
+    for (; start < end; start++, count++)
+    {
+        if (count < max_names)
+            names[count] = (*start)->name;
+    }
+    return count;
+}
+
+const GPIO_CHIP_T *gpio_find_chip(const char *name)
 {
 #if LIBRARY_BUILD
     const GPIO_CHIP_T *const *start = &library_gpiochips[0];
@@ -430,81 +1363,236 @@ static GPIO_CHIP_INSTANCE_T *gpio_add_chip_instance(const char *dtnode, const ch
     uint64_t phys_addr;
     char *compatible;
 
-    compatible = dt_read_prop(dtnode, "compatible", NULL);
-    if (!compatible)
+    // The kernel also lists the aliased chips, so check before reading
+    // any properties
+    if (gpio_chip_is_known(dtnode))
+        return NULL;
+
+    compatible = dt_read_prop(dtnode, "compatible", NULL);
+    if (!compatible)
+    {
+        sprintf(pathbuf, "%s/..", dtnode);
+        compatible = dt_read_prop(pathbuf, "compatible", NULL);
+    }
+
+    chip = gpio_find_chip(compatible);
+    dt_free(compatible);
+
+    // Skip unknown gpio chips
+    if (!chip)
+        return NULL;
+
+    if (chip->size)
+    {
+        phys_addr = dt_parse_addr(dtnode);
+        if (phys_addr == INVALID_ADDRESS)
+            return NULL;
+    }
+    else
+    {
+        phys_addr = 0;
+    }
+
+    inst = gpio_create_instance(chip, phys_addr, NULL, dtnode);
+    // Skip duplicates (or if there is an error)
+    if (!inst)
+        return NULL;
+
+    sprintf(pathbuf, "/dev/gpiomem%s", gpiomem_idx);
+    inst->mem_fd = open(pathbuf, O_RDWR|O_SYNC);
+    snprintf(inst->gpiomem_idx, sizeof(inst->gpiomem_idx), "%s", gpiomem_idx);
+    return inst;
+}
+
+static void gpiolib_cache_key(GPIOLIB_CACHE_HEADER_T *key)
+{
+    const char *overlays_path = "/sys/kernel/config/device-tree/overlays";
+    struct dirent *de;
+    DIR *dir;
+    FILE *fp;
+
+    memset(key, 0, sizeof(*key));
+    memcpy(key->magic, CACHE_MAGIC, sizeof(key->magic));
+    key->version = CACHE_VERSION;
+
+    // The boot time tree can only change by applying overlays through
+    // configfs, which anyone can list (unlike /sys/firmware/fdt)
+    key->overlays_hash = FNV1A_INIT;
+    dir = opendir(overlays_path);
+    while (dir && ((de = readdir(dir)) != NULL))
+    {
+        if (de->d_name[0] != '.')
+            key->overlays_hash = fnv1a(key->overlays_hash, de->d_name,
+                                       strlen(de->d_name) + 1);
+    }
+    if (dir)
+        closedir(dir);
+
+    // procfs files have no size, so read_file can't be used
+    fp = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (fp)
+    {
+        if (!fgets(key->boot_id, sizeof(key->boot_id), fp))
+            key->boot_id[0] = '\0';
+        key->boot_id[strcspn(key->boot_id, "\n")] = '\0';
+        fclose(fp);
+    }
+}
+
+// Recreate the chips from the cache, returning 0 on success
+static int gpiolib_cache_load(const GPIOLIB_CACHE_HEADER_T *key)
+{
+    GPIOLIB_CACHE_HEADER_T *hdr;
+    const char *p, *end;
+    void *record;
+    size_t size;
+    uint8_t *buf;
+    unsigned i;
+
+    if (!key->boot_id[0])
+        return -1;
+
+    buf = read_file(gpiolib_cache_path, &size);
+    if (!buf)
+        return -1;
+    hdr = (GPIOLIB_CACHE_HEADER_T *)buf;
+    if (size < sizeof(*hdr) ||
+        memcmp(hdr->magic, key->magic, sizeof(hdr->magic)) != 0 ||
+        hdr->version != key->version || hdr->overlays_hash != key->overlays_hash ||
+        strncmp(hdr->boot_id, key->boot_id, sizeof(hdr->boot_id)) != 0 ||
+        (size_t)hdr->chips_len + hdr->record_len != size - sizeof(*hdr) ||
+        !hdr->num_chips || hdr->num_chips > MAX_GPIO_CHIPS)
+        goto fail;
+
+    p = (const char *)(hdr + 1);
+    end = p + hdr->chips_len;
+    if (hdr->chips_len && end[-1] != '\0')
+        goto fail;
+
+    record = malloc(hdr->record_len ? hdr->record_len : 1);
+    if (!record)
+        goto fail;
+    memcpy(record, end, hdr->record_len);
+    if (dt_load_record(record, hdr->record_len) != 0)
+        goto fail;
+
+    for (i = 0; i < hdr->num_chips && p < end; i++)
+    {
+        const char *gpiomem_idx = p;
+        char *dtnode;
+
+        p += strlen(p) + 1;
+        if (p >= end)
+            break;
+        dtnode = strdup(p);
+        p += strlen(p) + 1;
+        if (dtnode && !gpio_add_chip_instance(dtnode, gpiomem_idx))
+            free(dtnode);
+    }
+
+    free(buf);
+    return 0;
+
+fail:
+    free(buf);
+    return -1;
+}
+
+static void gpiolib_cache_save(GPIOLIB_CACHE_HEADER_T *hdr, const void *record,
+                               size_t record_len)
+{
+    char tmp_path[FILENAME_MAX];
+    unsigned i;
+    FILE *fp;
+    int ok;
+
+    if (!hdr->boot_id[0] || !num_gpio_chips)
+        return;
+
+    hdr->num_chips = num_gpio_chips;
+    hdr->chips_len = 0;
+    for (i = 0; i < num_gpio_chips; i++)
+        hdr->chips_len += strlen(gpio_chips[i].gpiomem_idx) + 1 +
+                          strlen(gpio_chips[i].dtnode) + 1;
+    hdr->record_len = record_len;
+
+    // Write a temporary file and rename it, so readers never see part of one
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d", gpiolib_cache_path,
+                 (int)getpid()) >= (int)sizeof(tmp_path))
+        return;
+    fp = fopen(tmp_path, "wb");
+    if (!fp)
+        return;
+
+    ok = (fwrite(hdr, sizeof(*hdr), 1, fp) == 1);
+    for (i = 0; ok && i < num_gpio_chips; i++)
     {
-        sprintf(pathbuf, "%s/..", dtnode);
-        compatible = dt_read_prop(pathbuf, "compatible", NULL);
+        const GPIO_CHIP_INSTANCE_T *inst = &gpio_chips[i];
+        ok = (fwrite(inst->gpiomem_idx, strlen(inst->gpiomem_idx) + 1, 1, fp) == 1) &&
+             (fwrite(inst->dtnode, strlen(inst->dtnode) + 1, 1, fp) == 1);
     }
+    if (ok && record_len)
+        ok = (fwrite(record, record_len, 1, fp) == 1);
 
-    chip = gpio_find_chip(compatible);
-    dt_free(compatible);
+    if (fclose(fp) != 0 || !ok || rename(tmp_path, gpiolib_cache_path) != 0)
+        unlink(tmp_path);
+}
 
-    // Skip unknown gpio chips
-    if (!chip)
-        return NULL;
+// Adds the gpio-controller nodes at or below node, skipping disabled nodes
+// and their subtrees, since a node is only enabled if its ancestors are too.
+// Only used for trees given to gpiolib_set_dt_path, which have no kernel
+// devices to ask.
+static void gpiolib_find_controllers(const char *node, const char *gpiomem_idx,
+                                     unsigned depth)
+{
+    DT_SUBNODE_HANDLE handle;
+    const char *name;
+    char *prop;
+    int okay;
 
-    if (chip->size)
+    handle = dt_open_subnodes(node);
+    if (!handle)
+        return;
+
+    prop = dt_read_prop(node, "status", NULL);
+    okay = !prop || !strcmp(prop, "okay") || !strcmp(prop, "ok");
+    dt_free(prop);
+
+    prop = okay ? dt_read_prop(node, "gpio-controller", NULL) : NULL;
+    if (prop)
     {
-        phys_addr = dt_parse_addr(dtnode);
-        if (phys_addr == INVALID_ADDRESS)
-            return NULL;
+        char *dtnode = strdup(node);
+
+        dt_free(prop);
+        if (dtnode && !gpio_add_chip_instance(dtnode, gpiomem_idx))
+            free(dtnode);
     }
-    else
+
+    while (okay && depth < MAX_DT_DEPTH && (name = dt_next_subnode(handle)) != NULL)
     {
-        phys_addr = 0;
-    }
+        char child[FILENAME_MAX];
 
-    inst = gpio_create_instance(chip, phys_addr, NULL, dtnode);
-    // Skip duplicates (or if there is an error)
-    if (!inst)
-        return NULL;
+        if (snprintf(child, sizeof(child), "%s/%s", (node[1] ? node : ""),
+                     name) < (int)sizeof(child))
+            gpiolib_find_controllers(child, gpiomem_idx, depth + 1);
+    }
 
-    sprintf(pathbuf, "/dev/gpiomem%s", gpiomem_idx);
-    inst->mem_fd = open(pathbuf, O_RDWR|O_SYNC);
-    return inst;
+    dt_close_subnodes(handle);
 }
 
-int gpiolib_init(void)
+// Find the GPIO chips from the gpio<n> aliases and the gpio controllers
+static void gpiolib_find_chips(void)
 {
-    const GPIO_CHIP_T *chip;
-    GPIO_CHIP_INSTANCE_T *inst;
     char pathbuf[FILENAME_MAX];
     char gpiomem_idx[4];
-    const char *dtpath = "/sys/firmware/devicetree/base";
-    const char *ofnode_prefix = dtpath + 4;
+    const char *ofnode_prefix = "/firmware/devicetree/base";
     const char *gpiopath = "/sys/bus/gpio/devices";
     DIR *dir;
     struct dirent *de;
-    const char *p;
-    char *alias = NULL, *names, *end;
-    size_t names_len;
-    unsigned gpio_base;
-    unsigned pin, i;
+    char *alias = NULL;
+    unsigned i;
     int prefix_len, len;
 
-    for (pin = 0; pin <= NUM_HDR_PINS; pin++)
-        hdr_gpios[pin] = GPIO_INVALID;
-
-    // There is currently only one header layout
-    hdr_gpios[1] = GPIO_3V3;
-    hdr_gpios[17] = GPIO_3V3;
-    hdr_gpios[2] = GPIO_5V;
-    hdr_gpios[4] = GPIO_5V;
-    hdr_gpios[6] = GPIO_GND;
-    hdr_gpios[9] = GPIO_GND;
-    hdr_gpios[14] = GPIO_GND;
-    hdr_gpios[20] = GPIO_GND;
-    hdr_gpios[25] = GPIO_GND;
-    hdr_gpios[30] = GPIO_GND;
-    hdr_gpios[34] = GPIO_GND;
-    hdr_gpios[39] = GPIO_GND;
-
-    if (verbose_callback)
-        (*verbose_callback)("GPIO chips:\n");
-
-    dt_set_path(dtpath);
-
     // Scan the gpio<n> aliases, stopping at the first absence
     for (i = 0; ; i++)
     {
@@ -522,7 +1610,15 @@ int gpiolib_init(void)
             dt_free(alias);
     }
 
-    // Now look for other gpio chips without aliases
+    // Now look for other gpio chips without aliases. The kernel lists the
+    // live ones, which is much quicker than walking the whole tree, and only
+    // includes enabled controllers.
+    if (gpiolib_dt_path)
+    {
+        gpiolib_find_controllers("/", gpiomem_idx, 0);
+        return;
+    }
+
     dir = opendir(gpiopath);
     prefix_len = strlen(ofnode_prefix);
     while (dir && ((de = readdir(dir)) != NULL))
@@ -545,6 +1641,77 @@ int gpiolib_init(void)
                 free(dtnode);
         }
     }
+    if (dir)
+        closedir(dir);
+}
+
+int gpiolib_init(void)
+{
+    const GPIO_CHIP_T *chip;
+    GPIO_CHIP_INSTANCE_T *inst;
+    GPIOLIB_CACHE_HEADER_T cache_key;
+    const char *dtpath = "/sys/firmware/devicetree/base";
+    const char *p;
+    char *names, *end;
+    size_t names_len;
+    unsigned gpio_base;
+    unsigned pin, i;
+    int cached = 0;
+
+    for (pin = 0; pin <= NUM_HDR_PINS; pin++)
+        hdr_gpios[pin] = GPIO_INVALID;
+    first_hdr_pin = GPIO_INVALID;
+    last_hdr_pin = GPIO_INVALID;
+
+    // There is currently only one header layout
+    hdr_gpios[1] = GPIO_3V3;
+    hdr_gpios[17] = GPIO_3V3;
+    hdr_gpios[2] = GPIO_5V;
+    hdr_gpios[4] = GPIO_5V;
+    hdr_gpios[6] = GPIO_GND;
+    hdr_gpios[9] = GPIO_GND;
+    hdr_gpios[14] = GPIO_GND;
+    hdr_gpios[20] = GPIO_GND;
+    hdr_gpios[25] = GPIO_GND;
+    hdr_gpios[30] = GPIO_GND;
+    hdr_gpios[34] = GPIO_GND;
+    hdr_gpios[39] = GPIO_GND;
+
+    if (verbose_callback)
+        (*verbose_callback)("GPIO chips:\n");
+
+    if (gpiolib_dt_path)
+    {
+        struct stat st;
+
+        // Either a flattened device tree or a directory of nodes
+        if (stat(gpiolib_dt_path, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            if (dt_load_fdt(gpiolib_dt_path) != 0)
+                return -1;
+        }
+        else
+        {
+            dt_set_path(gpiolib_dt_path);
+        }
+    }
+    else
+    {
+        // The live tree, including any overlays applied at runtime. The boot
+        // time blob in /sys/firmware/fdt would miss those, and is root-only.
+        dt_set_path(dtpath);
+    }
+
+    if (gpiolib_cache_path && !gpiolib_dt_path)
+    {
+        gpiolib_cache_key(&cache_key);
+        cached = (gpiolib_cache_load(&cache_key) == 0);
+        if (!cached)
+            dt_record_start();
+    }
+
+    if (!cached)
+        gpiolib_find_chips();
 
     gpio_base = 0;
     num_gpios = 0;
@@ -572,7 +1739,10 @@ int gpiolib_init(void)
         gpio_base = ROUND_UP(num_gpios, 100);
 
         if (num_gpios > MAX_GPIO_PINS)
+        {
+            free(dt_record_stop(&names_len));
             return -1;
+        }
 
         names = dt_read_prop(inst->dtnode, "gpio-line-names", &names_len);
         end = names + names_len;
@@ -641,10 +1811,26 @@ int gpiolib_init(void)
         dt_free(names);
     }
 
+    if (gpiolib_cache_path && !gpiolib_dt_path && !cached)
+    {
+        size_t record_len;
+        void *record = dt_record_stop(&record_len);
+
+        if (record)
+            gpiolib_cache_save(&cache_key, record, record_len);
+        free(record);
+    }
+
     // On a board with PINs, show pins 1-40
     if (first_hdr_pin == 3)
         first_hdr_pin = 1;
 
+    gpio_build_hdr_map();
+    gpio_build_dispatch();
+    gpio_build_name_hash();
+    gpio_build_func_hash();
+    gpio_build_pin_map();
+
     return (int)num_gpios;
 }
 
@@ -658,6 +1844,8 @@ int gpiolib_init_by_name(const char *name)
 
     for (pin = 0; pin <= NUM_HDR_PINS; pin++)
         hdr_gpios[pin] = GPIO_INVALID;
+    first_hdr_pin = GPIO_INVALID;
+    last_hdr_pin = GPIO_INVALID;
 
     if (verbose_callback)
         (*verbose_callback)("GPIO chips:\n");
@@ -694,6 +1882,12 @@ int gpiolib_init_by_name(const char *name)
         (*verbose_callback)(msg_buf);
     }
 
+    gpio_build_hdr_map();
+    gpio_build_dispatch();
+    gpio_build_name_hash();
+    gpio_build_func_hash();
+    gpio_build_pin_map();
+
     return (int)num_gpios;
 }
 
@@ -758,10 +1952,330 @@ int gpiolib_mmap(void)
         inst->priv = new_priv;
     }
 
+    // Pick up any private data replaced by the probes
+    gpio_build_dispatch();
+
+    return 0;
+}
+
+GPIOLIB_CTX_T *gpiolib_ctx_init(void)
+{
+    GPIOLIB_CTX_T *ctx = NULL;
+
+    pthread_mutex_lock(&gpiolib_ctx_lock);
+    if (!gpiolib_ctx.status)
+    {
+        // Discovery and mapping can't be repeated, so a failure sticks
+        gpiolib_ctx.status = gpiolib_init();
+        if (gpiolib_ctx.status <= 0 || gpiolib_mmap() != 0)
+            gpiolib_ctx.status = -1;
+    }
+    if (gpiolib_ctx.status > 0)
+    {
+        gpiolib_ctx.refs++;
+        ctx = &gpiolib_ctx;
+    }
+    pthread_mutex_unlock(&gpiolib_ctx_lock);
+
+    return ctx;
+}
+
+void gpiolib_ctx_free(GPIOLIB_CTX_T *ctx)
+{
+    if (!ctx)
+        return;
+
+    pthread_mutex_lock(&gpiolib_ctx_lock);
+    assert(ctx->refs > 0);
+    // The mappings are kept for the life of the process
+    if (--ctx->refs == 0)
+        gpio_release_edges();
+    pthread_mutex_unlock(&gpiolib_ctx_lock);
+}
+
+#ifdef GPIO_V2_LINES_MAX
+
+typedef struct GPIO_EDGE_REQUEST_
+{
+    int chardev;
+    int fd;
+    unsigned gpio_base;  // The GPIO number of line 0
+    struct gpio_v2_line_request req;
+} GPIO_EDGE_REQUEST_T;
+
+static GPIO_EDGE_REQUEST_T edge_requests[MAX_EDGE_REQUESTS];
+static unsigned num_edge_requests;
+
+// Find the /dev/gpiochip<n> devices created for a GPIO chip instance, in
+// order. Drivers that register one gpiochip per bank (e.g. brcmstb) produce
+// several, each covering 32 GPIOs.
+static int gpio_find_chardevs(const GPIO_CHIP_INSTANCE_T *inst, int *devs)
+{
+    const char *gpiopath = "/sys/bus/gpio/devices";
+    const char *ofnode_prefix = "/firmware/devicetree/base";
+    int prefix_len = strlen(ofnode_prefix);
+    char pathbuf[FILENAME_MAX];
+    struct dirent *de;
+    int num_devs = 0;
+    DIR *dir;
+    int i, j;
+
+    if (!inst->dtnode)
+        return 0;
+
+    dir = opendir(gpiopath);
+    while (dir && ((de = readdir(dir)) != NULL))
+    {
+        char symlink[FILENAME_MAX];
+        char *match;
+        int dev, len;
+
+        if (sscanf(de->d_name, "gpiochip%d", &dev) != 1)
+            continue;
+        snprintf(pathbuf, sizeof(pathbuf), "%s/%s/of_node", gpiopath, de->d_name);
+        len = readlink(pathbuf, symlink, sizeof(symlink) - 1);
+        if (len < 0)
+            continue;
+        symlink[len] = '\0';
+        match = strstr(symlink, ofnode_prefix);
+        if (!match || strcmp(match + prefix_len, inst->dtnode) != 0)
+            continue;
+        if (num_devs == MAX_CHARDEVS)
+            break;
+
+        // Insertion sort
+        for (i = num_devs; i > 0 && devs[i - 1] > dev; i--)
+            devs[i] = devs[i - 1];
+        devs[i] = dev;
+        num_devs++;
+    }
+    if (dir)
+        closedir(dir);
+
+    // Discard duplicates
+    for (i = 1, j = 1; i < num_devs; i++)
+    {
+        if (devs[i] != devs[j - 1])
+            devs[j++] = devs[i];
+    }
+
+    return num_devs ? j : 0;
+}
+
+int gpio_request_edges(const unsigned *gpios, unsigned num_gpios)
+{
+    int chardevs[MAX_GPIO_CHIPS][MAX_CHARDEVS];
+    int num_chardevs[MAX_GPIO_CHIPS];
+    unsigned i, j;
+    int err;
+
+    gpio_release_edges();
+
+    for (i = 0; i < num_gpio_chips; i++)
+        num_chardevs[i] = -1;
+
+    for (i = 0; i < num_gpios; i++)
+    {
+        unsigned gpio = gpios[i];
+        GPIO_CHIP_INSTANCE_T *inst = NULL;
+        GPIO_EDGE_REQUEST_T *req = NULL;
+        unsigned offset, line, bank;
+        int chip;
+
+        for (chip = 0; chip < (int)num_gpio_chips; chip++)
+        {
+            inst = &gpio_chips[chip];
+            if (gpio >= inst->base && gpio < inst->base + inst->num_gpios)
+                break;
+        }
+        if (chip == (int)num_gpio_chips)
+        {
+            errno = EINVAL;
+            goto fail;
+        }
+
+        if (num_chardevs[chip] < 0)
+            num_chardevs[chip] = gpio_find_chardevs(inst, chardevs[chip]);
+
+        offset = gpio - inst->base;
+        bank = (num_chardevs[chip] > 1) ? offset / 32 : 0;
+        line = (num_chardevs[chip] > 1) ? offset % 32 : offset;
+        if ((int)bank >= num_chardevs[chip])
+        {
+            errno = ENODEV;
+            goto fail;
+        }
+
+        for (j = 0; j < num_edge_requests; j++)
+        {
+            if (edge_requests[j].chardev == chardevs[chip][bank])
+            {
+                req = &edge_requests[j];
+                break;
+            }
+        }
+        if (!req)
+        {
+            if (num_edge_requests == MAX_EDGE_REQUESTS)
+            {
+                errno = ENOSPC;
+                goto fail;
+            }
+            req = &edge_requests[num_edge_requests++];
+            memset(req, 0, sizeof(*req));
+            req->chardev = chardevs[chip][bank];
+            req->fd = -1;
+            req->gpio_base = gpio - line;
+            strcpy(req->req.consumer, "gpiolib");
+            req->req.config.flags = GPIO_V2_LINE_FLAG_INPUT |
+                                    GPIO_V2_LINE_FLAG_EDGE_RISING |
+                                    GPIO_V2_LINE_FLAG_EDGE_FALLING;
+        }
+        // The kernel rejects requests for the same line twice
+        for (j = 0; j < req->req.num_lines; j++)
+        {
+            if (req->req.offsets[j] == line)
+                break;
+        }
+        if (j < req->req.num_lines)
+            continue;
+        if (req->req.num_lines == GPIO_V2_LINES_MAX)
+        {
+            errno = ENOSPC;
+            goto fail;
+        }
+        req->req.offsets[req->req.num_lines++] = line;
+    }
+
+    for (i = 0; i < num_edge_requests; i++)
+    {
+        GPIO_EDGE_REQUEST_T *req = &edge_requests[i];
+        char pathbuf[FILENAME_MAX];
+        int chip_fd, ret;
+
+        sprintf(pathbuf, "/dev/gpiochip%d", req->chardev);
+        chip_fd = open(pathbuf, O_RDONLY | O_CLOEXEC);
+        if (chip_fd < 0)
+            goto fail;
+        ret = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req->req);
+        close(chip_fd);
+        if (ret < 0)
+            goto fail;
+        req->fd = req->req.fd;
+    }
+
     return 0;
+
+fail:
+    err = errno;
+    gpio_release_edges();
+    errno = err;
+    return -1;
+}
+
+int gpio_wait_edges(GPIO_EDGE_EVENT_T *events, unsigned max_events, int timeout_ms)
+{
+    struct pollfd fds[MAX_EDGE_REQUESTS];
+    unsigned num_events = 0;
+    unsigned i;
+    int ret;
+
+    if (!num_edge_requests)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < num_edge_requests; i++)
+    {
+        fds[i].fd = edge_requests[i].fd;
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+
+    ret = poll(fds, num_edge_requests, timeout_ms);
+    if (ret <= 0)
+        return ret;
+
+    for (i = 0; i < num_edge_requests && num_events < max_events; i++)
+    {
+        struct gpio_v2_line_event buf[16];
+        unsigned count = max_events - num_events;
+        ssize_t len;
+        unsigned j;
+
+        if (!(fds[i].revents & POLLIN))
+            continue;
+
+        if (count > ARRAY_SIZE(buf))
+            count = ARRAY_SIZE(buf);
+        len = read(fds[i].fd, buf, count * sizeof(buf[0]));
+        if (len < 0)
+            return -1;
+
+        for (j = 0; j < len / sizeof(buf[0]); j++)
+        {
+            GPIO_EDGE_EVENT_T *event = &events[num_events++];
+
+            event->gpio = edge_requests[i].gpio_base + buf[j].offset;
+            event->level = (buf[j].id == GPIO_V2_LINE_EVENT_RISING_EDGE);
+            event->timestamp_ns = buf[j].timestamp_ns;
+        }
+    }
+
+    return (int)num_events;
+}
+
+void gpio_release_edges(void)
+{
+    unsigned i;
+
+    for (i = 0; i < num_edge_requests; i++)
+    {
+        if (edge_requests[i].fd >= 0)
+            close(edge_requests[i].fd);
+    }
+    num_edge_requests = 0;
+}
+
+#else
+
+// The kernel headers predate the GPIO v2 uAPI
+
+int gpio_request_edges(const unsigned *gpios, unsigned num_gpios)
+{
+    UNUSED(gpios);
+    UNUSED(num_gpios);
+    errno = ENOSYS;
+    return -1;
+}
+
+int gpio_wait_edges(GPIO_EDGE_EVENT_T *events, unsigned max_events, int timeout_ms)
+{
+    UNUSED(events);
+    UNUSED(max_events);
+    UNUSED(timeout_ms);
+    errno = ENOSYS;
+    return -1;
+}
+
+void gpio_release_edges(void)
+{
 }
 
+#endif
+
 void gpiolib_set_verbose(void (*callback)(const char *))
 {
     verbose_callback = callback;
 }
+
+void gpiolib_set_dt_path(const char *path)
+{
+    gpiolib_dt_path = path;
+}
+
+void gpiolib_set_cache_path(const char *path)
+{
+    gpiolib_cache_path = path;
+}
@@ -3,6 +3,12 @@
 
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GPIOLIB_CACHE_PATH "/run/gpiolib.cache"
+
 #define NUM_HDR_PINS 40
 #define MAX_GPIO_PINS 300
 
@@ -54,10 +60,175 @@ typedef enum
     DRIVE_MAX
 } GPIO_DRIVE_T;
 
+typedef struct
+{
+    unsigned gpio;
+    int level;              /* 1 after a rising edge, 0 after a falling edge */
+    uint64_t timestamp_ns;  /* Kernel timestamp, CLOCK_MONOTONIC */
+} GPIO_EDGE_EVENT_T;
+
+typedef struct
+{
+    uint32_t gpio;
+    uint8_t fsel;           /* GPIO_FSEL_T */
+    uint8_t drive;          /* GPIO_DRIVE_T - DRIVE_MAX unless an output */
+    uint8_t pull;           /* GPIO_PULL_T - PULL_MAX if it can't be read */
+    uint8_t reserved;
+    uint32_t pad;           /* Chip-specific pad settings, or GPIO_PAD_NONE */
+} GPIO_PIN_STATE_T;
+
+#define GPIO_PAD_NONE 0xffffffff
+
+typedef struct
+{
+    const char *name;       /* The chip driver, e.g. "rp1" */
+    unsigned base;          /* The first GPIO number */
+    unsigned num_gpios;
+} GPIO_CHIP_INFO_T;
+
+typedef struct
+{
+    unsigned gpio;
+    GPIO_FSEL_T fsel;       /* The alternate function, GPIO_FSEL_FUNC0 upwards */
+    const char *name;       /* As the chip names it */
+} GPIO_FUNCTION_T;
+
+/* One step of a waveform for gpio_play - bit n of the masks is GPIO first + n */
+typedef struct GPIO_STEP_
+{
+    uint64_t time_ns;       /* When to apply it, relative to the start */
+    uint32_t first;
+    uint32_t reserved;
+    uint64_t set_mask;      /* GPIOs to drive high */
+    uint64_t clear_mask;    /* GPIOs to drive low */
+} GPIO_STEP_T;
+
+typedef struct
+{
+    unsigned spin_ns;       /* Busy-wait for the last spin_ns before each step */
+    int cpu;                /* CPU to run on, or -1 for any */
+    int priority;           /* SCHED_FIFO priority, or 0 to leave it unchanged */
+} GPIO_PLAY_CONFIG_T;
+
+/* The errors are the times each step's writes started minus the requested times */
+typedef struct
+{
+    unsigned num_steps;
+    int64_t min_error_ns;
+    int64_t max_error_ns;
+    int64_t mean_error_ns;
+    uint64_t duration_ns;   /* From the start to the end of the last step */
+} GPIO_PLAY_RESULT_T;
+
+/* The register layouts that gpio_get_chip_regs can describe. GPIO n of a
+ * chip (counting from the chip's base) is bit n % 32 of bank n / 32, except
+ * on RP1, whose banks start at GPIOs 0, 28 and 34.
+ */
+typedef enum
+{
+    GPIO_REGS_BCM2835,      /* set/clear aliases, level register */
+    GPIO_REGS_BCM2712,      /* One data register, read-modify-write */
+    GPIO_REGS_RP1,          /* set/clear aliases, synchronised input */
+    GPIO_REGS_MAX           /* No direct access - use the functions below */
+} GPIO_REGS_TYPE_T;
+
+#define GPIO_REGS_MAX_BANKS 4
+
+typedef struct
+{
+    GPIO_REGS_TYPE_T type;
+    unsigned base;          /* The first GPIO number */
+    unsigned num_gpios;
+    unsigned num_banks;
+    volatile uint32_t *set[GPIO_REGS_MAX_BANKS];  /* Write 1s to drive high, or NULL */
+    volatile uint32_t *clr[GPIO_REGS_MAX_BANKS];  /* Write 1s to drive low, or NULL */
+    volatile uint32_t *out[GPIO_REGS_MAX_BANKS];  /* Output data, if set and clr are NULL */
+    volatile uint32_t *lev[GPIO_REGS_MAX_BANKS];  /* The levels observed */
+} GPIO_CHIP_REGS_T;
+
+/* The GPIO chip operations measured when gpiolib is built with GPIOLIB_STATS */
+typedef enum
+{
+    GPIO_OP_GET_FSEL,
+    GPIO_OP_SET_FSEL,
+    GPIO_OP_GET_DIR,
+    GPIO_OP_SET_DIR,
+    GPIO_OP_GET_LEVEL,
+    GPIO_OP_GET_DRIVE,
+    GPIO_OP_SET_DRIVE,
+    GPIO_OP_GET_PULL,
+    GPIO_OP_SET_PULL,
+    GPIO_OP_GET_LEVELS,
+    GPIO_OP_SET_DRIVES,
+    GPIO_OP_GET_PAD,
+    GPIO_OP_SET_PAD,
+    GPIO_OP_MAX
+} GPIO_OP_T;
+
+/* Bucket n of a latency histogram counts the calls taking less than
+ * GPIO_STATS_BUCKET_NS(n), and at least GPIO_STATS_BUCKET_NS(n - 1). The
+ * last bucket also counts all longer calls.
+ */
+#define GPIO_STATS_BUCKETS 16
+#define GPIO_STATS_BUCKET_NS(n) (64ULL << (n))
+
+typedef struct
+{
+    uint64_t calls;
+    uint64_t total_ns;      /* Time spent in the chip driver */
+    uint64_t max_ns;
+    uint64_t mmio_reads;
+    uint64_t mmio_writes;
+    uint64_t mbox_calls;    /* Firmware mailbox round trips */
+    uint64_t mbox_ns;       /* Time spent waiting for them */
+    uint64_t histogram[GPIO_STATS_BUCKETS];
+} GPIO_OP_STATS_T;
+
+typedef struct
+{
+    const char *name;       /* The chip driver, e.g. "rp1" */
+    unsigned base;          /* The first GPIO number */
+    unsigned num_gpios;
+    GPIO_OP_STATS_T ops[GPIO_OP_MAX];
+} GPIO_CHIP_STATS_T;
+
+typedef struct GPIOLIB_CTX_ GPIOLIB_CTX_T;
+
+/* Thread-safe, reference-counted initialisation: the first call runs
+ * gpiolib_init and gpiolib_mmap, and returns NULL if either fails.
+ */
+GPIOLIB_CTX_T *gpiolib_ctx_init(void);
+void gpiolib_ctx_free(GPIOLIB_CTX_T *ctx);
+
 int gpiolib_init(void);
 int gpiolib_init_by_name(const char *name);
 int gpiolib_mmap(void);
 void gpiolib_set_verbose(void (*callback)(const char *));
+void gpiolib_set_dt_path(const char *path);
+void gpiolib_set_cache_path(const char *path);
+
+/* Returns the number of chips, filling in up to max_chips entries */
+int gpiolib_get_chips(GPIO_CHIP_INFO_T *chips, unsigned max_chips);
+
+/* Returns the number of GPIO chip drivers built in, whether or not their
+ * chips are present, filling in up to max_names of their names (as used by
+ * gpiolib_init_by_name).
+ */
+int gpiolib_get_drivers(const char **names, unsigned max_names);
+
+/* Return the number of chips (filling in up to max_chips entries), or -1
+ * with errno ENOTSUP if gpiolib was built without GPIOLIB_STATS.
+ */
+int gpiolib_get_stats(GPIO_CHIP_STATS_T *stats, unsigned max_chips);
+void gpiolib_reset_stats(void);
+
+/* Describe the registers of the chip holding gpio, for callers (such as
+ * gpiolib.hpp) that drive and read GPIOs directly. Only meaningful after
+ * gpiolib_mmap. Returns 0, or -1 if gpio is invalid. The type is
+ * GPIO_REGS_MAX, with no registers, if the chip can't be accessed that way
+ * (e.g. simulated and firmware chips, or before gpiolib_mmap).
+ */
+int gpio_get_chip_regs(unsigned gpio, GPIO_CHIP_REGS_T *regs);
 
 int gpio_num_is_valid(unsigned gpio);
 GPIO_DIR_T gpio_get_dir(unsigned gpio);
@@ -72,14 +243,46 @@ GPIO_DRIVE_T gpio_get_drive(unsigned gpio);  /* What it is being driven as */
 GPIO_PULL_T gpio_get_pull(unsigned gpio);
 void gpio_set_pull(unsigned gpio, GPIO_PULL_T pull);
 
+int gpio_get_levels(unsigned first, unsigned count, uint64_t *levels);
+void gpio_set_mask(unsigned first, uint64_t mask);
+void gpio_clear_mask(unsigned first, uint64_t mask);
+
+int gpio_snapshot(GPIO_PIN_STATE_T *states, unsigned max_states);
+int gpio_restore(const GPIO_PIN_STATE_T *states, unsigned num_states);
+
+/* Apply the steps, which must be in time order, at their times. config
+ * may be NULL for the defaults (sleep until each step, with no change of
+ * CPU or priority), and result NULL if not wanted. Returns 0, or -1 with
+ * errno set - EINVAL (having changed nothing) if a step is invalid.
+ */
+int gpio_play(const GPIO_STEP_T *steps, unsigned num_steps,
+              const GPIO_PLAY_CONFIG_T *config, GPIO_PLAY_RESULT_T *result);
+
+int gpio_request_edges(const unsigned *gpios, unsigned num_gpios);
+int gpio_wait_edges(GPIO_EDGE_EVENT_T *events, unsigned max_events, int timeout_ms);
+void gpio_release_edges(void);
+
 void gpio_get_pin_range(unsigned *first, unsigned *last);
 unsigned gpio_for_pin(int pin);
 int gpio_to_pin(unsigned gpio);
 unsigned gpio_get_gpio_by_name(const char *name, int namelen);
 const char *gpio_get_name(unsigned gpio);
+/* Find the GPIOs offering alternate function pattern (ignoring case), which
+ * may contain the wildcards of fnmatch, e.g. "SPI0_*". Fills in up to
+ * max_funcs entries, in GPIO order, and returns the number of matches.
+ */
+int gpio_find_function(const char *pattern, GPIO_FUNCTION_T *funcs,
+                       unsigned max_funcs);
+
 const char *gpio_get_gpio_fsel_name(unsigned gpio, GPIO_FSEL_T fsel);
+int gpio_fsel_name_is_valid(const char *name);  /* Not NULL, "" or "-" */
 const char *gpio_get_fsel_name(GPIO_FSEL_T fsel);
 const char *gpio_get_pull_name(GPIO_PULL_T pull);
 const char *gpio_get_drive_name(GPIO_DRIVE_T drive);
+const char *gpio_get_op_name(GPIO_OP_T op);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
@@ -0,0 +1,221 @@
+#ifndef GPIOLIB_HPP
+#define GPIOLIB_HPP
+
+/* Compile-time GPIO access for C++17 code.
+ *
+ * GPIOs are template parameters, so each access compiles to a single
+ * volatile load or store of a precomputed mask (a read-modify-write on
+ * bcm2712), with no dispatch through the chip drivers and no run-time
+ * checks. The register layout of the chip is a template parameter too,
+ * chosen once at run time by with_chip:
+ *
+ *     gpiolib_init();
+ *     gpiolib_mmap();
+ *     gpiolib::with_chip(0, [](auto family, const GPIO_CHIP_REGS_T &regs)
+ *     {
+ *         gpiolib::Pin<decltype(family)::value, 17> led(regs);
+ *         gpiolib::Pins<decltype(family)::value, 22, 23, 24> bus(regs);
+ *
+ *         if (!led.valid() || !bus.valid())
+ *             return;
+ *         led.set();
+ *         bus.write(bus.read() ^ bus.mask);
+ *     });
+ *
+ * The lambda is instantiated for each family, but only one is called. GPIO
+ * numbers are relative to the chip holding the GPIO passed to with_chip,
+ * which for the first chip are the gpiolib GPIO numbers.
+ *
+ * Chips without directly accessible registers (simulated and firmware
+ * chips) get the generic family, which uses the gpiolib functions instead.
+ * GPIOs are not configured - set their functions with gpio_set_fsel first.
+ * On bcm2712 the read-modify-write is not locked against other threads
+ * changing outputs in the same bank.
+ */
+
+#include <cstdint>
+#include <type_traits>
+
+#include "gpiolib.h"
+
+namespace gpiolib
+{
+
+enum class Family
+{
+    bcm2835 = GPIO_REGS_BCM2835,
+    bcm2712 = GPIO_REGS_BCM2712,
+    rp1 = GPIO_REGS_RP1,
+    generic = GPIO_REGS_MAX,
+};
+
+/* Where each GPIO of a chip lives in its banks of registers */
+template <Family F>
+struct Layout
+{
+    static constexpr unsigned bank(unsigned gpio) { return gpio / 32; }
+    static constexpr unsigned first(unsigned bank) { return bank * 32; }
+    static constexpr unsigned bit(unsigned gpio) { return gpio % 32; }
+};
+
+template <>
+struct Layout<Family::rp1>
+{
+    static constexpr unsigned bank(unsigned gpio) { return (gpio < 28) ? 0 : (gpio < 34) ? 1 : 2; }
+    static constexpr unsigned first(unsigned bank) { return (bank == 0) ? 0 : (bank == 1) ? 28 : 34; }
+    static constexpr unsigned bit(unsigned gpio) { return gpio - first(bank(gpio)); }
+};
+
+/* A group of GPIOs in the same bank, accessed together */
+template <Family F, unsigned First, unsigned... Others>
+class Pins
+{
+public:
+    static constexpr unsigned bank = Layout<F>::bank(First);
+    static constexpr uint32_t mask = (1U << Layout<F>::bit(First)) |
+                                     (0U | ... | (1U << Layout<F>::bit(Others)));
+
+    static_assert(((Layout<F>::bank(Others) == bank) && ...),
+                  "The GPIOs of a group must be in the same bank");
+    static_assert(bank < GPIO_REGS_MAX_BANKS, "GPIO out of range");
+
+    explicit Pins(const GPIO_CHIP_REGS_T &regs) :
+        set_(regs.set[bank]),
+        clr_(regs.clr[bank]),
+        out_(regs.out[bank]),
+        lev_(regs.lev[bank]),
+        first_gpio_(regs.base + Layout<F>::first(bank)),
+        valid_(static_cast<Family>(regs.type) == F && last() < regs.num_gpios)
+    {
+        if constexpr (F == Family::bcm2712)
+            valid_ = valid_ && out_ && lev_;
+        else if constexpr (F != Family::generic)
+            valid_ = valid_ && set_ && clr_ && lev_;
+    }
+
+    /* Whether regs describe a chip of family F with all of these GPIOs */
+    bool valid() const { return valid_; }
+
+    void set() const
+    {
+        if constexpr (F == Family::generic)
+            gpio_set_mask(first_gpio_, mask);
+        else if constexpr (F == Family::bcm2712)
+            *out_ = *out_ | mask;
+        else
+            *set_ = mask;
+    }
+
+    void clear() const
+    {
+        if constexpr (F == Family::generic)
+            gpio_clear_mask(first_gpio_, mask);
+        else if constexpr (F == Family::bcm2712)
+            *out_ = *out_ & ~mask;
+        else
+            *clr_ = mask;
+    }
+
+    /* Drive the GPIOs to the corresponding bits of a bank-wide value */
+    void write(uint32_t bits) const
+    {
+        if constexpr (F == Family::generic)
+        {
+            gpio_set_mask(first_gpio_, bits & mask);
+            gpio_clear_mask(first_gpio_, ~bits & mask);
+        }
+        else if constexpr (F == Family::bcm2712)
+        {
+            *out_ = (*out_ & ~mask) | (bits & mask);
+        }
+        else
+        {
+            *set_ = bits & mask;
+            *clr_ = ~bits & mask;
+        }
+    }
+
+    /* The levels of the GPIOs, in their bank-wide bit positions */
+    uint32_t read() const
+    {
+        if constexpr (F == Family::generic)
+        {
+            uint64_t levels;
+
+            gpio_get_levels(first_gpio_, 32, &levels);
+            return static_cast<uint32_t>(levels) & mask;
+        }
+        else
+        {
+            return *lev_ & mask;
+        }
+    }
+
+private:
+    static constexpr unsigned last()
+    {
+        unsigned gpio = First;
+
+        ((gpio = (Others > gpio) ? Others : gpio), ...);
+        return gpio;
+    }
+
+    volatile uint32_t *set_;
+    volatile uint32_t *clr_;
+    volatile uint32_t *out_;
+    volatile uint32_t *lev_;
+    unsigned first_gpio_;
+    bool valid_;
+};
+
+/* A single GPIO */
+template <Family F, unsigned Gpio>
+class Pin : public Pins<F, Gpio>
+{
+public:
+    using Pins<F, Gpio>::Pins;
+
+    void write(bool high) const
+    {
+        if (high)
+            this->set();
+        else
+            this->clear();
+    }
+
+    bool read() const { return Pins<F, Gpio>::read() != 0; }
+};
+
+/* Describe the chip holding gpio and call fn(family, regs) with the family
+ * as a std::integral_constant, so that fn can instantiate Pin and Pins for
+ * it. Returns 0, or -1 if gpio is invalid.
+ */
+template <typename Fn>
+int with_chip(unsigned gpio, Fn &&fn)
+{
+    GPIO_CHIP_REGS_T regs;
+
+    if (gpio_get_chip_regs(gpio, &regs) != 0)
+        return -1;
+
+    switch (regs.type)
+    {
+    case GPIO_REGS_BCM2835:
+        fn(std::integral_constant<Family, Family::bcm2835>(), regs);
+        break;
+    case GPIO_REGS_BCM2712:
+        fn(std::integral_constant<Family, Family::bcm2712>(), regs);
+        break;
+    case GPIO_REGS_RP1:
+        fn(std::integral_constant<Family, Family::rp1>(), regs);
+        break;
+    default:
+        fn(std::integral_constant<Family, Family::generic>(), regs);
+        break;
+    }
+    return 0;
+}
+
+} // namespace gpiolib
+
+#endif
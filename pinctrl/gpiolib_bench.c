@@ -0,0 +1,312 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gpiolib.h"
+#include "util.h"
+
+#define BENCH_MAX_CHIPS 8
+#define BENCH_DEFAULT_ITERATIONS 100000
+#define BENCH_DEFAULT_BATCH 16
+#define BENCH_WARMUP 1000
+
+typedef enum
+{
+    BENCH_GET_LEVEL,
+    BENCH_GET_LEVELS,
+    BENCH_SET_DRIVE,
+    BENCH_SET_MASK,
+    BENCH_SET_FSEL,
+    BENCH_MAX
+} BENCH_TEST_T;
+
+typedef struct
+{
+    const char *name;
+    int writes;             /* Changes the GPIO, so only run where allowed */
+} BENCH_TEST_INFO_T;
+
+typedef struct
+{
+    unsigned gpio;          /* The GPIO exercised by the single-GPIO tests */
+    unsigned first;         /* The GPIOs read by the bulk test */
+    unsigned count;
+} BENCH_TARGET_T;
+
+static const BENCH_TEST_INFO_T bench_tests[BENCH_MAX] =
+{
+    [BENCH_GET_LEVEL] = { "get_level", 0 },
+    [BENCH_GET_LEVELS] = { "get_levels", 0 },
+    [BENCH_SET_DRIVE] = { "set_drive", 1 },
+    [BENCH_SET_MASK] = { "set/clear_mask", 1 },
+    [BENCH_SET_FSEL] = { "set_fsel", 1 },
+};
+
+static unsigned iterations = BENCH_DEFAULT_ITERATIONS;
+static unsigned batch = BENCH_DEFAULT_BATCH;
+
+static void usage(void)
+{
+    printf("Use: gpiolib-bench [-n <iterations>] [-b <batch>] [-g <GPIO>[,<GPIO>...]]\n");
+    printf("                   [--dtpath <dir>] [--sim]\n");
+    printf("\n");
+    printf("Measures the rate of gpiolib operations on each discovered GPIO chip, using\n");
+    printf("the single-GPIO and bulk APIs, and the spread of their latencies. Each\n");
+    printf("latency sample is the mean of <batch> (default %u) consecutive operations -\n", BENCH_DEFAULT_BATCH);
+    printf("use -b 1 to see the jitter of individual operations, at the cost of timing\n");
+    printf("overhead. Each test runs <iterations> (default %u) operations.\n", BENCH_DEFAULT_ITERATIONS);
+    printf("\n");
+    printf("The tests that drive GPIOs or change their functions are only run on\n");
+    printf("simulated chips, and on GPIOs named with -g, which are otherwise left alone.\n");
+    printf("All GPIOs are returned to their original state afterwards.\n");
+    printf("\n");
+    printf("With --sim, or if no GPIO chips are found, a simulated bcm2711 in ordinary\n");
+    printf("memory is used, which measures gpiolib's own overheads. --dtpath reads the\n");
+    printf("Device Tree from <dir>, e.g. to use other simulated chips (see gpiolib.md).\n");
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void bench_op(BENCH_TEST_T test, const BENCH_TARGET_T *target, unsigned i)
+{
+    uint64_t levels;
+
+    switch (test)
+    {
+    case BENCH_GET_LEVEL:
+        gpio_get_level(target->gpio);
+        break;
+    case BENCH_GET_LEVELS:
+        gpio_get_levels(target->first, target->count, &levels);
+        break;
+    case BENCH_SET_DRIVE:
+        gpio_set_drive(target->gpio, (i & 1) ? DRIVE_LOW : DRIVE_HIGH);
+        break;
+    case BENCH_SET_MASK:
+        if (i & 1)
+            gpio_clear_mask(target->gpio, 1);
+        else
+            gpio_set_mask(target->gpio, 1);
+        break;
+    case BENCH_SET_FSEL:
+        gpio_set_fsel(target->gpio, (i & 1) ? GPIO_FSEL_INPUT : GPIO_FSEL_OUTPUT);
+        break;
+    default:
+        break;
+    }
+}
+
+static void bench_run(BENCH_TEST_T test, const BENCH_TARGET_T *target,
+                      uint32_t *samples, unsigned num_samples)
+{
+    uint64_t total_ns = 0;
+    unsigned i = 0;
+    unsigned s, j;
+
+    // Warm up the caches and branch predictors
+    for (j = 0; j < BENCH_WARMUP; j++)
+        bench_op(test, target, i++);
+
+    for (s = 0; s < num_samples; s++)
+    {
+        uint64_t start = get_time_ns(CLOCK_MONOTONIC);
+        uint64_t ns;
+
+        for (j = 0; j < batch; j++)
+            bench_op(test, target, i++);
+        ns = get_time_ns(CLOCK_MONOTONIC) - start;
+        total_ns += ns;
+        ns /= batch;
+        samples[s] = (ns > UINT32_MAX) ? UINT32_MAX : (uint32_t)ns;
+    }
+
+    qsort(samples, num_samples, sizeof(*samples), bench_compare);
+    printf("  %-15s %12.0f %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32 "\n",
+           bench_tests[test].name,
+           total_ns ? (double)num_samples * batch * 1e9 / total_ns : 0.0,
+           samples[num_samples / 2],
+           samples[(uint64_t)num_samples * 99 / 100],
+           samples[(uint64_t)num_samples * 999 / 1000],
+           samples[num_samples - 1]);
+}
+
+static void bench_chip(const GPIO_CHIP_INFO_T *chip, const uint8_t *named,
+                       uint32_t *samples, unsigned num_samples)
+{
+    BENCH_TARGET_T target;
+    int simulated = !strcmp(chip->name, "sim");
+    int writable = simulated;
+    unsigned gpio;
+    int test;
+
+    target.gpio = GPIO_INVALID;
+    for (gpio = chip->base; gpio < chip->base + chip->num_gpios; gpio++)
+    {
+        if (named[gpio])
+        {
+            target.gpio = gpio;
+            writable = 1;
+            break;
+        }
+        if (target.gpio == GPIO_INVALID && gpio_num_is_valid(gpio))
+            target.gpio = gpio;
+    }
+    if (target.gpio == GPIO_INVALID)
+        return;
+
+    target.first = chip->base;
+    target.count = (chip->num_gpios < 64) ? chip->num_gpios : 64;
+
+    printf("%s (GPIOs %u-%u), using GPIO %u%s:\n", chip->name, chip->base,
+           chip->base + chip->num_gpios - 1, target.gpio,
+           writable ? "" : " (read only - name a GPIO with -g to write)");
+    printf("  %-15s %12s %8s %8s %8s %8s\n", "test", "ops/s",
+           "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+
+    for (test = 0; test < BENCH_MAX; test++)
+    {
+        if (bench_tests[test].writes && !writable)
+            continue;
+        if (test == BENCH_SET_DRIVE || test == BENCH_SET_MASK)
+            gpio_set_fsel(target.gpio, GPIO_FSEL_OUTPUT);
+        bench_run(test, &target, samples, num_samples);
+    }
+}
+
+static int parse_gpios(char *list, uint8_t *named)
+{
+    char *tok, *saveptr;
+
+    for (tok = strtok_r(list, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr))
+    {
+        char *end;
+        unsigned long gpio = strtoul(tok, &end, 10);
+
+        if (end == tok || *end || gpio >= MAX_GPIO_PINS)
+        {
+            printf("Invalid GPIO '%s'\n", tok);
+            return -1;
+        }
+        named[gpio] = 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    GPIO_CHIP_INFO_T chips[BENCH_MAX_CHIPS];
+    GPIO_PIN_STATE_T *states;
+    uint8_t named[MAX_GPIO_PINS] = { 0 };
+    uint32_t *samples;
+    unsigned num_samples;
+    int sim = 0;
+    int num_chips, num_states;
+    int ret, i;
+
+    for (i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+
+        if (!strcmp(arg, "--sim"))
+        {
+            sim = 1;
+        }
+        else if (!strcmp(arg, "-h") || !strcmp(arg, "--help"))
+        {
+            usage();
+            return 0;
+        }
+        else if (i + 1 >= argc)
+        {
+            printf("Unknown option '%s' - try \"gpiolib-bench -h\"\n", arg);
+            return 1;
+        }
+        else if (!strcmp(arg, "--dtpath"))
+        {
+            gpiolib_set_dt_path(argv[++i]);
+        }
+        else if (!strcmp(arg, "-g"))
+        {
+            if (parse_gpios(argv[++i], named))
+                return 1;
+        }
+        else if (!strcmp(arg, "-n") || !strcmp(arg, "-b"))
+        {
+            char *end;
+            unsigned long num = strtoul(argv[++i], &end, 10);
+
+            if (*end || !num || num > 100000000)
+            {
+                printf("Invalid number '%s' for %s\n", argv[i], arg);
+                return 1;
+            }
+            if (arg[1] == 'n')
+                iterations = num;
+            else
+                batch = num;
+        }
+        else
+        {
+            printf("Unknown option '%s' - try \"gpiolib-bench -h\"\n", arg);
+            return 1;
+        }
+    }
+
+    ret = sim ? 0 : gpiolib_init();
+    if (ret < 0)
+    {
+        printf("Failed to initialise gpiolib - %d\n", ret);
+        return 1;
+    }
+    if (!ret)
+    {
+        if (!sim)
+            printf("No GPIO chips found - using a simulated bcm2711\n");
+        ret = gpiolib_init_by_name("sim");
+        if (ret <= 0)
+        {
+            printf("Failed to create a simulated GPIO chip\n");
+            return 1;
+        }
+    }
+
+    ret = gpiolib_mmap();
+    if (ret)
+    {
+        printf("Failed to mmap gpiolib - %s\n", strerror(ret));
+        return 1;
+    }
+
+    num_samples = (iterations + batch - 1) / batch;
+    samples = calloc(num_samples, sizeof(*samples));
+    num_states = gpio_snapshot(NULL, 0);
+    states = calloc(num_states ? num_states : 1, sizeof(*states));
+    if (!samples || !states)
+        return 1;
+    num_states = gpio_snapshot(states, num_states);
+
+    num_chips = gpiolib_get_chips(chips, BENCH_MAX_CHIPS);
+    if (num_chips > BENCH_MAX_CHIPS)
+        num_chips = BENCH_MAX_CHIPS;
+    for (i = 0; i < num_chips; i++)
+    {
+        if (chips[i].num_gpios)
+            bench_chip(&chips[i], named, samples, num_samples);
+    }
+
+    gpio_restore(states, num_states);
+
+    free(states);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <cstdio>
+#include <cstring>
+
+#include "gpiolib.hpp"
+
+/* An example of gpiolib.hpp, which also keeps it building with warnings
+ * enabled. It reports GPIOs 22-24 of the first GPIO chip and, only on a
+ * simulated chip, toggles GPIO 17 and reads it back.
+ */
+
+#define EXAMPLE_LED 17
+
+static const char *family_name(gpiolib::Family family)
+{
+    switch (family)
+    {
+    case gpiolib::Family::bcm2835: return "bcm2835";
+    case gpiolib::Family::bcm2712: return "bcm2712";
+    case gpiolib::Family::rp1: return "rp1";
+    default: return "generic";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int sim = 0;
+    int ret;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--sim"))
+        {
+            sim = 1;
+        }
+        else if (!strcmp(argv[i], "--dtpath") && i + 1 < argc)
+        {
+            gpiolib_set_dt_path(argv[++i]);
+        }
+        else
+        {
+            printf("Use: gpiolib-example [--dtpath <dir>] [--sim]\n");
+            return 1;
+        }
+    }
+
+    ret = sim ? 0 : gpiolib_init();
+    if (ret < 0)
+    {
+        printf("Failed to initialise gpiolib - %d\n", ret);
+        return 1;
+    }
+    if (!ret)
+    {
+        sim = 1;
+        if (gpiolib_init_by_name("sim") <= 0)
+        {
+            printf("Failed to create a simulated GPIO chip\n");
+            return 1;
+        }
+    }
+
+    ret = gpiolib_mmap();
+    if (ret)
+    {
+        printf("Failed to mmap gpiolib - %s\n", strerror(ret));
+        return 1;
+    }
+
+    ret = gpiolib::with_chip(0, [sim](auto family, const GPIO_CHIP_REGS_T &regs)
+    {
+        constexpr gpiolib::Family F = decltype(family)::value;
+        gpiolib::Pins<F, 22, 23, 24> bus(regs);
+        gpiolib::Pin<F, EXAMPLE_LED> led(regs);
+
+        printf("Chip family %s, %u GPIOs from %u\n", family_name(F),
+               regs.num_gpios, regs.base);
+        if (bus.valid())
+            printf("GPIOs 22-24: %x\n", bus.read() >> 22);
+
+        // Real GPIOs are left alone, as something may be connected to them
+        if (!sim || !led.valid())
+            return;
+
+        gpio_set_fsel(regs.base + EXAMPLE_LED, GPIO_FSEL_OUTPUT);
+        led.write(true);
+        printf("GPIO %d set: %d\n", EXAMPLE_LED, led.read());
+        led.write(false);
+        printf("GPIO %d cleared: %d\n", EXAMPLE_LED, led.read());
+    });
+    if (ret)
+    {
+        printf("No GPIO 0\n");
+        return 1;
+    }
+
+    return 0;
+}
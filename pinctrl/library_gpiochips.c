@@ -15,6 +15,7 @@ EXTERN_GPIO_CHIP(bcm2712d0_aon);
 EXTERN_GPIO_CHIP(brcmstb);
 EXTERN_GPIO_CHIP(rp1);
 EXTERN_GPIO_CHIP(firmware);
+EXTERN_GPIO_CHIP(sim);
 
 const GPIO_CHIP_T *const library_gpiochips[] =
 {
@@ -29,6 +30,7 @@ const GPIO_CHIP_T *const library_gpiochips[] =
     &GPIO_CHIP(brcmstb),
     &GPIO_CHIP(rp1),
     &GPIO_CHIP(firmware),
+    &GPIO_CHIP(sim),
 };
 
 const int library_gpiochips_count = ARRAY_SIZE(library_gpiochips);
@@ -10,6 +10,10 @@ _pinctrl ()
         if [[ "$arg" == "-c" ]]; then
             chip=${COMP_WORDS[$((i + 1))]}
             i=$((i + 2))
+        elif [[ "$arg" == "-f" ]]; then
+            i=$((i + 2))
+        elif [[ "$arg" =~ ^--(output|format|rate|cpu|priority|spin|dtpath|socket|group|export-tables)$ ]]; then
+            i=$((i + 2))
         else
             if [[ "$arg" == "-p" ]]; then
                 pinmode=true
@@ -18,6 +22,17 @@ _pinctrl ()
         fi
     done
 
+    if [[ $i -lt $cword && ${COMP_WORDS[$i]} =~ ^(save|restore|play)$ ]]; then
+        if [[ $((i + 1)) -eq $cword ]]; then
+            _filedir
+        fi
+        return
+    fi
+
+    if [[ $i -lt $cword && ${COMP_WORDS[$i]} == "find" ]]; then
+        return
+    fi
+
     if [[ $i -lt $cword && ${COMP_WORDS[$i]} =~ ^(get|set|funcs|poll|help) ]]; then
         cmd=${COMP_WORDS[$i]}
         i=$((i + 1))
@@ -65,16 +80,26 @@ _pinctrl ()
             COMPREPLY+=($(compgen -W "$opts" -- $cur))
         fi
     else
-        if [[ "$prev" == "-c" ]]; then
+        if [[ "$prev" == "--format" ]]; then
+            COMPREPLY+=($(compgen -W "text vcd bin" -- $cur))
+        elif [[ "$prev" == "--output" || "$prev" == "-f" || "$prev" == "--socket" || "$prev" == "--export-tables" ]]; then
+            _filedir
+        elif [[ "$prev" == "--dtpath" ]]; then
+            _filedir -d
+        elif [[ "$prev" == "--group" ]]; then
+            COMPREPLY+=($(compgen -g -- $cur))
+        elif [[ "$prev" =~ ^--(rate|cpu|priority|spin)$ ]]; then
+            :
+        elif [[ "$prev" == "-c" ]]; then
             CHIPS=($(pinctrl -v -p 0 | grep 'gpios)' | cut -d' ' -f4 | sort | uniq))
             chips="${CHIPS[@]}"
             COMPREPLY+=($(compgen -W "$chips" -- $cur))
         elif [[ "$cur" =~ ^- ]]; then
-            COMPREPLY+=($(compgen -W "-p -h -v -c" -- $cur))
+            COMPREPLY+=($(compgen -W "-p -h -v -c -f --output --format --rate --cpu --priority --spin --events --deltas --dtpath --cache --serve --socket --group --stats --export-tables" -- $cur))
         elif [[ "$chip" == "" ]]; then
-            COMPREPLY+=($(compgen -W "get set poll funcs help" -- $cur))
+            COMPREPLY+=($(compgen -W "get set poll funcs find save restore play help" -- $cur))
         else
-            COMPREPLY+=($(compgen -W "funcs help" -- $cur))
+            COMPREPLY+=($(compgen -W "funcs find help" -- $cur))
         fi
     fi
 }
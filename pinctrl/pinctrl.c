@@ -1,32 +1,40 @@
 #define _GNU_SOURCE
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <inttypes.h>
-#include <sys/time.h>
+#include <sys/mman.h>
 
+#include "capture.h"
 #include "gpiolib.h"
+#include "pinctrl_client.h"
+#include "server.h"
+#include "tables.h"
 
 #define ARRAY_SIZE(_a) (sizeof(_a)/sizeof(_a[0]))
 
+#define MAX_SCRIPT_ARGS 64
+
 const char *program_name = "pinctrl";
 
 static int pin_mode = 0;
 static int verbose_mode = 0;
+static int echo_mode = 0;
+static int stats_mode = 0;
 static unsigned num_gpios;
+static const char *named_chip = NULL;
+static unsigned start_pin = GPIO_INVALID, end_pin;
+static unsigned play_spin_us;
 
-struct poll_gpio_state {
-    unsigned int num;
-    unsigned int gpio;
-    const char *name;
-    int level;
-};
-
-int num_poll_gpios;
-struct poll_gpio_state *poll_gpios;
+static unsigned num_poll_gpios;
+static CAPTURE_GPIO_T *poll_gpios;
+static CAPTURE_CONFIG_T capture_config = { .cpu = -1 };
+static SERVER_CONFIG_T server_config;
 
 static void print_gpio_alts_info(unsigned gpio)
 {
@@ -76,7 +84,7 @@ static void usage(void)
     printf("OR\n");
     printf("  %s [-p] [-v] [-e] set <GPIO> [options]\n", name);
     printf("OR\n");
-    printf("  %s [-p] [-v] poll <GPIO>\n", name);
+    printf("  %s [-p] [-v] [poll options] poll <GPIO>\n", name);
     printf("OR\n");
     printf("  %s [-p] [-v] funcs [GPIO]\n", name);
     printf("OR\n");
@@ -84,7 +92,19 @@ static void usage(void)
     printf("OR\n");
     printf("  %s -c <chip> [funcs] [GPIO]\n", name);
     printf("OR\n");
+    printf("  %s [-p] [-c <chip>] find <function>\n", name);
+    printf("OR\n");
     printf("  %s -l\n", name);
+    printf("OR\n");
+    printf("  %s [--dtpath <dir>] --export-tables <file>\n", name);
+    printf("OR\n");
+    printf("  %s save|restore <file>\n", name);
+    printf("OR\n");
+    printf("  %s [-p] [--cpu <n>] [--priority <n>] [--spin <n>] play <file>\n", name);
+    printf("OR\n");
+    printf("  %s [-p] [-v] [-e] -f <script>\n", name);
+    printf("OR\n");
+    printf("  %s [-v] [--socket <path>] [--group <name>] [--rate <n>] --serve\n", name);
     printf("\n");
     printf("GPIO is a comma-separated list of GPIO names, numbers or ranges (without\n");
     printf("spaces), e.g. 4 or 18-21 or BT_ON,9-11\n");
@@ -98,6 +118,50 @@ static void usage(void)
     printf("The -c option allows the alt functions (and only the alt function) for a named\n");
     printf("chip to be displayed, even if that chip is not present in the current system.\n");
     printf("The -l option lists the discovered chips.\n");
+    printf("The --export-tables option writes the GPIO and alt function names of every\n");
+    printf("chip %s supports, and the 40-way header pins of this board, to <file>\n", name);
+    printf("in the binary format described in pinctrl_tables.h.\n");
+    printf("%s find lists the GPIOs and alt functions providing <function>, which\n", name);
+    printf("may contain the wildcards * ? and [...], ignoring case - e.g. \"SPI0_*\".\n");
+    printf("%s save writes the function, pull and drive of every GPIO to <file>,\n", name);
+    printf("and %s restore puts them back, changing only what differs.\n", name);
+    printf("%s play drives GPIOs at the times given in <file>, one step per line:\n", name);
+    printf("a time in microseconds (or \"+<n>\" after the previous step) followed by\n");
+    printf("GPIOs and dh or dl, e.g. \"+2.5 4,17-19 dh 5 dl\". It sleeps until each\n");
+    printf("step, busy-waiting for the last --spin microseconds, optionally on --cpu\n");
+    printf("<n> at SCHED_FIFO --priority <n>, and reports the timing errors.\n");
+    printf("The -f option runs the commands in <script> (or stdin if <script> is \"-\"),\n");
+    printf("one per line, without the startup cost of running %s for each of them.\n", name);
+    printf("Each line is written as on the command line, without the \"%s\" - e.g.\n", name);
+    printf("\"set 10 op dh\" - and # starts a comment. \"wait <n>\" pauses for <n>\n");
+    printf("microseconds. poll is not supported, and the script stops at the first error.\n");
+    printf("The --serve option runs %s as a server, keeping the GPIOs mapped and\n", name);
+    printf("accepting requests on a Unix domain socket (%s unless --socket\n", PINCTRL_SOCKET_PATH);
+    printf("<path> is given) - see pinctrl_client.h. The socket can be used by the\n");
+    printf("--group <name> group (default \"%s\", if it exists). Changes to\n", SERVER_DEFAULT_GROUP);
+    printf("subscribed GPIOs are sampled --rate times a second (default 1000), and a\n");
+    printf("client that doesn't read its replies is disconnected.\n");
+    printf("The --dtpath <dir> option reads the Device Tree from <dir> instead of the\n");
+    printf("running system, e.g. to use simulated GPIO chips (see gpiolib.md).\n");
+    printf("The --stats option prints, after running the command, how often and for\n");
+    printf("how long each GPIO chip operation ran (if gpiolib was built with ENABLE_STATS).\n");
+    printf("The --cache option saves the results of GPIO chip discovery in\n");
+    printf("%s and reuses them until the next reboot, for faster startup.\n", GPIOLIB_CACHE_PATH);
+    printf("\n");
+    printf("Valid [poll options] are:\n");
+    printf("  --output <file>    write the capture to <file> instead of stdout\n");
+    printf("  --format <fmt>     text (the default), vcd (Value Change Dump) or bin\n");
+    printf("                     (compact binary - see capture.h)\n");
+    printf("  --rate <n>         sample at <n> Hz, rather than as fast as possible\n");
+    printf("  --cpu <n>          run the sampler on CPU <n>\n");
+    printf("  --priority <n>     run the sampler with SCHED_FIFO priority <n>\n");
+    printf("  --events           wait for edge events from the kernel (GPIO character\n");
+    printf("                     device) instead of sampling\n");
+    printf("  --deltas           write only the GPIOs that changed, and how many samples\n");
+    printf("                     were unchanged before them - one line per change with\n");
+    printf("                     text (and a count of changes per GPIO at the end), or\n");
+    printf("                     a compact delta log with bin (see capture.h)\n");
+    printf("Polling continues until interrupted (e.g. with Ctrl-C).\n");
     printf("\n");
     printf("Valid [options] for %s set are:\n", name);
     printf("  ip      set GPIO as input\n");
@@ -122,7 +186,9 @@ static void usage(void)
     printf("  %s set 35 a1 pu     Set GPIO35 to fsel 1 (jtag_2_clk) with pull up\n", name);
     printf("  %s set 20 op pn dh  Set GPIO20 to output with no pull and driving high\n", name);
     printf("  %s lev 4            Prints the level (1 or 0) of GPIO4\n", name);
+    printf("  %s --output spi.vcd poll 8-11  Capture the SPI0 signals as a VCD file\n", name);
     printf("  %s -c bcm2835 9-11  Display the alt functions for GPIOs 9-11 on bcm2835\n", name);
+    printf("  %s find 'TXD*'      Show which GPIOs and alt functions provide UART TXDs\n", name);
     printf("  %s -l               List the compatible detected GPIO chips\n", name);
 }
 
@@ -261,7 +327,7 @@ static int do_gpio_level(unsigned int gpio)
 
 static int do_gpio_poll_add(unsigned int gpio)
 {
-    struct poll_gpio_state *new_gpio;
+    CAPTURE_GPIO_T *new_gpio;
     unsigned int num = gpio;
 
     if (pin_mode)
@@ -276,52 +342,18 @@ static int do_gpio_poll_add(unsigned int gpio)
     new_gpio->num = num;
     new_gpio->gpio = gpio;
     new_gpio->name = gpio_get_name(gpio);
-    new_gpio->level = -1; /* Unknown */
     num_poll_gpios++;
 
     return 0;
 }
 
-static void do_gpio_poll(void)
+static int do_gpio_poll(void)
 {
-    unsigned int idle_count = 0;
-    struct timeval idle_start;
-    int i;
+    if (!num_poll_gpios)
+        return 0;
 
-    while (num_poll_gpios)
-    {
-        int changed = 0;
-        for (i = 0; i < num_poll_gpios; i++)
-        {
-            struct poll_gpio_state *state = &poll_gpios[i];
-            int level = gpio_get_level(state->gpio);
-            if (level != state->level)
-            {
-                if (idle_count)
-                {
-                    struct timeval now;
-                    uint64_t interval_us;
-
-                    gettimeofday(&now, NULL);
-                    interval_us =
-                        (uint64_t)(now.tv_sec - idle_start.tv_sec) * 1000000 +
-                        (now.tv_usec - idle_start.tv_usec);
-                    printf("+%" PRIu64 "us\n", interval_us);
-                    idle_count = 0;
-                }
-                printf("%2d: %s // %s\n", state->num, level ? "hi" : "lo", state->name);
-                state->level = level;
-                changed = 1;
-                fflush(stdout);
-            }
-        }
-        if (!changed)
-        {
-            if (!idle_count)
-                gettimeofday(&idle_start, NULL);
-            idle_count++;
-        }
-    }
+    capture_config.verbose = verbose_mode;
+    return capture_run(&capture_config, poll_gpios, num_poll_gpios) ? 1 : 0;
 }
 
 static void verbose_callback(const char *msg)
@@ -329,303 +361,631 @@ static void verbose_callback(const char *msg)
     printf("%s", msg);
 }
 
-int main(int argc, char *argv[])
+static int do_gpio_mmap(void)
 {
+    static int mapped = 0;
     int ret;
 
-    /* arg parsing */
-
-    const char *named_chip = NULL;
-
-    int set = 0;
-    int get = 0;
-    int level = 0;
-    int poll = 0;
-    int funcs = 0;
-    int echo = 0;
-    int list = 0;
-    int pull = PULL_MAX;
-    int infer_cmd = 0;
-    int fsparam = GPIO_FSEL_MAX;
-    int drive = DRIVE_MAX;
-    uint32_t gpiomask[(MAX_GPIO_PINS + 31)/32] = { 0 };
-    unsigned start_pin = GPIO_INVALID, end_pin, pin;
-    int first_pin = 1;
-    int i;
-
-    argv++;
-    argc--;
+    if (mapped)
+        return 0;
 
-    while (argc && (argv[0][0] == '-'))
+    ret = gpiolib_mmap();
+    if (ret)
     {
-        const char *arg = *(argv++);
-        argc--;
-
-        if (strcmp(arg, "-c") == 0)
-        {
-            if (!argc)
-            {
-                printf("* chip name expected - use 'pinctrl -h' for help\n");
-                return -1;
-            }
-            named_chip = *(argv++);
-            argc--;
-        }
-        else if (strcmp(arg, "-e") == 0)
-        {
-            echo = 1;
-        }
-        else if (strcmp(arg, "-h") == 0)
-        {
-            usage();
-            return 0;
-        }
-        else if (strcmp(arg, "-l") == 0)
-        {
-            list = 1;
-            verbose_mode = 1;
-        }
-        else if (strcmp(arg, "-p") == 0)
-        {
-            pin_mode = 1;
-        }
-        else if (strcmp(arg, "-v") == 0)
-        {
-            verbose_mode = 1;
-        }
+        if (ret == EACCES && geteuid())
+            printf("Must be root (or group 'gpio' on RPiOS)\n");
         else
-        {
-            printf("Unknown option '%s' - try \"%s help\"\n",
-                   arg, program_name);
-            exit(1);
-        }
+            printf("Failed to mmap gpiolib - %s\n", strerror(ret));
+        return -1;
     }
 
-    if (verbose_mode)
-        gpiolib_set_verbose(&verbose_callback);
+    mapped = 1;
+    return 0;
+}
 
-    if (named_chip)
-        ret = gpiolib_init_by_name(named_chip);
-    else
-        ret = gpiolib_init();
+static int do_wait(const char *arg)
+{
+    struct timespec ts;
+    unsigned long usecs;
+    char *end;
 
-    if (ret < 0)
+    usecs = strtoul(arg, &end, 10);
+    if (end == arg || *end)
     {
-        printf("Failed to initialise gpiolib - %d\n", ret);
-        return -1;
+        printf("Invalid wait \"%s\" - expected microseconds\n", arg);
+        return 1;
     }
 
-    num_gpios = ret;
-    if (!num_gpios)
-    {
-        printf("No GPIO chips found\n");
-        return -1;
-    }
+    // Let any output so far be seen before pausing
+    fflush(stdout);
 
-    if (argc)
-    {
-        const char *cmd = *(argv++);
-        argc--;
+    ts.tv_sec = usecs / 1000000;
+    ts.tv_nsec = (usecs % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        continue;
 
-        if (strcmp(cmd, "help") == 0)
-        {
-            usage();
-            return 0;
-        }
+    return 0;
+}
 
-        get = strcmp(cmd, "get") == 0;
-        set = strcmp(cmd, "set") == 0;
-        level = strcmp(cmd, "level") == 0 || strcmp(cmd, "lev") == 0;
-        poll = strcmp(cmd, "poll") == 0;
-        funcs = strcmp(cmd, "funcs") == 0;
+/* "pinctrl save" file format, in host byte order: a PINCTRL_SAVE_HEADER_T
+ * followed by num_states GPIO_PIN_STATE_Ts.
+ */
+#define PINCTRL_SAVE_MAGIC "PCTLSAVE"
+#define PINCTRL_SAVE_VERSION 2
 
-        if (!set && !get && !level && !poll && !funcs)
-        {
-            /* Back up in case we can decode this as a pin */
-            argv--;
-            argc++;
-            infer_cmd = 1;
-        }
-    }
-    else if (named_chip)
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_gpios;     /* Guards against restoring on a different system */
+    uint32_t num_states;
+} PINCTRL_SAVE_HEADER_T;
+
+static int do_gpio_save(const char *fname)
+{
+    PINCTRL_SAVE_HEADER_T hdr;
+    GPIO_PIN_STATE_T *states;
+    FILE *fp;
+    int count;
+    int ret = 1;
+
+    count = gpio_snapshot(NULL, 0);
+    states = calloc(count ? count : 1, sizeof(*states));
+    if (!states)
+        return 1;
+    count = gpio_snapshot(states, count);
+
+    memcpy(hdr.magic, PINCTRL_SAVE_MAGIC, sizeof(hdr.magic));
+    hdr.version = PINCTRL_SAVE_VERSION;
+    hdr.num_gpios = num_gpios;
+    hdr.num_states = count;
+
+    fp = fopen(fname, "wb");
+    if (!fp)
     {
-        funcs = 1;
+        printf("Failed to create '%s' - %s\n", fname, strerror(errno));
     }
     else
     {
-        get = 1;
+        if (fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+            fwrite(states, sizeof(*states), count, fp) == (size_t)count)
+            ret = 0;
+        if (fclose(fp) != 0)
+            ret = 1;
+        if (ret)
+            printf("Failed to write '%s'\n", fname);
     }
 
-    if (list)
-        return 0;
+    free(states);
+    return ret;
+}
 
-    if (pin_mode)
-    {
-       gpio_get_pin_range(&start_pin, &end_pin);
-       if (start_pin == GPIO_INVALID)
-       {
-           printf("No PIN numbers declared in DT - pin mode disabled\n");
-           pin_mode = 0;
-       }
-    }
+static int do_gpio_restore(const char *fname)
+{
+    PINCTRL_SAVE_HEADER_T hdr;
+    GPIO_PIN_STATE_T *states = NULL;
+    FILE *fp;
+    int ret = 1;
 
-    if (start_pin == GPIO_INVALID)
+    fp = fopen(fname, "rb");
+    if (!fp)
     {
-        start_pin = 0;
-        end_pin = num_gpios - 1;
+        printf("Failed to open '%s' - %s\n", fname, strerror(errno));
+        return 1;
     }
 
-    if (argc) /* expect pin number/name(s) next */
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        memcmp(hdr.magic, PINCTRL_SAVE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != PINCTRL_SAVE_VERSION)
+        printf("'%s' is not a pinctrl save file\n", fname);
+    else if (hdr.num_gpios != num_gpios || hdr.num_states > num_gpios)
+        printf("'%s' was saved on a different system\n", fname);
+    else if (!(states = calloc(hdr.num_states ? hdr.num_states : 1, sizeof(*states))) ||
+             fread(states, sizeof(*states), hdr.num_states, fp) != hdr.num_states)
+        printf("Failed to read '%s'\n", fname);
+    else if (gpio_restore(states, hdr.num_states) != 0)
+        printf("'%s' contains invalid GPIO states\n", fname);
+    else
+        ret = 0;
+
+    free(states);
+    fclose(fp);
+    return ret;
+}
+
+/* Marks the GPIOs (header pins in pin mode) in a comma-separated list of
+ * numbers, names and ranges in gpiomask. The list may continue in the
+ * arguments that follow if they start with a dash or comma, e.g. "4 -7 ,9".
+ * Returns the number of arguments used, or -1 if the list is invalid, with
+ * *bad pointing at the text that couldn't be parsed (or NULL if the problem
+ * has been reported).
+ */
+static int parse_gpio_list(int argc, char *argv[], uint32_t *gpiomask,
+                           const char **bad)
+{
+    char *p = argv[0];
+    int used = 1;
+    int ret;
+
+    while (p)
     {
-        char *p = *(argv++);
-        argc--;
+        unsigned gpio, gpio2;
+        int len, len2;
+        len = strcspn(p, "-,");
+        ret = sscanf(p, "%u%n", &gpio, &len2);
+        if (ret == 1 && len == len2 && gpio >= num_gpios)
+            break;
+        else if (ret != 1 || len != len2)
+        {
+            gpio = gpio_get_gpio_by_name(p, len);
+            if (gpio == GPIO_INVALID)
+                break;
+            if (pin_mode)
+            {
+                int pin = gpio_to_pin(gpio);
+                if (pin < 0)
+                {
+                    printf("Signal \"%*s\" is not on a header pin\n",
+                           len, p);
+                    *bad = NULL;
+                    return -1;
+                }
+                gpio = (unsigned)pin;
+            }
+        }
+        p += len;
 
-        while (p)
+        if (*p == '\0' && used < argc && (argv[used][0] == '-' || argv[used][0] == ','))
+            p = argv[used++];
+
+        if (*p == '-')
         {
-            unsigned gpio, gpio2;
-            int len, len2;
+            p++;
             len = strcspn(p, "-,");
-            ret = sscanf(p, "%u%n", &gpio, &len2);
-            if (ret == 1 && len == len2 && gpio >= num_gpios)
+            ret = sscanf(p, "%u%n", &gpio2, &len2);
+            if (ret == 1 && len == len2 && gpio2 >= num_gpios)
                 break;
             else if (ret != 1 || len != len2)
             {
-                gpio = gpio_get_gpio_by_name(p, len);
-                if (gpio == GPIO_INVALID)
+                gpio2 = gpio_get_gpio_by_name(p, len);
+                if (gpio2 == GPIO_INVALID)
                     break;
                 if (pin_mode)
                 {
-                    int pin = gpio_to_pin(gpio);
+                    int pin = gpio_to_pin(gpio2);
                     if (pin < 0)
                     {
                         printf("Signal \"%*s\" is not on a header pin\n",
                                len, p);
-                        return 1;
-                    }
-                    gpio = (unsigned)pin;
-                }
-            }
-            p += len;
-
-            if (*p == '\0' && argc && (argv[0][0] == '-' || argv[0][0] == ','))
-            {
-                p = *(argv++);
-                argc--;
-            }
-
-            if (*p == '-')
-            {
-                p++;
-                len = strcspn(p, "-,");
-                ret = sscanf(p, "%u%n", &gpio2, &len2);
-                if (ret == 1 && len == len2 && gpio2 >= num_gpios)
-                    break;
-                else if (ret != 1 || len != len2)
-                {
-                    gpio2 = gpio_get_gpio_by_name(p, len);
-                    if (gpio2 == GPIO_INVALID)
-                        break;
-                    if (pin_mode)
-                    {
-                        int pin = gpio_to_pin(gpio2);
-                        if (pin < 0)
-                        {
-                            printf("Signal \"%*s\" is not on a header pin\n",
-                                   len, p);
-                            return 1;
-                        }
-                        gpio2 = (unsigned)pin;
+                        *bad = NULL;
+                        return -1;
                     }
+                    gpio2 = (unsigned)pin;
                 }
-                if (gpio2 < gpio)
-                {
-                    int tmp = gpio2;
-                    gpio2 = gpio;
-                    gpio = tmp;
-                }
-                p += len;
             }
-            else
+            if (gpio2 < gpio)
             {
+                int tmp = gpio2;
                 gpio2 = gpio;
+                gpio = tmp;
             }
-            while (gpio <= gpio2)
-            {
-                gpiomask[gpio/32] |= (1 << (gpio % 32));
-                gpio++;
-            }
-            if (*p == '\0' && argc && argv[0][0] == ',')
-            {
-                p = *(argv++);
-                argc--;
-            }
-            if (*p == '\0')
-            {
-                p = NULL;
-            }
-            else
-            {
-                if (*p != ',')
-                    break;
-                p++;
-            }
+            p += len;
         }
-        if (p)
+        else
         {
-            if (infer_cmd && p == argv[-1])
-                printf("Unknown command \"%s\"\n", p);
-            else
-                printf("Unknown GPIO \"%s\"\n", p);
-            return 1;
+            gpio2 = gpio;
+        }
+        while (gpio <= gpio2)
+        {
+            gpiomask[gpio/32] |= (1 << (gpio % 32));
+            gpio++;
+        }
+        if (*p == '\0' && used < argc && argv[used][0] == ',')
+            p = argv[used++];
+        if (*p == '\0')
+        {
+            p = NULL;
+        }
+        else
+        {
+            if (*p != ',')
+                break;
+            p++;
         }
     }
-    else if (set)
-    {
-        printf("Need GPIO number to set\n");
-        return 1;
-    }
-    else if (poll)
+
+    if (p)
     {
-        printf("Need GPIO number to poll\n");
-        return 1;
+        *bad = p;
+        return -1;
     }
+    return used;
+}
 
-    if (set && !argc)
+/* Adds the GPIOs in a list, as accepted by parse_gpio_list, to gpiomask,
+ * returning 0, or -1 if the list is invalid.
+ */
+static int parse_play_gpios(char *list, uint32_t *gpiomask)
+{
+    uint32_t listmask[(MAX_GPIO_PINS + 31) / 32] = { 0 };
+    const char *bad;
+    unsigned num, gpio;
+
+    if (parse_gpio_list(1, &list, listmask, &bad) < 0)
     {
-        printf("Need a function or pull to set\n");
-        return 1;
+        if (bad)
+            printf("Unknown GPIO \"%s\"\n", bad);
+        return -1;
     }
 
-    if ((get || funcs) && argc)
+    // Skip any gaps in a range
+    for (num = 0; num < MAX_GPIO_PINS; num++)
     {
-        printf("Too many arguments\n");
-        return 1;
+        if (!(listmask[num / 32] & (1U << (num % 32))))
+            continue;
+        gpio = pin_mode ? gpio_for_pin(num) : num;
+        if (gpio_num_is_valid(gpio))
+            gpiomask[gpio / 32] |= 1U << (gpio % 32);
     }
+    return 0;
+}
 
-    if (infer_cmd)
+#define PLAY_MAX_US 1000000000000000ULL  /* About 31 years */
+
+/* Reads a "pinctrl play" file, in which each line is a time in microseconds
+ * (absolute, or after the previous line if it starts with '+') followed by
+ * pairs of GPIO list and dh/dl, e.g. "+2.5 4,17-19 dh 5 dl". Returns the
+ * number of steps, or -1 on error.
+ */
+static int read_play_file(const char *fname, GPIO_STEP_T **steps_ptr)
+{
+    GPIO_STEP_T *steps = NULL;
+    unsigned num_steps = 0, max_steps = 0;
+    uint64_t time_ns = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    unsigned line_num = 0;
+    FILE *fp;
+    int ret = 0;
+
+    fp = fopen(fname, "r");
+    if (!fp)
     {
-        if (named_chip)
-            funcs = 1;
-        else if (argc)
-            set = 1;
-        else
-            get = 1;
+        printf("Failed to open \"%s\" - %s\n", fname, strerror(errno));
+        return -1;
     }
 
-    /* parse remaining args */
-    while (argc)
+    while (!ret && getline(&line, &line_size, fp) >= 0)
     {
-        const char *arg = *(argv++);
-        argc--;
+        uint32_t masks[DRIVE_MAX][(MAX_GPIO_PINS + 31) / 32];
+        char *saveptr, *word, *end;
+        uint64_t step_ns;
+        unsigned chunk;
+        double usecs;
+
+        line_num++;
+        line[strcspn(line, "#")] = '\0';
+        word = strtok_r(line, " \t\r\n", &saveptr);
+        if (!word)
+            continue;
 
-        if (strcmp(arg, "dh") == 0)
-            drive = DRIVE_HIGH;
-        else if (strcmp(arg, "dl") == 0)
-            drive = DRIVE_LOW;
-        else if (strcmp(arg, "gp") == 0)
-            fsparam = GPIO_FSEL_GPIO;
-        else if (strcmp(arg, "ip") == 0)
-            fsparam = GPIO_FSEL_INPUT;
+        // The range check also rejects NaN, and keeps the conversion to
+        // nanoseconds (and the sum of two such times) within a uint64_t
+        usecs = strtod(word, &end);
+        if (end == word || *end || !(usecs >= 0 && usecs <= PLAY_MAX_US))
+        {
+            printf("Invalid time \"%s\"\n", word);
+            ret = -1;
+            break;
+        }
+        step_ns = (uint64_t)(usecs * 1000 + 0.5);
+        if (word[0] == '+')
+            step_ns += time_ns;
+        if (step_ns > PLAY_MAX_US * 1000)
+        {
+            printf("Time %s is too late\n", word);
+            ret = -1;
+            break;
+        }
+        if (step_ns >= time_ns)
+            time_ns = step_ns;
+        else
+        {
+            printf("Time %s is earlier than the line before\n", word);
+            ret = -1;
+            break;
+        }
+
+        memset(masks, 0, sizeof(masks));
+        while ((word = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL)
+        {
+            char *level = strtok_r(NULL, " \t\r\n", &saveptr);
+            int drv;
+
+            if (!level || (strcmp(level, "dh") && strcmp(level, "dl")))
+            {
+                printf("Expected dh or dl after \"%s\"\n", word);
+                ret = -1;
+                break;
+            }
+            drv = (level[1] == 'h') ? DRIVE_HIGH : DRIVE_LOW;
+            if (parse_play_gpios(word, masks[drv]) != 0)
+            {
+                ret = -1;
+                break;
+            }
+        }
+
+        // One step per 64 GPIOs touched, all for the same time
+        for (chunk = 0; !ret && chunk < (MAX_GPIO_PINS + 63) / 64; chunk++)
+        {
+            GPIO_STEP_T *step;
+            uint64_t bits[DRIVE_MAX];
+            int drv;
+
+            for (drv = 0; drv < DRIVE_MAX; drv++)
+            {
+                bits[drv] = masks[drv][chunk * 2];
+                if (chunk * 2 + 1 < ARRAY_SIZE(masks[drv]))
+                    bits[drv] |= (uint64_t)masks[drv][chunk * 2 + 1] << 32;
+            }
+            if (!bits[DRIVE_HIGH] && !bits[DRIVE_LOW])
+                continue;
+            if (bits[DRIVE_HIGH] & bits[DRIVE_LOW])
+            {
+                printf("A GPIO can't be driven high and low at once\n");
+                ret = -1;
+                break;
+            }
+
+            if (num_steps == max_steps)
+            {
+                max_steps = max_steps ? max_steps * 2 : 256;
+                step = realloc(steps, max_steps * sizeof(*steps));
+                if (!step)
+                {
+                    ret = -1;
+                    break;
+                }
+                steps = step;
+            }
+            step = &steps[num_steps++];
+            memset(step, 0, sizeof(*step));
+            step->time_ns = time_ns;
+            step->first = chunk * 64;
+            step->set_mask = bits[DRIVE_HIGH];
+            step->clear_mask = bits[DRIVE_LOW];
+        }
+    }
+
+    if (ret)
+    {
+        printf("Failed at line %u of %s\n", line_num, fname);
+        free(steps);
+        steps = NULL;
+    }
+    free(line);
+    fclose(fp);
+
+    *steps_ptr = steps;
+    return ret ? -1 : (int)num_steps;
+}
+
+static int do_gpio_play(const char *fname)
+{
+    GPIO_PLAY_CONFIG_T config;
+    GPIO_PLAY_RESULT_T result;
+    GPIO_STEP_T *steps;
+    int num_steps;
+    int ret;
+
+    num_steps = read_play_file(fname, &steps);
+    if (num_steps < 0)
+        return 1;
+
+    memset(&config, 0, sizeof(config));
+    config.spin_ns = play_spin_us * 1000;
+    config.cpu = capture_config.cpu;
+    config.priority = capture_config.priority;
+    // Avoid page faults during playback
+    if (config.priority > 0)
+        mlockall(MCL_CURRENT | MCL_FUTURE);
+
+    fflush(stdout);
+    ret = gpio_play(steps, num_steps, &config, &result);
+    free(steps);
+    if (ret != 0)
+    {
+        printf("Failed to play \"%s\" - %s\n", fname, strerror(errno));
+        return 1;
+    }
+
+    printf("Played %u steps in %" PRIu64 "us - timing error min %" PRId64
+           "ns, mean %" PRId64 "ns, max %" PRId64 "ns\n",
+           result.num_steps, result.duration_ns / 1000, result.min_error_ns,
+           result.mean_error_ns, result.max_error_ns);
+    return 0;
+}
+
+static int do_gpio_find(const char *pattern)
+{
+    GPIO_FUNCTION_T *funcs;
+    int count, i;
+
+    count = gpio_find_function(pattern, NULL, 0);
+    if (!count)
+    {
+        printf("No GPIO has a function matching \"%s\"\n", pattern);
+        return 1;
+    }
+
+    funcs = calloc(count, sizeof(*funcs));
+    if (!funcs)
+        return 1;
+    count = gpio_find_function(pattern, funcs, count);
+
+    for (i = 0; i < count; i++)
+    {
+        const GPIO_FUNCTION_T *func = &funcs[i];
+        const char *name = gpio_get_name(func->gpio);
+        int num = func->gpio;
+
+        if (pin_mode)
+        {
+            num = gpio_to_pin(func->gpio);
+            if (num < 0)
+                continue;
+            if (strchr(name, '/'))
+                name = strchr(name, '/') + 1;
+        }
+        printf("%2d: %s %s // %s\n", num, gpio_get_fsel_name(func->fsel),
+               func->name, name);
+    }
+
+    free(funcs);
+    return 0;
+}
+
+static int run_command(int argc, char *argv[])
+{
+    int set = 0;
+    int get = 0;
+    int level = 0;
+    int poll = 0;
+    int funcs = 0;
+    int pull = PULL_MAX;
+    int infer_cmd = 0;
+    int fsparam = GPIO_FSEL_MAX;
+    int drive = DRIVE_MAX;
+    uint32_t gpiomask[(MAX_GPIO_PINS + 31)/32] = { 0 };
+    unsigned pin;
+    int first_pin = 1;
+    int i;
+
+    if (argc)
+    {
+        const char *cmd = *(argv++);
+        argc--;
+
+        if (strcmp(cmd, "help") == 0)
+        {
+            usage();
+            return 0;
+        }
+
+        if (strcmp(cmd, "save") == 0 || strcmp(cmd, "restore") == 0 ||
+            strcmp(cmd, "play") == 0)
+        {
+            if (argc != 1)
+            {
+                printf("Usage: %s %s <file>\n", program_name, cmd);
+                return 1;
+            }
+            if (do_gpio_mmap() != 0)
+                return 1;
+            if (cmd[0] == 'p')
+                return do_gpio_play(argv[0]);
+            if (cmd[0] == 's')
+                return do_gpio_save(argv[0]);
+            return do_gpio_restore(argv[0]);
+        }
+
+        if (strcmp(cmd, "find") == 0)
+        {
+            if (argc != 1)
+            {
+                printf("Usage: %s find <function>\n", program_name);
+                return 1;
+            }
+            return do_gpio_find(argv[0]);
+        }
+
+        get = strcmp(cmd, "get") == 0;
+        set = strcmp(cmd, "set") == 0;
+        level = strcmp(cmd, "level") == 0 || strcmp(cmd, "lev") == 0;
+        poll = strcmp(cmd, "poll") == 0;
+        funcs = strcmp(cmd, "funcs") == 0;
+
+        if (!set && !get && !level && !poll && !funcs)
+        {
+            /* Back up in case we can decode this as a pin */
+            argv--;
+            argc++;
+            infer_cmd = 1;
+        }
+    }
+    else if (named_chip)
+    {
+        funcs = 1;
+    }
+    else
+    {
+        get = 1;
+    }
+
+    if (argc) /* expect pin number/name(s) next */
+    {
+        const char *bad;
+        int used = parse_gpio_list(argc, argv, gpiomask, &bad);
+
+        if (used < 0)
+        {
+            if (bad && infer_cmd && bad == argv[0])
+                printf("Unknown command \"%s\"\n", bad);
+            else if (bad)
+                printf("Unknown GPIO \"%s\"\n", bad);
+            return 1;
+        }
+        argv += used;
+        argc -= used;
+    }
+    else if (set)
+    {
+        printf("Need GPIO number to set\n");
+        return 1;
+    }
+    else if (poll)
+    {
+        printf("Need GPIO number to poll\n");
+        return 1;
+    }
+
+    if (set && !argc)
+    {
+        printf("Need a function or pull to set\n");
+        return 1;
+    }
+
+    if ((get || funcs) && argc)
+    {
+        printf("Too many arguments\n");
+        return 1;
+    }
+
+    if (infer_cmd)
+    {
+        if (named_chip)
+            funcs = 1;
+        else if (argc)
+            set = 1;
+        else
+            get = 1;
+    }
+
+    /* parse remaining args */
+    while (argc)
+    {
+        const char *arg = *(argv++);
+        argc--;
+
+        if (strcmp(arg, "dh") == 0)
+            drive = DRIVE_HIGH;
+        else if (strcmp(arg, "dl") == 0)
+            drive = DRIVE_LOW;
+        else if (strcmp(arg, "gp") == 0)
+            fsparam = GPIO_FSEL_GPIO;
+        else if (strcmp(arg, "ip") == 0)
+            fsparam = GPIO_FSEL_INPUT;
         else if (strcmp(arg, "op") == 0)
             fsparam = GPIO_FSEL_OUTPUT;
         else if (strcmp(arg, "no") == 0)
@@ -669,18 +1029,8 @@ int main(int argc, char *argv[])
     if (i < 0)
         memset(gpiomask, 0xff, sizeof(gpiomask));
 
-    if (!funcs)
-    {
-        ret = gpiolib_mmap();
-        if (ret)
-        {
-            if (ret == EACCES && geteuid())
-                printf("Must be root (or group 'gpio' on RPiOS)\n");
-            else
-                printf("Failed to mmap gpiolib - %s\n", strerror(ret));
-            return -1;
-        }
-    }
+    if (!funcs && do_gpio_mmap())
+        return -1;
 
     for (pin = start_pin; pin < end_pin + 1; pin++)
     {
@@ -707,7 +1057,7 @@ int main(int argc, char *argv[])
     if (level)
         printf("\n");
 
-    if (set && echo)
+    if (set && echo_mode)
     {
         for (pin = start_pin; pin < end_pin + 1; pin++)
         {
@@ -719,7 +1069,419 @@ int main(int argc, char *argv[])
     }
 
     if (poll)
-            do_gpio_poll();
+        return do_gpio_poll();
 
     return 0;
 }
+
+static int run_script(const char *fname)
+{
+    char *args[MAX_SCRIPT_ARGS];
+    char *line = NULL;
+    size_t line_size = 0;
+    unsigned line_num = 0;
+    FILE *fp;
+    int ret = 0;
+
+    if (strcmp(fname, "-") == 0)
+    {
+        fp = stdin;
+        fname = "<stdin>";
+    }
+    else
+    {
+        fp = fopen(fname, "r");
+        if (!fp)
+        {
+            printf("Failed to open \"%s\" - %s\n", fname, strerror(errno));
+            return -1;
+        }
+    }
+
+    // Map the hardware once, rather than for each command
+    if (!named_chip && do_gpio_mmap())
+        ret = -1;
+
+    while (!ret && getline(&line, &line_size, fp) >= 0)
+    {
+        char *saveptr;
+        char *word;
+        int argc = 0;
+
+        line_num++;
+        line[strcspn(line, "#")] = '\0';
+
+        for (word = strtok_r(line, " \t\r\n", &saveptr); word;
+             word = strtok_r(NULL, " \t\r\n", &saveptr))
+        {
+            if (argc < MAX_SCRIPT_ARGS)
+                args[argc] = word;
+            argc++;
+        }
+
+        if (!argc)
+            continue;
+
+        if (argc > MAX_SCRIPT_ARGS)
+        {
+            printf("Too many arguments\n");
+            ret = 1;
+        }
+        else if (strcmp(args[0], "wait") == 0)
+        {
+            if (argc == 2)
+                ret = do_wait(args[1]);
+            else
+            {
+                printf("Usage: wait <microseconds>\n");
+                ret = 1;
+            }
+        }
+        else if (strcmp(args[0], "poll") == 0)
+        {
+            printf("poll can't be used in a script\n");
+            ret = 1;
+        }
+        else
+        {
+            ret = run_command(argc, args);
+        }
+
+        if (ret)
+            printf("Script failed at line %u of %s\n", line_num, fname);
+    }
+
+    free(line);
+    if (fp != stdin)
+        fclose(fp);
+
+    return ret;
+}
+
+static void print_stats(void)
+{
+    GPIO_CHIP_STATS_T *stats;
+    int num_chips, chip;
+    unsigned op, bucket;
+
+    num_chips = gpiolib_get_stats(NULL, 0);
+    if (num_chips < 0)
+    {
+        printf("gpiolib was built without statistics (cmake -DENABLE_STATS=1)\n");
+        return;
+    }
+    stats = calloc(num_chips ? num_chips : 1, sizeof(*stats));
+    if (!stats)
+        return;
+    num_chips = gpiolib_get_stats(stats, num_chips);
+
+    for (chip = 0; chip < num_chips; chip++)
+    {
+        const GPIO_CHIP_STATS_T *chip_stats = &stats[chip];
+
+        for (op = 0; op < GPIO_OP_MAX && !chip_stats->ops[op].calls; op++)
+            continue;
+        if (op == GPIO_OP_MAX)
+            continue;
+
+        printf("%s (GPIOs %u-%u):\n", chip_stats->name, chip_stats->base,
+               chip_stats->base + chip_stats->num_gpios - 1);
+        printf("  %-10s %8s %8s %8s %8s %8s %6s %10s\n", "op", "calls",
+               "mean ns", "max ns", "mmio rd", "mmio wr", "mbox", "mbox ns");
+        for (op = 0; op < GPIO_OP_MAX; op++)
+        {
+            const GPIO_OP_STATS_T *op_stats = &chip_stats->ops[op];
+
+            if (!op_stats->calls)
+                continue;
+            printf("  %-10s %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64
+                   " %8" PRIu64 " %6" PRIu64 " %10" PRIu64 "\n",
+                   gpio_get_op_name(op), op_stats->calls,
+                   op_stats->total_ns / op_stats->calls, op_stats->max_ns,
+                   op_stats->mmio_reads, op_stats->mmio_writes,
+                   op_stats->mbox_calls, op_stats->mbox_ns);
+            printf("  %10s", "");
+            for (bucket = 0; bucket < GPIO_STATS_BUCKETS; bucket++)
+            {
+                if (!op_stats->histogram[bucket])
+                    continue;
+                if (bucket < GPIO_STATS_BUCKETS - 1)
+                    printf(" <%llu:", GPIO_STATS_BUCKET_NS(bucket));
+                else
+                    printf(" >=%llu:", GPIO_STATS_BUCKET_NS(bucket - 1));
+                printf("%" PRIu64, op_stats->histogram[bucket]);
+            }
+            printf("\n");
+        }
+    }
+
+    free(stats);
+}
+
+int main(int argc, char *argv[])
+{
+    int ret;
+
+    /* arg parsing */
+
+    const char *script = NULL;
+    const char *tables_file = NULL;
+
+    int list = 0;
+    int serve = 0;
+    int format_set = 0;
+
+    argv++;
+    argc--;
+
+    while (argc && (argv[0][0] == '-'))
+    {
+        const char *arg = *(argv++);
+        argc--;
+
+        if (strcmp(arg, "-c") == 0)
+        {
+            if (!argc)
+            {
+                printf("* chip name expected - use 'pinctrl -h' for help\n");
+                return -1;
+            }
+            named_chip = *(argv++);
+            argc--;
+        }
+        else if (strcmp(arg, "-e") == 0)
+        {
+            echo_mode = 1;
+        }
+        else if (strcmp(arg, "-f") == 0)
+        {
+            if (!argc)
+            {
+                printf("* script file expected - use 'pinctrl -h' for help\n");
+                return -1;
+            }
+            script = *(argv++);
+            argc--;
+        }
+        else if (strcmp(arg, "-h") == 0)
+        {
+            usage();
+            return 0;
+        }
+        else if (strcmp(arg, "-l") == 0)
+        {
+            list = 1;
+            verbose_mode = 1;
+        }
+        else if (strcmp(arg, "-p") == 0)
+        {
+            pin_mode = 1;
+        }
+        else if (strcmp(arg, "-v") == 0)
+        {
+            verbose_mode = 1;
+        }
+        else if (strcmp(arg, "--cache") == 0)
+        {
+            gpiolib_set_cache_path(GPIOLIB_CACHE_PATH);
+        }
+        else if (strcmp(arg, "--events") == 0)
+        {
+            capture_config.events = 1;
+        }
+        else if (strcmp(arg, "--deltas") == 0)
+        {
+            capture_config.deltas = 1;
+        }
+        else if (strcmp(arg, "--serve") == 0)
+        {
+            serve = 1;
+        }
+        else if (strcmp(arg, "--stats") == 0)
+        {
+            stats_mode = 1;
+        }
+        else if (strcmp(arg, "--dtpath") == 0)
+        {
+            if (!argc)
+            {
+                printf("* %s expects an argument - use 'pinctrl -h' for help\n", arg);
+                return -1;
+            }
+            gpiolib_set_dt_path(*(argv++));
+            argc--;
+        }
+        else if (strcmp(arg, "--socket") == 0)
+        {
+            if (!argc)
+            {
+                printf("* %s expects an argument - use 'pinctrl -h' for help\n", arg);
+                return -1;
+            }
+            server_config.socket_path = *(argv++);
+            argc--;
+        }
+        else if (strcmp(arg, "--group") == 0)
+        {
+            if (!argc)
+            {
+                printf("* %s expects an argument - use 'pinctrl -h' for help\n", arg);
+                return -1;
+            }
+            server_config.group = *(argv++);
+            argc--;
+        }
+        else if (strcmp(arg, "--export-tables") == 0)
+        {
+            if (!argc)
+            {
+                printf("* %s expects an argument - use 'pinctrl -h' for help\n", arg);
+                return -1;
+            }
+            tables_file = *(argv++);
+            argc--;
+        }
+        else if (strcmp(arg, "--output") == 0 ||
+                 strcmp(arg, "--format") == 0 ||
+                 strcmp(arg, "--rate") == 0 ||
+                 strcmp(arg, "--cpu") == 0 ||
+                 strcmp(arg, "--priority") == 0 ||
+                 strcmp(arg, "--spin") == 0)
+        {
+            const char *val;
+            char *end;
+            long num;
+
+            if (!argc)
+            {
+                printf("* %s expects an argument - use 'pinctrl -h' for help\n", arg);
+                return -1;
+            }
+            val = *(argv++);
+            argc--;
+            num = strtol(val, &end, 10);
+
+            if (strcmp(arg, "--output") == 0)
+            {
+                capture_config.output = val;
+                if (!format_set)
+                {
+                    const char *ext = strrchr(val, '.');
+                    if (ext && strcmp(ext, ".vcd") == 0)
+                        capture_config.format = CAPTURE_VCD;
+                    else if (ext && strcmp(ext, ".bin") == 0)
+                        capture_config.format = CAPTURE_BINARY;
+                }
+            }
+            else if (strcmp(arg, "--format") == 0)
+            {
+                capture_config.format = capture_format_by_name(val);
+                if (capture_config.format == CAPTURE_FORMAT_MAX)
+                {
+                    printf("Unknown format '%s'\n", val);
+                    return -1;
+                }
+                format_set = 1;
+            }
+            else if (*end || num < 0)
+            {
+                printf("Invalid number '%s' for %s\n", val, arg);
+                return -1;
+            }
+            else if (strcmp(arg, "--rate") == 0)
+            {
+                capture_config.rate = (unsigned)num;
+            }
+            else if (strcmp(arg, "--cpu") == 0)
+            {
+                capture_config.cpu = (int)num;
+            }
+            else if (strcmp(arg, "--spin") == 0)
+            {
+                // Passed on in nanoseconds, as an unsigned
+                if ((unsigned long)num > UINT_MAX / 1000)
+                {
+                    printf("Invalid number '%s' for %s\n", val, arg);
+                    return -1;
+                }
+                play_spin_us = (unsigned)num;
+            }
+            else
+            {
+                capture_config.priority = (int)num;
+            }
+        }
+        else
+        {
+            printf("Unknown option '%s' - try \"%s help\"\n",
+                   arg, program_name);
+            exit(1);
+        }
+    }
+
+    if (verbose_mode)
+        gpiolib_set_verbose(&verbose_callback);
+
+    // Needs each chip driver to itself, so before gpiolib is initialised
+    if (tables_file)
+        return tables_export(tables_file) ? -1 : 0;
+
+    if (named_chip)
+        ret = gpiolib_init_by_name(named_chip);
+    else
+        ret = gpiolib_init();
+
+    if (ret < 0)
+    {
+        printf("Failed to initialise gpiolib - %d\n", ret);
+        return -1;
+    }
+
+    num_gpios = ret;
+    if (!num_gpios)
+    {
+        printf("No GPIO chips found\n");
+        return -1;
+    }
+
+    if (list)
+        return 0;
+
+    if (pin_mode)
+    {
+       gpio_get_pin_range(&start_pin, &end_pin);
+       if (start_pin == GPIO_INVALID)
+       {
+           printf("No PIN numbers declared in DT - pin mode disabled\n");
+           pin_mode = 0;
+       }
+    }
+
+    if (start_pin == GPIO_INVALID)
+    {
+        start_pin = 0;
+        end_pin = num_gpios - 1;
+    }
+
+    if (script)
+    {
+        ret = run_script(script);
+    }
+    else if (serve)
+    {
+        if (do_gpio_mmap())
+            return -1;
+        server_config.rate = capture_config.rate;
+        server_config.verbose = verbose_mode;
+        ret = server_run(&server_config);
+    }
+    else
+    {
+        ret = run_command(argc, argv);
+    }
+
+    if (stats_mode)
+        print_stats();
+
+    return ret;
+}
@@ -0,0 +1,228 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "pinctrl_client.h"
+
+#define CLIENT_QUEUE_SIZE 16
+
+struct PINCTRL_CLIENT_
+{
+    int fd;
+    // Changes that arrived while waiting for a reply
+    unsigned queue_head;
+    unsigned queue_count;
+    PINCTRL_MSG_T queue[CLIENT_QUEUE_SIZE];
+};
+
+static void client_queue_change(PINCTRL_CLIENT_T *client, const PINCTRL_MSG_T *msg)
+{
+    PINCTRL_MSG_T *last;
+
+    if (client->queue_count < CLIENT_QUEUE_SIZE)
+    {
+        client->queue[(client->queue_head + client->queue_count) % CLIENT_QUEUE_SIZE] = *msg;
+        client->queue_count++;
+        return;
+    }
+
+    // Full - merge into the newest entry, which loses the intermediate levels
+    last = &client->queue[(client->queue_head + CLIENT_QUEUE_SIZE - 1) % CLIENT_QUEUE_SIZE];
+    last->mask |= msg->mask;
+    last->levels = msg->levels;
+    last->timestamp_ns = msg->timestamp_ns;
+}
+
+static int client_recv(PINCTRL_CLIENT_T *client, PINCTRL_MSG_T *msg)
+{
+    ssize_t len = recv(client->fd, msg, sizeof(*msg), 0);
+
+    if (len == (ssize_t)sizeof(*msg))
+        return 0;
+    if (len >= 0)
+        errno = len ? EPROTO : ECONNRESET;
+    return -1;
+}
+
+static int client_request(PINCTRL_CLIENT_T *client, PINCTRL_MSG_T *msg)
+{
+    PINCTRL_MSG_T reply;
+
+    if (send(client->fd, msg, sizeof(*msg), MSG_NOSIGNAL) != (ssize_t)sizeof(*msg))
+        return -1;
+
+    while (1)
+    {
+        if (client_recv(client, &reply) != 0)
+            return -1;
+        if (reply.op != PINCTRL_OP_CHANGE)
+            break;
+        client_queue_change(client, &reply);
+    }
+
+    if (reply.op != msg->op)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+    if (reply.status < 0)
+    {
+        errno = -reply.status;
+        return -1;
+    }
+
+    *msg = reply;
+    return 0;
+}
+
+static int client_set(PINCTRL_CLIENT_T *client, PINCTRL_OP_T op,
+                      unsigned first, uint64_t mask, uint32_t arg)
+{
+    PINCTRL_MSG_T msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.op = op;
+    msg.first = first;
+    msg.mask = mask;
+    msg.arg = arg;
+    return client_request(client, &msg);
+}
+
+PINCTRL_CLIENT_T *pinctrl_client_open(const char *path)
+{
+    PINCTRL_CLIENT_T *client;
+    struct sockaddr_un addr;
+
+    if (!path)
+        path = PINCTRL_SOCKET_PATH;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    client = calloc(1, sizeof(*client));
+    if (!client)
+        return NULL;
+
+    client->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (client->fd < 0)
+    {
+        free(client);
+        return NULL;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(client->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        int err = errno;
+
+        close(client->fd);
+        free(client);
+        errno = err;
+        return NULL;
+    }
+
+    return client;
+}
+
+void pinctrl_client_close(PINCTRL_CLIENT_T *client)
+{
+    if (!client)
+        return;
+    close(client->fd);
+    free(client);
+}
+
+int pinctrl_client_fd(PINCTRL_CLIENT_T *client)
+{
+    return client->fd;
+}
+
+int pinctrl_client_get_levels(PINCTRL_CLIENT_T *client, unsigned first,
+                              uint64_t mask, uint64_t *levels)
+{
+    PINCTRL_MSG_T msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.op = PINCTRL_OP_GET_LEVELS;
+    msg.first = first;
+    msg.mask = mask;
+    if (client_request(client, &msg) != 0)
+        return -1;
+    *levels = msg.levels;
+    return 0;
+}
+
+int pinctrl_client_set_drives(PINCTRL_CLIENT_T *client, unsigned first,
+                              uint64_t mask, GPIO_DRIVE_T drv)
+{
+    return client_set(client, PINCTRL_OP_SET_DRIVES, first, mask, drv);
+}
+
+int pinctrl_client_set_fsels(PINCTRL_CLIENT_T *client, unsigned first,
+                             uint64_t mask, GPIO_FSEL_T fsel)
+{
+    return client_set(client, PINCTRL_OP_SET_FSELS, first, mask, fsel);
+}
+
+int pinctrl_client_set_pulls(PINCTRL_CLIENT_T *client, unsigned first,
+                             uint64_t mask, GPIO_PULL_T pull)
+{
+    return client_set(client, PINCTRL_OP_SET_PULLS, first, mask, pull);
+}
+
+int pinctrl_client_subscribe(PINCTRL_CLIENT_T *client, unsigned first,
+                             uint64_t mask, uint64_t *levels)
+{
+    PINCTRL_MSG_T msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.op = PINCTRL_OP_SUBSCRIBE;
+    msg.first = first;
+    msg.mask = mask;
+    if (client_request(client, &msg) != 0)
+        return -1;
+
+    // Changes queued under an earlier subscription are no longer relevant
+    client->queue_count = 0;
+    if (levels)
+        *levels = msg.levels;
+    return 0;
+}
+
+int pinctrl_client_wait_change(PINCTRL_CLIENT_T *client, PINCTRL_MSG_T *change,
+                               int timeout_ms)
+{
+    struct pollfd pfd;
+    int ret;
+
+    if (client->queue_count)
+    {
+        *change = client->queue[client->queue_head];
+        client->queue_head = (client->queue_head + 1) % CLIENT_QUEUE_SIZE;
+        client->queue_count--;
+        return 1;
+    }
+
+    pfd.fd = client->fd;
+    pfd.events = POLLIN;
+    ret = poll(&pfd, 1, timeout_ms);
+    if (ret <= 0)
+        return ret;
+
+    if (client_recv(client, change) != 0)
+        return -1;
+    if (change->op != PINCTRL_OP_CHANGE)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+    return 1;
+}
@@ -0,0 +1,69 @@
+#ifndef PINCTRL_CLIENT_H
+#define PINCTRL_CLIENT_H
+
+#include <stdint.h>
+
+#include "gpiolib.h"
+
+#define PINCTRL_SOCKET_PATH "/run/pinctrl.sock"
+
+/* Protocol spoken over the "pinctrl --serve" socket, which is a Unix domain
+ * SOCK_SEQPACKET socket, so every message is one PINCTRL_MSG_T in host byte
+ * order. Each request is answered by one reply with the same op. GPIOs are
+ * gpiolib GPIO numbers - bit n of mask and levels is GPIO first + n.
+ *
+ * Once a client has subscribed, the server also sends PINCTRL_OP_CHANGE
+ * messages whenever any of the subscribed GPIOs change level.
+ *
+ * The server never waits for a client. One that leaves its replies unread
+ * until its queue is full is disconnected, and changes are reported late.
+ */
+typedef enum
+{
+    PINCTRL_OP_GET_LEVELS,  /* Reply levels are those of the GPIOs in mask */
+    PINCTRL_OP_SET_DRIVES,  /* arg is a GPIO_DRIVE_T */
+    PINCTRL_OP_SET_FSELS,   /* arg is a GPIO_FSEL_T */
+    PINCTRL_OP_SET_PULLS,   /* arg is a GPIO_PULL_T */
+    PINCTRL_OP_SUBSCRIBE,   /* Replaces any previous subscription - mask 0 cancels */
+    PINCTRL_OP_CHANGE,      /* Server to client only */
+    PINCTRL_OP_MAX
+} PINCTRL_OP_T;
+
+typedef struct
+{
+    uint32_t op;
+    int32_t status;         /* Replies: 0, or a negative errno value */
+    uint32_t first;
+    uint32_t arg;
+    uint64_t mask;          /* For a CHANGE, the GPIOs that changed */
+    uint64_t levels;
+    uint64_t timestamp_ns;  /* For a CHANGE, the CLOCK_MONOTONIC sample time */
+} PINCTRL_MSG_T;
+
+typedef struct PINCTRL_CLIENT_ PINCTRL_CLIENT_T;
+
+/* Connects to the server at path (NULL for PINCTRL_SOCKET_PATH). The other
+ * functions return 0 on success, or -1 with errno set.
+ */
+PINCTRL_CLIENT_T *pinctrl_client_open(const char *path);
+void pinctrl_client_close(PINCTRL_CLIENT_T *client);
+int pinctrl_client_fd(PINCTRL_CLIENT_T *client);  /* For poll() loops */
+
+int pinctrl_client_get_levels(PINCTRL_CLIENT_T *client, unsigned first,
+                              uint64_t mask, uint64_t *levels);
+int pinctrl_client_set_drives(PINCTRL_CLIENT_T *client, unsigned first,
+                              uint64_t mask, GPIO_DRIVE_T drv);
+int pinctrl_client_set_fsels(PINCTRL_CLIENT_T *client, unsigned first,
+                             uint64_t mask, GPIO_FSEL_T fsel);
+int pinctrl_client_set_pulls(PINCTRL_CLIENT_T *client, unsigned first,
+                             uint64_t mask, GPIO_PULL_T pull);
+int pinctrl_client_subscribe(PINCTRL_CLIENT_T *client, unsigned first,
+                             uint64_t mask, uint64_t *levels);
+
+/* Waits up to timeout_ms (-1 for ever) for a change to the subscribed GPIOs.
+ * Returns 1 if *change was filled in, 0 on timeout, or -1 on error.
+ */
+int pinctrl_client_wait_change(PINCTRL_CLIENT_T *client, PINCTRL_MSG_T *change,
+                               int timeout_ms);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef PINCTRL_TABLES_H
+#define PINCTRL_TABLES_H
+
+#include <stdint.h>
+
+/* Layout of the file written by "pinctrl --export-tables", in host byte
+ * order, which holds the GPIO names and alternate functions of every chip
+ * gpiolib supports, so that other tools can use them without gpiolib. All
+ * offsets are in bytes from the start of the file, so it can be used in
+ * place after mmap:
+ *
+ *   PINCTRL_TABLES_HEADER_T
+ *   PINCTRL_TABLES_CHIP_T chips[num_chips]
+ *   PINCTRL_TABLES_PIN_T pins[num_pins]      header pin n is pins[n - 1]
+ *   PINCTRL_TABLES_GPIO_T gpios[]            each chip's GPIOs, in order
+ *   strings                                  NUL-terminated, shared
+ *
+ * A string offset of 0 means no string.
+ */
+#define PINCTRL_TABLES_MAGIC "PCTLTABS"
+#define PINCTRL_TABLES_VERSION 1
+
+#define PINCTRL_TABLES_NUM_ALTS 9       /* GPIO_FSEL_FUNC0 to GPIO_FSEL_FUNC8 */
+#define PINCTRL_TABLES_NO_CHIP 0xffff
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t size;          /* Of the whole file */
+    uint32_t num_chips;
+    uint32_t num_pins;
+    uint32_t chips_offset;
+    uint32_t pins_offset;
+} PINCTRL_TABLES_HEADER_T;
+
+typedef struct
+{
+    uint32_t name;          /* String - the name accepted by "pinctrl -c" */
+    uint32_t num_gpios;
+    uint32_t gpios_offset;  /* Of num_gpios PINCTRL_TABLES_GPIO_Ts */
+} PINCTRL_TABLES_CHIP_T;
+
+typedef struct
+{
+    uint32_t name;          /* String, or 0 if the GPIO doesn't exist */
+    uint32_t alts[PINCTRL_TABLES_NUM_ALTS];  /* Strings, 0 if unused */
+    uint8_t pin;            /* Header pin, or 0 if not on the header */
+    uint8_t reserved[3];
+} PINCTRL_TABLES_GPIO_T;
+
+/* Header pins are only mapped if the export ran with a Device Tree (the
+ * live one, or --dtpath) describing a board with a header.
+ */
+typedef struct
+{
+    uint32_t name;          /* String, e.g. "GPIO17" or "gnd", or 0 if unknown */
+    uint16_t chip;          /* Index into chips, or PINCTRL_TABLES_NO_CHIP */
+    uint16_t gpio;          /* GPIO number within the chip */
+} PINCTRL_TABLES_PIN_T;
+
+#endif
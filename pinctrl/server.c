@@ -0,0 +1,356 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <grp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "gpiolib.h"
+#include "pinctrl_client.h"
+#include "server.h"
+#include "util.h"
+
+#define SERVER_MAX_CLIENTS 32
+#define SERVER_DEFAULT_RATE 1000
+#define NS_PER_SEC 1000000000ULL
+
+typedef struct
+{
+    int fd;             /* -1 if the slot is free */
+    unsigned first;
+    uint64_t mask;      /* The subscribed GPIOs, if any */
+    uint64_t levels;    /* Their levels as last reported */
+} SERVER_CLIENT_T;
+
+static volatile sig_atomic_t server_stop;
+
+static void server_signal(int sig)
+{
+    (void)sig;
+    server_stop = 1;
+}
+
+static int server_check_gpios(unsigned first, uint64_t mask)
+{
+    unsigned i;
+
+    for (i = 0; i < 64; i++)
+    {
+        if (((mask >> i) & 1) && !gpio_num_is_valid(first + i))
+            return -EINVAL;
+    }
+    return 0;
+}
+
+static int server_read_levels(unsigned first, uint64_t mask, uint64_t *levels)
+{
+    *levels = 0;
+    if (!mask)
+        return 0;
+    if (gpio_get_levels(first, 64 - __builtin_clzll(mask), levels) != 0)
+        return -EINVAL;
+    *levels &= mask;
+    return 0;
+}
+
+/* Never waits, so that a slow client can't hold up the others. Returns 0
+ * if the message was sent, or -1 if the client's queue is full or it has
+ * gone away.
+ */
+static int server_send(SERVER_CLIENT_T *client, const PINCTRL_MSG_T *msg)
+{
+    ssize_t len;
+
+    len = send(client->fd, msg, sizeof(*msg), MSG_DONTWAIT | MSG_NOSIGNAL);
+    return (len == (ssize_t)sizeof(*msg)) ? 0 : -1;
+}
+
+static void server_close_client(SERVER_CLIENT_T *client, int verbose)
+{
+    if (verbose)
+        printf("Client %d disconnected\n", client->fd);
+    close(client->fd);
+    client->fd = -1;
+    client->mask = 0;
+}
+
+static int server_handle(SERVER_CLIENT_T *client, PINCTRL_MSG_T *msg)
+{
+    int status = server_check_gpios(msg->first, msg->mask);
+    unsigned i;
+
+    if (!status)
+    {
+        switch (msg->op)
+        {
+        case PINCTRL_OP_GET_LEVELS:
+            status = server_read_levels(msg->first, msg->mask, &msg->levels);
+            break;
+
+        case PINCTRL_OP_SET_DRIVES:
+            if (msg->arg == DRIVE_HIGH)
+                gpio_set_mask(msg->first, msg->mask);
+            else if (msg->arg == DRIVE_LOW)
+                gpio_clear_mask(msg->first, msg->mask);
+            else
+                status = -EINVAL;
+            break;
+
+        case PINCTRL_OP_SET_FSELS:
+            if (msg->arg >= GPIO_FSEL_MAX)
+            {
+                status = -EINVAL;
+                break;
+            }
+            for (i = 0; i < 64; i++)
+            {
+                if ((msg->mask >> i) & 1)
+                    gpio_set_fsel(msg->first + i, (GPIO_FSEL_T)msg->arg);
+            }
+            break;
+
+        case PINCTRL_OP_SET_PULLS:
+            if (msg->arg >= PULL_MAX)
+            {
+                status = -EINVAL;
+                break;
+            }
+            for (i = 0; i < 64; i++)
+            {
+                if ((msg->mask >> i) & 1)
+                    gpio_set_pull(msg->first + i, (GPIO_PULL_T)msg->arg);
+            }
+            break;
+
+        case PINCTRL_OP_SUBSCRIBE:
+            status = server_read_levels(msg->first, msg->mask, &msg->levels);
+            if (!status)
+            {
+                client->first = msg->first;
+                client->mask = msg->mask;
+                client->levels = msg->levels;
+            }
+            break;
+
+        default:
+            status = -EOPNOTSUPP;
+            break;
+        }
+    }
+
+    msg->status = status;
+    // A client that isn't reading its replies is disconnected
+    return server_send(client, msg);
+}
+
+static void server_sample(SERVER_CLIENT_T *clients)
+{
+    uint64_t now = get_time_ns(CLOCK_MONOTONIC);
+    unsigned i;
+
+    for (i = 0; i < SERVER_MAX_CLIENTS; i++)
+    {
+        SERVER_CLIENT_T *client = &clients[i];
+        PINCTRL_MSG_T msg;
+        uint64_t levels;
+
+        if (client->fd < 0 || !client->mask ||
+            server_read_levels(client->first, client->mask, &levels) != 0 ||
+            levels == client->levels)
+            continue;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.op = PINCTRL_OP_CHANGE;
+        msg.first = client->first;
+        msg.mask = levels ^ client->levels;
+        msg.levels = levels;
+        msg.timestamp_ns = now;
+        // If the client's queue is full, report the change on a later sample
+        // rather than wait
+        if (server_send(client, &msg) == 0)
+            client->levels = levels;
+    }
+}
+
+static int server_listen(const char *path, const char *group_name)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    struct group *group;
+    mode_t old_mask;
+    int fd, ret;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        printf("Socket path '%s' is too long\n", path);
+        return -1;
+    }
+
+    // Without the default group, only the server's own group has access
+    group = getgrnam(group_name ? group_name : SERVER_DEFAULT_GROUP);
+    if (!group && group_name)
+    {
+        printf("Unknown group '%s'\n", group_name);
+        return -1;
+    }
+
+    // Remove a socket left behind by an earlier server, but nothing else
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        goto fail;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    // Create the socket with its final permissions, so that it is never
+    // accessible to others
+    old_mask = umask(0117);
+    ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (ret != 0 || chmod(path, 0660) != 0 ||
+        (group && chown(path, -1, group->gr_gid) != 0) || listen(fd, 8) != 0)
+        goto fail;
+
+    return fd;
+
+fail:
+    printf("Failed to listen on '%s' - %s\n", path, strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+int server_run(const SERVER_CONFIG_T *config)
+{
+    SERVER_CLIENT_T clients[SERVER_MAX_CLIENTS];
+    struct pollfd fds[SERVER_MAX_CLIENTS + 1];
+    struct sigaction sa, old_int, old_term;
+    const char *path;
+    uint64_t interval, next_sample = 0;
+    unsigned i;
+    int listen_fd;
+
+    path = config->socket_path ? config->socket_path : PINCTRL_SOCKET_PATH;
+    interval = NS_PER_SEC / (config->rate ? config->rate : SERVER_DEFAULT_RATE);
+
+    listen_fd = server_listen(path, config->group);
+    if (listen_fd < 0)
+        return -1;
+
+    for (i = 0; i < SERVER_MAX_CLIENTS; i++)
+    {
+        clients[i].fd = -1;
+        clients[i].mask = 0;
+    }
+
+    server_stop = 0;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = server_signal;
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+
+    if (config->verbose)
+        printf("Listening on %s\n", path);
+
+    while (!server_stop)
+    {
+        struct timespec timeout, *ptimeout = NULL;
+        int subscribed = 0;
+        uint64_t now;
+        int ret;
+
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (i = 0; i < SERVER_MAX_CLIENTS; i++)
+        {
+            fds[i + 1].fd = clients[i].fd;
+            fds[i + 1].events = POLLIN;
+            fds[i + 1].revents = 0;
+            if (clients[i].fd >= 0 && clients[i].mask)
+                subscribed = 1;
+        }
+
+        // Only wake up to sample while someone is interested in changes
+        if (subscribed)
+        {
+            now = get_time_ns(CLOCK_MONOTONIC);
+            if (next_sample < now)
+                next_sample = now;
+            timeout.tv_sec = (next_sample - now) / NS_PER_SEC;
+            timeout.tv_nsec = (next_sample - now) % NS_PER_SEC;
+            ptimeout = &timeout;
+        }
+
+        ret = ppoll(fds, SERVER_MAX_CLIENTS + 1, ptimeout, NULL);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            printf("poll failed - %s\n", strerror(errno));
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+            for (i = 0; fd >= 0 && i < SERVER_MAX_CLIENTS; i++)
+            {
+                if (clients[i].fd < 0)
+                {
+                    clients[i].fd = fd;
+                    clients[i].mask = 0;
+                    if (config->verbose)
+                        printf("Client %d connected\n", fd);
+                    fd = -1;
+                }
+            }
+            if (fd >= 0)
+                close(fd);
+        }
+
+        for (i = 0; i < SERVER_MAX_CLIENTS; i++)
+        {
+            SERVER_CLIENT_T *client = &clients[i];
+            PINCTRL_MSG_T msg;
+            ssize_t len;
+
+            if (client->fd < 0 || !fds[i + 1].revents)
+                continue;
+
+            len = recv(client->fd, &msg, sizeof(msg), MSG_DONTWAIT);
+            if (len < 0 && errno == EAGAIN)
+                continue;
+            if (len != (ssize_t)sizeof(msg) || server_handle(client, &msg) != 0)
+                server_close_client(client, config->verbose);
+        }
+
+        if (subscribed && get_time_ns(CLOCK_MONOTONIC) >= next_sample)
+        {
+            server_sample(clients);
+            next_sample += interval;
+        }
+    }
+
+    for (i = 0; i < SERVER_MAX_CLIENTS; i++)
+    {
+        if (clients[i].fd >= 0)
+            close(clients[i].fd);
+    }
+    close(listen_fd);
+    unlink(path);
+
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+
+    return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#define SERVER_DEFAULT_GROUP "gpio"
+
+typedef struct
+{
+    const char *socket_path;  /* NULL for PINCTRL_SOCKET_PATH */
+    const char *group;        /* Owning group of the socket, or NULL for
+                                 SERVER_DEFAULT_GROUP if it exists */
+    unsigned rate;            /* Samples per second for subscriptions, or 0 */
+    int verbose;
+} SERVER_CONFIG_T;
+
+/* Serves requests on the socket (see pinctrl_client.h) until interrupted */
+int server_run(const SERVER_CONFIG_T *config);
+
+#endif
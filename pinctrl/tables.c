@@ -0,0 +1,372 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "gpiolib.h"
+#include "pinctrl_tables.h"
+#include "tables.h"
+#include "util.h"
+
+#define TABLES_MAX_CHIPS 32
+#define TABLES_MAX_GPIOS 1024   /* Across all chips */
+#define TABLES_HASH_SIZE 4096   /* A power of two */
+#define TABLES_MAX_STRINGS (TABLES_HASH_SIZE / 2)
+#define TABLES_MAX_STRINGS_SIZE (1 << 20)
+
+typedef struct
+{
+    char *data;
+    uint32_t size;
+    uint32_t max_size;
+    unsigned count;
+    uint32_t hash[TABLES_HASH_SIZE];  /* String offsets, 0 for a free slot */
+} TABLES_STRINGS_T;
+
+typedef struct
+{
+    PINCTRL_TABLES_CHIP_T chips[TABLES_MAX_CHIPS];
+    PINCTRL_TABLES_PIN_T pins[NUM_HDR_PINS];
+    PINCTRL_TABLES_GPIO_T gpios[TABLES_MAX_GPIOS];
+    unsigned num_chips;
+    unsigned num_gpios;
+    TABLES_STRINGS_T strings;
+} TABLES_T;
+
+/* Sets *offset to the offset of str in the string table, relative to the
+ * start of the strings, adding it if new. Offsets start at 1, so that 0 can
+ * mean no string (str is empty). Returns 0, or -1 if the table is full or
+ * can't grow.
+ */
+static int tables_add_string(TABLES_STRINGS_T *strings, const char *str,
+                             uint32_t *offset)
+{
+    size_t len = strlen(str);
+    unsigned slot;
+
+    *offset = 0;
+    if (!len)
+        return 0;
+
+    for (slot = fnv1a(FNV1A_INIT, str, len) & (TABLES_HASH_SIZE - 1);
+         strings->hash[slot]; slot = (slot + 1) & (TABLES_HASH_SIZE - 1))
+    {
+        if (strcmp(strings->data + strings->hash[slot], str) == 0)
+        {
+            *offset = strings->hash[slot];
+            return 0;
+        }
+    }
+
+    // Keeping the hash table half empty also guarantees a free slot
+    if (strings->count == TABLES_MAX_STRINGS ||
+        len + 2 > TABLES_MAX_STRINGS_SIZE - strings->size)
+        return -1;
+
+    if (strings->size + len + 2 > strings->max_size)
+    {
+        uint32_t max_size = strings->max_size ? strings->max_size * 2 : 16384;
+        char *data;
+
+        while (max_size < strings->size + len + 2)
+            max_size *= 2;
+        data = realloc(strings->data, max_size);
+        if (!data)
+            return -1;
+        if (!strings->size)
+            data[strings->size++] = '\0';
+        strings->data = data;
+        strings->max_size = max_size;
+    }
+
+    strings->hash[slot] = strings->size;
+    memcpy(strings->data + strings->size, str, len + 1);
+    strings->size += len + 1;
+    strings->count++;
+    *offset = strings->hash[slot];
+    return 0;
+}
+
+/* Runs in a child process, because each driver keeps its instances in
+ * static storage that can't be reset. Writes a line per GPIO of the name
+ * and alternate function names, separated by tabs, to fd - nothing if the
+ * driver can't describe its GPIOs without the hardware. Returns 0, or -1 if
+ * the lines couldn't be written.
+ */
+static int tables_dump_chip(const char *name, int fd)
+{
+    FILE *fp = fdopen(fd, "w");
+    int num_gpios, gpio, fsel;
+
+    if (!fp)
+        return -1;
+
+    num_gpios = gpiolib_init_by_name(name);
+    for (gpio = 0; gpio < num_gpios; gpio++)
+    {
+        if (gpio_num_is_valid(gpio))
+        {
+            fputs(gpio_get_name(gpio), fp);
+            for (fsel = GPIO_FSEL_FUNC0; fsel <= GPIO_FSEL_FUNC8; fsel++)
+            {
+                const char *alt = gpio_get_gpio_fsel_name(gpio, fsel);
+
+                fprintf(fp, "\t%s", gpio_fsel_name_is_valid(alt) ? alt : "");
+            }
+        }
+        fputc('\n', fp);
+    }
+
+    return (ferror(fp) || fclose(fp) != 0) ? -1 : 0;
+}
+
+/* Returns 0, having added the chip if it has any alternate functions to
+ * describe, or -1 if the string table is full.
+ */
+static int tables_read_chip(TABLES_T *tables, const char *name, FILE *fp)
+{
+    PINCTRL_TABLES_CHIP_T *chip = &tables->chips[tables->num_chips];
+    unsigned first = tables->num_gpios;
+    char *line = NULL;
+    size_t line_size = 0;
+    int named = 0;
+    int ret = 0;
+
+    while (!ret && getline(&line, &line_size, fp) >= 0)
+    {
+        PINCTRL_TABLES_GPIO_T *gpio;
+        char *field, *rest = line;
+        int alt = -1;
+
+        if (tables->num_gpios == TABLES_MAX_GPIOS)
+            break;
+        gpio = &tables->gpios[tables->num_gpios++];
+        memset(gpio, 0, sizeof(*gpio));
+
+        line[strcspn(line, "\n")] = '\0';
+        while ((field = strsep(&rest, "\t")) != NULL && alt < PINCTRL_TABLES_NUM_ALTS)
+        {
+            uint32_t str;
+
+            ret = tables_add_string(&tables->strings, field, &str);
+            if (ret)
+                break;
+            if (alt < 0)
+                gpio->name = str;
+            else
+                gpio->alts[alt] = str;
+            if (alt >= 0 && str)
+                named = 1;
+            alt++;
+        }
+    }
+    free(line);
+
+    if (!ret && named)
+        ret = tables_add_string(&tables->strings, name, &chip->name);
+
+    // Skip chips that have no alternate functions to describe
+    if (ret || !named)
+    {
+        tables->num_gpios = first;
+        return ret;
+    }
+
+    chip->num_gpios = tables->num_gpios - first;
+    chip->gpios_offset = first;     // Converted to a file offset later
+    tables->num_chips++;
+    return 0;
+}
+
+/* Returns 0, or -1 if the string table is full */
+static int tables_map_pins(TABLES_T *tables)
+{
+    GPIO_CHIP_INFO_T chips[TABLES_MAX_CHIPS];
+    int num_chips, pin;
+
+    for (pin = 1; pin <= NUM_HDR_PINS; pin++)
+        tables->pins[pin - 1].chip = PINCTRL_TABLES_NO_CHIP;
+
+    // Without a Device Tree there is no header to describe
+    if (gpiolib_init() <= 0)
+        return 0;
+    num_chips = gpiolib_get_chips(chips, TABLES_MAX_CHIPS);
+    if (num_chips > TABLES_MAX_CHIPS)
+        num_chips = TABLES_MAX_CHIPS;
+
+    for (pin = 1; pin <= NUM_HDR_PINS; pin++)
+    {
+        PINCTRL_TABLES_PIN_T *entry = &tables->pins[pin - 1];
+        unsigned gpio = gpio_for_pin(pin);
+        const char *name = gpio_get_name(gpio);
+        unsigned i;
+        int c;
+
+        if (name && strchr(name, '/'))
+            name = strchr(name, '/') + 1;
+        if (tables_add_string(&tables->strings, name ? name : "", &entry->name))
+            return -1;
+        if (!gpio_num_is_valid(gpio))
+            continue;
+
+        // Find the chip by its driver name, if it was exported
+        for (c = 0; c < num_chips; c++)
+        {
+            if (gpio < chips[c].base || gpio >= chips[c].base + chips[c].num_gpios)
+                continue;
+            for (i = 0; i < tables->num_chips; i++)
+            {
+                PINCTRL_TABLES_CHIP_T *chip = &tables->chips[i];
+                unsigned offset = gpio - chips[c].base;
+
+                if (strcmp(tables->strings.data + chip->name, chips[c].name) ||
+                    offset >= chip->num_gpios)
+                    continue;
+                entry->chip = i;
+                entry->gpio = offset;
+                tables->gpios[chip->gpios_offset + offset].pin = pin;
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+static int tables_write(TABLES_T *tables, const char *fname)
+{
+    PINCTRL_TABLES_HEADER_T hdr;
+    uint32_t gpios_offset, strings_offset;
+    unsigned i, j;
+    FILE *fp;
+    int ret = 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PINCTRL_TABLES_MAGIC, sizeof(hdr.magic));
+    hdr.version = PINCTRL_TABLES_VERSION;
+    hdr.num_chips = tables->num_chips;
+    hdr.num_pins = NUM_HDR_PINS;
+    hdr.chips_offset = sizeof(hdr);
+    hdr.pins_offset = hdr.chips_offset + tables->num_chips * sizeof(PINCTRL_TABLES_CHIP_T);
+    gpios_offset = hdr.pins_offset + NUM_HDR_PINS * sizeof(PINCTRL_TABLES_PIN_T);
+    strings_offset = gpios_offset + tables->num_gpios * sizeof(PINCTRL_TABLES_GPIO_T);
+    hdr.size = strings_offset + tables->strings.size;
+
+    // Make the string offsets and GPIO indexes relative to the file
+    for (i = 0; i < tables->num_chips; i++)
+    {
+        tables->chips[i].name += strings_offset;
+        tables->chips[i].gpios_offset = gpios_offset +
+            tables->chips[i].gpios_offset * sizeof(PINCTRL_TABLES_GPIO_T);
+    }
+    for (i = 0; i < NUM_HDR_PINS; i++)
+    {
+        if (tables->pins[i].name)
+            tables->pins[i].name += strings_offset;
+    }
+    for (i = 0; i < tables->num_gpios; i++)
+    {
+        PINCTRL_TABLES_GPIO_T *gpio = &tables->gpios[i];
+
+        if (gpio->name)
+            gpio->name += strings_offset;
+        for (j = 0; j < PINCTRL_TABLES_NUM_ALTS; j++)
+        {
+            if (gpio->alts[j])
+                gpio->alts[j] += strings_offset;
+        }
+    }
+
+    fp = fopen(fname, "wb");
+    if (!fp)
+    {
+        printf("Failed to create '%s' - %s\n", fname, strerror(errno));
+        return -1;
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fwrite(tables->chips, sizeof(PINCTRL_TABLES_CHIP_T), tables->num_chips, fp) != tables->num_chips ||
+        fwrite(tables->pins, sizeof(PINCTRL_TABLES_PIN_T), NUM_HDR_PINS, fp) != NUM_HDR_PINS ||
+        fwrite(tables->gpios, sizeof(PINCTRL_TABLES_GPIO_T), tables->num_gpios, fp) != tables->num_gpios ||
+        fwrite(tables->strings.data, 1, tables->strings.size, fp) != tables->strings.size)
+        ret = -1;
+    if (fclose(fp) != 0)
+        ret = -1;
+    if (ret)
+        printf("Failed to write '%s'\n", fname);
+    return ret;
+}
+
+int tables_export(const char *fname)
+{
+    const char *drivers[TABLES_MAX_CHIPS];
+    TABLES_T *tables;
+    int num_drivers, i;
+    int status;
+    int ret = 0;
+
+    tables = calloc(1, sizeof(*tables));
+    if (!tables)
+        return -1;
+
+    num_drivers = gpiolib_get_drivers(drivers, TABLES_MAX_CHIPS);
+    if (num_drivers > TABLES_MAX_CHIPS)
+        num_drivers = TABLES_MAX_CHIPS;
+
+    fflush(stdout);
+    for (i = 0; i < num_drivers; i++)
+    {
+        int fds[2];
+        FILE *fp;
+        pid_t pid;
+
+        // The simulator just wraps another chip
+        if (strcmp(drivers[i], "sim") == 0)
+            continue;
+
+        ret = -1;
+        if (pipe(fds) != 0)
+            break;
+        pid = fork();
+        if (pid == 0)
+        {
+            close(fds[0]);
+            _exit(tables_dump_chip(drivers[i], fds[1]) ? 1 : 0);
+        }
+        close(fds[1]);
+        if (pid < 0)
+        {
+            close(fds[0]);
+            break;
+        }
+
+        fp = fdopen(fds[0], "r");
+        if (fp)
+        {
+            ret = tables_read_chip(tables, drivers[i], fp);
+            fclose(fp);
+        }
+        else
+        {
+            close(fds[0]);
+        }
+        // The child's table is only complete if it exited cleanly
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0)
+            ret = -1;
+        if (ret)
+            break;
+    }
+
+    if (!ret)
+        ret = tables_map_pins(tables);
+    if (ret)
+        printf("Failed to read the GPIO chip tables\n");
+    else
+        ret = tables_write(tables, fname);
+
+    free(tables->strings.data);
+    free(tables);
+    return ret;
+}
@@ -0,0 +1,10 @@
+#ifndef TABLES_H
+#define TABLES_H
+
+/* Writes the GPIO tables of every chip driver to fname, in the format
+ * described in pinctrl_tables.h. Must be called before gpiolib is
+ * initialised, which it does itself to map the header pins.
+ */
+int tables_export(const char *fname);
+
+#endif
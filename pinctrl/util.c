@@ -7,15 +7,60 @@
 
 #include "util.h"
 
-// We're actually going to cheat and cast the pointers, but define
-// a structure to keep the compiler happy.
+#define FDT_MAGIC       0xd00dfeed
+#define FDT_BEGIN_NODE  1
+#define FDT_END_NODE    2
+#define FDT_PROP        3
+#define FDT_NOP         4
+#define FDT_END         9
+
+#define FDT_MAX_DEPTH   32
 
 struct dt_subnode_iter
 {
     DIR *dh;
+    unsigned next;       // Next FDT node to consider
+    const char *parent;  // FDT parent path
 };
 
+typedef struct
+{
+    const char *name;
+    const uint8_t *data;
+    uint32_t len;
+} DT_PROP_T;
+
+typedef struct
+{
+    char *path;
+    unsigned first_prop;
+    unsigned num_props;
+} DT_NODE_T;
+
+// A flattened device tree, indexed once on loading
+typedef struct
+{
+    uint8_t *blob;
+    DT_NODE_T *nodes;
+    unsigned num_nodes;
+    DT_PROP_T *props;
+    unsigned num_props;
+    unsigned *path_hash;  // Node index + 1, or 0 for an empty slot
+    unsigned hash_size;   // A power of two
+} DT_FDT_T;
+
+// Property reads captured for dt_load_record
+typedef struct
+{
+    int active;
+    uint8_t *buf;
+    size_t len;
+    size_t size;
+} DT_RECORD_T;
+
 const char *dtpath;
+static DT_FDT_T fdt;
+static DT_RECORD_T dt_rec;
 
 static void *do_read_file(const char *fname, const char *mode, size_t *plen)
 {
@@ -44,6 +89,26 @@ static void *do_read_file(const char *fname, const char *mode, size_t *plen)
     return (char *)buf;
 }
 
+uint64_t get_time_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t fnv1a(uint64_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    while (len--)
+    {
+        hash ^= *(p++);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
 char *read_text_file(const char *fname, size_t *plen)
 {
     return do_read_file(fname, "rt", plen);
@@ -54,16 +119,306 @@ void *read_file(const char *fname, size_t *plen)
     return do_read_file(fname, "rb", plen);
 }
 
+static uint32_t fdt_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | ((uint32_t)p[3] << 0);
+}
+
+static int fdt_build_path_hash(void)
+{
+    unsigned i;
+
+    fdt.hash_size = 16;
+    while (fdt.hash_size < fdt.num_nodes * 2)
+        fdt.hash_size *= 2;
+    fdt.path_hash = calloc(fdt.hash_size, sizeof(unsigned));
+    if (!fdt.path_hash)
+        return -1;
+
+    for (i = 0; i < fdt.num_nodes; i++)
+    {
+        const char *path = fdt.nodes[i].path;
+        unsigned slot = fnv1a(FNV1A_INIT, path, strlen(path)) & (fdt.hash_size - 1);
+
+        while (fdt.path_hash[slot])
+            slot = (slot + 1) & (fdt.hash_size - 1);
+        fdt.path_hash[slot] = i + 1;
+    }
+    return 0;
+}
+
+static void dt_unload_fdt(void)
+{
+    unsigned i;
+
+    for (i = 0; i < fdt.num_nodes; i++)
+        free(fdt.nodes[i].path);
+    free(fdt.path_hash);
+    free(fdt.nodes);
+    free(fdt.props);
+    free(fdt.blob);
+    memset(&fdt, 0, sizeof(fdt));
+}
+
 void dt_set_path(const char *path)
 {
+    dt_unload_fdt();
     dtpath = path;
 }
 
-char *dt_read_prop(const char *node, const char *prop, size_t *plen)
+int dt_load_fdt(const char *fname)
+{
+    size_t size;
+    void *blob;
+
+    blob = read_file(fname, &size);
+    if (!blob)
+    {
+        dt_unload_fdt();
+        return -1;
+    }
+    return dt_load_fdt_buf(blob, size);
+}
+
+int dt_load_fdt_buf(void *buf, size_t size)
+{
+    char path[FILENAME_MAX];
+    size_t path_lens[FDT_MAX_DEPTH + 1];
+    uint32_t off_struct, size_struct, off_strings, size_strings;
+    unsigned max_nodes, max_props, depth = 0;
+    const uint8_t *p, *end;
+    uint8_t *blob = buf;
+
+    dt_unload_fdt();
+
+    if (size < 40 || fdt_be32(blob) != FDT_MAGIC || fdt_be32(blob + 4) > size)
+        goto fail;
+    off_struct = fdt_be32(blob + 8);
+    off_strings = fdt_be32(blob + 12);
+    size_strings = fdt_be32(blob + 32);
+    size_struct = fdt_be32(blob + 36);
+    if (off_struct > size || size_struct > size - off_struct ||
+        off_strings > size || size_strings > size - off_strings)
+        goto fail;
+
+    // Every node and property needs at least 8 bytes of structure
+    max_nodes = max_props = size_struct / 8;
+    fdt.blob = blob;
+    fdt.nodes = calloc(max_nodes, sizeof(DT_NODE_T));
+    fdt.props = calloc(max_props, sizeof(DT_PROP_T));
+    if (!fdt.nodes || !fdt.props)
+        goto fail;
+
+    path_lens[0] = 0;
+    p = blob + off_struct;
+    end = p + size_struct;
+    while (p + 4 <= end)
+    {
+        uint32_t token = fdt_be32(p);
+
+        p += 4;
+        if (token == FDT_BEGIN_NODE)
+        {
+            const char *name = (const char *)p;
+            size_t name_len = strnlen(name, end - p);
+            size_t len = path_lens[depth];
+            DT_NODE_T *node;
+
+            if (name_len == (size_t)(end - p) || depth == FDT_MAX_DEPTH ||
+                fdt.num_nodes == max_nodes)
+                goto fail;
+            p += ROUND_UP(name_len + 1, 4);
+
+            if (depth == 0)
+                len = snprintf(path, sizeof(path), "/");
+            else
+                len += snprintf(path + len, sizeof(path) - len, "%s%s",
+                                (depth == 1) ? "" : "/", name);
+            if (len >= sizeof(path))
+                goto fail;
+            path_lens[++depth] = len;
+
+            node = &fdt.nodes[fdt.num_nodes++];
+            node->path = strdup(path);
+            node->first_prop = fdt.num_props;
+            if (!node->path)
+                goto fail;
+        }
+        else if (token == FDT_END_NODE)
+        {
+            if (!depth)
+                goto fail;
+            depth--;
+            path[path_lens[depth]] = '\0';
+        }
+        else if (token == FDT_PROP)
+        {
+            DT_PROP_T *prop;
+            uint32_t len, nameoff;
+
+            if (p + 8 > end || !fdt.num_nodes || fdt.num_props == max_props)
+                goto fail;
+            len = fdt_be32(p);
+            nameoff = fdt_be32(p + 4);
+            p += 8;
+            if (len > (size_t)(end - p) || nameoff >= size_strings)
+                goto fail;
+
+            prop = &fdt.props[fdt.num_props++];
+            prop->name = (const char *)blob + off_strings + nameoff;
+            prop->data = p;
+            prop->len = len;
+            // A node's properties precede its subnodes
+            fdt.nodes[fdt.num_nodes - 1].num_props++;
+            p += ROUND_UP(len, 4);
+        }
+        else if (token == FDT_END)
+        {
+            break;
+        }
+        else if (token != FDT_NOP)
+        {
+            goto fail;
+        }
+    }
+
+    if (fdt_build_path_hash() != 0)
+        goto fail;
+
+    return 0;
+
+fail:
+    if (!fdt.blob)
+        free(blob);
+    dt_unload_fdt();
+    return -1;
+}
+
+// Resolve trailing "/.." (parent) and "/" components
+static int fdt_normalise_path(const char *node, char *path, size_t size)
+{
+    size_t len = strlen(node);
+
+    if (len >= size)
+        return -1;
+    memcpy(path, node, len + 1);
+
+    while (len > 1)
+    {
+        if (len >= 3 && strcmp(path + len - 3, "/..") == 0)
+        {
+            char *slash;
+
+            path[len - 3] = '\0';
+            slash = strrchr(path, '/');
+            if (!slash)
+                return -1;
+            slash[(slash == path) ? 1 : 0] = '\0';
+        }
+        else if (path[len - 1] == '/')
+        {
+            path[len - 1] = '\0';
+        }
+        else
+        {
+            break;
+        }
+        len = strlen(path);
+    }
+    return 0;
+}
+
+static const DT_NODE_T *fdt_find_node(const char *node)
+{
+    char path[FILENAME_MAX];
+    unsigned slot, i;
+
+    if (fdt_normalise_path(node, path, sizeof(path)) != 0)
+        return NULL;
+
+    slot = fnv1a(FNV1A_INIT, path, strlen(path)) & (fdt.hash_size - 1);
+    while ((i = fdt.path_hash[slot]) != 0)
+    {
+        if (strcmp(fdt.nodes[i - 1].path, path) == 0)
+            return &fdt.nodes[i - 1];
+        slot = (slot + 1) & (fdt.hash_size - 1);
+    }
+    return NULL;
+}
+
+static char *fdt_read_prop(const char *node, const char *prop, size_t *plen)
+{
+    const DT_NODE_T *n = fdt_find_node(node);
+    unsigned i;
+
+    for (i = 0; n && i < n->num_props; i++)
+    {
+        const DT_PROP_T *p = &fdt.props[n->first_prop + i];
+        char *buf;
+
+        if (strcmp(p->name, prop) != 0)
+            continue;
+        // Returned as a copy, so callers can modify and dt_free it
+        buf = malloc(p->len ? p->len : 1);
+        if (buf)
+        {
+            memcpy(buf, p->data, p->len);
+            if (plen)
+                *plen = p->len;
+        }
+        return buf;
+    }
+    return NULL;
+}
+
+static void dt_record_prop(const char *node, const char *prop,
+                           const void *value, size_t value_len)
+{
+    uint32_t lens[3];
+    size_t need;
+
+    lens[0] = strlen(node) + 1;
+    lens[1] = strlen(prop) + 1;
+    lens[2] = value_len;
+    need = sizeof(lens) + lens[0] + lens[1] + lens[2];
+
+    if (dt_rec.len + need > dt_rec.size)
+    {
+        size_t new_size = dt_rec.size ? dt_rec.size : 4096;
+        uint8_t *new_buf;
+
+        while (dt_rec.len + need > new_size)
+            new_size *= 2;
+        new_buf = realloc(dt_rec.buf, new_size);
+        if (!new_buf)
+        {
+            // An incomplete record is useless
+            dt_rec.active = 0;
+            return;
+        }
+        dt_rec.buf = new_buf;
+        dt_rec.size = new_size;
+    }
+
+    memcpy(dt_rec.buf + dt_rec.len, lens, sizeof(lens));
+    dt_rec.len += sizeof(lens);
+    memcpy(dt_rec.buf + dt_rec.len, node, lens[0]);
+    dt_rec.len += lens[0];
+    memcpy(dt_rec.buf + dt_rec.len, prop, lens[1]);
+    dt_rec.len += lens[1];
+    memcpy(dt_rec.buf + dt_rec.len, value, lens[2]);
+    dt_rec.len += lens[2];
+}
+
+static char *dt_read_prop_uncached(const char *node, const char *prop, size_t *plen)
 {
     char filename[FILENAME_MAX];
     size_t len;
 
+    if (fdt.blob)
+        return fdt_read_prop(node, prop, plen);
+
     len = snprintf(filename, sizeof(filename), "%s%s/%s", dtpath, node, prop);
     if (len >= sizeof(filename))
     {
@@ -76,6 +431,134 @@ char *dt_read_prop(const char *node, const char *prop, size_t *plen)
     return read_file(filename, plen);
 }
 
+char *dt_read_prop(const char *node, const char *prop, size_t *plen)
+{
+    size_t len = 0;
+    char *value;
+
+    if (!dt_rec.active)
+        return dt_read_prop_uncached(node, prop, plen);
+
+    value = dt_read_prop_uncached(node, prop, &len);
+    if (plen)
+        *plen = len;
+    // Absent properties needn't be recorded - they will be absent on replay
+    if (value)
+        dt_record_prop(node, prop, value, len);
+    return value;
+}
+
+void dt_record_start(void)
+{
+    dt_rec.active = 1;
+    dt_rec.len = 0;
+}
+
+void *dt_record_stop(size_t *plen)
+{
+    void *buf = dt_rec.active ? dt_rec.buf : NULL;
+
+    *plen = dt_rec.len;
+    if (!buf)
+        free(dt_rec.buf);
+    memset(&dt_rec, 0, sizeof(dt_rec));
+    return buf;
+}
+
+int dt_load_record(void *buf, size_t size)
+{
+    char path[FILENAME_MAX];
+    const uint8_t *p, *end;
+    unsigned *entry_nodes = NULL;
+    unsigned num_entries = 0;
+    unsigned i, n;
+
+    dt_unload_fdt();
+
+    // Count and validate the entries
+    for (p = buf, end = p + size; p < end; num_entries++)
+    {
+        uint32_t lens[3];
+
+        if ((size_t)(end - p) < sizeof(lens))
+            goto fail;
+        memcpy(lens, p, sizeof(lens));
+        p += sizeof(lens);
+        if (!lens[0] || !lens[1] ||
+            lens[0] > (size_t)(end - p) || lens[1] > (size_t)(end - p) - lens[0] ||
+            lens[2] > (size_t)(end - p) - lens[0] - lens[1] ||
+            p[lens[0] - 1] || p[lens[0] + lens[1] - 1])
+            goto fail;
+        p += lens[0] + lens[1] + lens[2];
+    }
+
+    fdt.blob = buf;
+    fdt.nodes = calloc(num_entries + 1, sizeof(DT_NODE_T));
+    fdt.props = calloc(num_entries + 1, sizeof(DT_PROP_T));
+    entry_nodes = calloc(num_entries + 1, sizeof(unsigned));
+    if (!fdt.nodes || !fdt.props || !entry_nodes)
+        goto fail;
+
+    // Find the distinct nodes
+    for (i = 0, p = buf; i < num_entries; i++)
+    {
+        uint32_t lens[3];
+
+        memcpy(lens, p, sizeof(lens));
+        if (fdt_normalise_path((const char *)p + sizeof(lens), path, sizeof(path)) != 0)
+            goto fail;
+        for (n = 0; n < fdt.num_nodes; n++)
+        {
+            if (strcmp(fdt.nodes[n].path, path) == 0)
+                break;
+        }
+        if (n == fdt.num_nodes)
+        {
+            fdt.nodes[n].path = strdup(path);
+            if (!fdt.nodes[n].path)
+                goto fail;
+            fdt.num_nodes++;
+        }
+        entry_nodes[i] = n;
+        p += sizeof(lens) + lens[0] + lens[1] + lens[2];
+    }
+
+    // Gather each node's properties together
+    for (n = 0; n < fdt.num_nodes; n++)
+    {
+        fdt.nodes[n].first_prop = fdt.num_props;
+        for (i = 0, p = buf; i < num_entries; i++)
+        {
+            uint32_t lens[3];
+
+            memcpy(lens, p, sizeof(lens));
+            if (entry_nodes[i] == n)
+            {
+                DT_PROP_T *prop = &fdt.props[fdt.num_props++];
+
+                prop->name = (const char *)p + sizeof(lens) + lens[0];
+                prop->data = p + sizeof(lens) + lens[0] + lens[1];
+                prop->len = lens[2];
+                fdt.nodes[n].num_props++;
+            }
+            p += sizeof(lens) + lens[0] + lens[1] + lens[2];
+        }
+    }
+
+    free(entry_nodes);
+    entry_nodes = NULL;
+    if (fdt_build_path_hash() != 0)
+        goto fail;
+    return 0;
+
+fail:
+    free(entry_nodes);
+    if (!fdt.blob)
+        free(buf);
+    dt_unload_fdt();
+    return -1;
+}
+
 uint32_t *dt_read_cells(const char *node, const char *prop, unsigned *num_cells)
 {
     uint8_t *buf;
@@ -226,30 +709,85 @@ void dt_free(void *value)
 DT_SUBNODE_HANDLE dt_open_subnodes(const char *node)
 {
     char dirpath[FILENAME_MAX];
+    DT_SUBNODE_HANDLE handle;
+    const DT_NODE_T *n = NULL;
     size_t len;
 
-    len = snprintf(dirpath, sizeof(dirpath), "%s%s", dtpath, node);
-    if (len >= sizeof(dirpath))
+    if (fdt.blob)
     {
-        assert(0);
+        n = fdt_find_node(node);
+        if (!n)
+            return NULL;
+    }
+    else
+    {
+        len = snprintf(dirpath, sizeof(dirpath), "%s%s", dtpath, node);
+        if (len >= sizeof(dirpath))
+        {
+            assert(0);
+            return NULL;
+        }
+    }
+
+    handle = calloc(1, sizeof(*handle));
+    if (!handle)
         return NULL;
+    if (n)
+    {
+        handle->parent = n->path;
+        handle->next = (n - fdt.nodes) + 1;
+    }
+    else
+    {
+        handle->dh = opendir(dirpath);
+        if (!handle->dh)
+        {
+            free(handle);
+            return NULL;
+        }
     }
-    return (DT_SUBNODE_HANDLE)opendir(dirpath);
+    return handle;
 }
 
 const char *dt_next_subnode(DT_SUBNODE_HANDLE handle)
 {
-    DIR *dirh = (DIR *)handle;
     struct dirent *dent;
+    size_t parent_len;
 
-    dent = readdir(dirh);
+    if (handle->dh)
+    {
+        // Skip the properties, which are files, as the FDT iteration does
+        while ((dent = readdir(handle->dh)) != NULL)
+        {
+            if (dent->d_name[0] == '.' ||
+                (dent->d_type != DT_DIR && dent->d_type != DT_UNKNOWN))
+                continue;
+            return dent->d_name;
+        }
+        return NULL;
+    }
 
-    return dent ? dent->d_name : NULL;
+    // Nodes are in depth-first order, so the children follow the parent
+    parent_len = strlen(handle->parent);
+    if (parent_len == 1)
+        parent_len = 0;
+    while (handle->next < fdt.num_nodes)
+    {
+        const char *path = fdt.nodes[handle->next++].path;
+
+        if (strncmp(path, handle->parent, parent_len) != 0 ||
+            path[parent_len] != '/')
+            break;
+        if (!strchr(path + parent_len + 1, '/'))
+            return path + parent_len + 1;
+    }
+    handle->next = fdt.num_nodes;
+    return NULL;
 }
 
 void dt_close_subnodes(DT_SUBNODE_HANDLE handle)
 {
-    DIR *dirh = (DIR *)handle;
-
-    closedir(dirh);
+    if (handle->dh)
+        closedir(handle->dh);
+    free(handle);
 }
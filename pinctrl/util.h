@@ -3,19 +3,42 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <time.h>
 
 #define INVALID_ADDRESS ((uint64_t)~0)
 #define ROUND_UP(n, d) ((((n) + (d) - 1) / (d)) * (d))
 #define UNUSED(x) (void)(x)
 #define ARRAY_SIZE(_a) (sizeof(_a)/sizeof(_a[0]))
+#define MASK64(n) (((n) >= 64) ? ~(uint64_t)0 : (((uint64_t)1 << (n)) - 1))
 
 typedef struct dt_subnode_iter *DT_SUBNODE_HANDLE;
+
+/* The time on the given clock (e.g. CLOCK_MONOTONIC) in nanoseconds */
+uint64_t get_time_ns(clockid_t clock);
+
+/* Adds len bytes to a 64-bit FNV-1a hash, which starts as FNV1A_INIT. Hash
+ * tables can use the low bits.
+ */
+#define FNV1A_INIT 14695981039346656037ull
+uint64_t fnv1a(uint64_t hash, const void *data, size_t len);
+
 char *read_text_file(const char *fname, size_t *plen);
 
 void *read_file(const char *fname, size_t *plen);
 
 void dt_set_path(const char *path);
 
+int dt_load_fdt(const char *fname);
+
+int dt_load_fdt_buf(void *buf, size_t size);
+
+/* Capture the properties read between start and stop, for dt_load_record */
+void dt_record_start(void);
+
+void *dt_record_stop(size_t *plen);
+
+int dt_load_record(void *buf, size_t size);
+
 char *dt_read_prop(const char *node, const char *prop, size_t *len);
 
 uint32_t *dt_read_cells(const char *node, const char *prop, unsigned *num_cells);